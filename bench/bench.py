@@ -0,0 +1,322 @@
+#!/usr/bin/env python3
+"""Benchmark of the binary translator.
+
+Every program of data/ and of a generated corpus is translated and executed by the translator in
+benchmark mode (--bench), once per configuration. Translation and execution are measured
+separately inside the translator; the emulator, if given, is timed as a whole process.
+Results go to a JSON file, a summary table is printed.
+"""
+
+import argparse
+import json
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+CONFIGS = {
+    "jit":     [],
+    "jit-opt": ["--reg-stack", "--peephole", "--const-fold", "--short-branches", "--licm"],
+}
+
+#=====================================================================================#
+#                                   CORPUS GENERATOR                                  #
+#=====================================================================================#
+
+HLT, CALL, JMP, JAE, JA, JBE, JB, JE, JNE, RET, IN, OUT, PUSH, POP, ADD, SUB, MUL, DVD, SQRT = range(19)
+AX, BX, CX, DX = 1, 2, 3, 4
+
+
+class Program:
+    """Bytecode builder; jumps to labels are patched in link ()"""
+
+    def __init__(self):
+        self.code   = bytearray()
+        self.labels = {}
+        self.fixups = []
+
+    def op(self, opcode):
+        self.code.append(opcode)
+
+    def push_num(self, num):
+        self.code += bytes([PUSH, 0, 0, 1]) + struct.pack("<d", num)
+
+    def push_reg(self, reg):
+        self.code += bytes([PUSH, 0, reg, 0])
+
+    def pop_reg(self, reg):
+        self.code += bytes([POP, 0, reg, 0])
+
+    def jump(self, opcode, label):
+        self.code.append(opcode)
+        self.fixups.append((len(self.code), label))
+        self.code += bytes(4)
+
+    def label(self, name):
+        self.labels[name] = len(self.code)
+
+    def link(self):
+        for offset, label in self.fixups:
+            self.code[offset:offset + 4] = struct.pack("<i", self.labels[label])
+        return bytes(self.code)
+
+
+def put_loop(prog, name, n_iterations, put_body):
+    """for (cx = 0; cx < n_iterations; cx++) body; cx is saved around the body"""
+    prog.push_num(0)
+    prog.pop_reg(CX)
+    prog.label(name)
+    prog.push_reg(CX)
+    prog.push_num(n_iterations)
+    prog.jump(JAE, name + "_end")
+
+    prog.push_reg(CX)
+    put_body()
+    prog.pop_reg(CX)
+
+    prog.push_reg(CX)
+    prog.push_num(1)
+    prog.op(ADD)
+    prog.pop_reg(CX)
+    prog.jump(JMP, name)
+    prog.label(name + "_end")
+
+
+def put_arithmetics(prog, rng, n_ops, const_share):
+    """n_ops updates of ax, bx and dx that keep them bounded:
+    reg = reg * k + c, reg = (reg + other) / 2 or reg = sqrt (reg * k + c)"""
+    regs = (AX, BX, DX)
+
+    for _ in range(n_ops):
+        reg = rng.choice(regs)
+        kind = rng.random()
+
+        if kind < const_share:
+            # a constant subexpression the constant folder can evaluate
+            prog.push_num(rng.uniform(1, 4))
+            prog.push_num(rng.uniform(1, 4))
+            prog.op(rng.choice((ADD, MUL)))
+            prog.push_num(rng.uniform(1, 4))
+            prog.op(DVD)
+            prog.pop_reg(reg)
+            continue
+
+        if kind < 0.6:
+            prog.push_reg(reg)
+            prog.push_num(rng.uniform(0.3, 0.9))
+            prog.op(MUL)
+            prog.push_num(rng.uniform(-5, 5))
+            prog.op(ADD)
+        elif kind < 0.9:
+            prog.push_reg(reg)
+            prog.push_reg(rng.choice(regs))
+            prog.op(ADD)
+            prog.push_num(2)
+            prog.op(DVD)
+        else:
+            prog.push_reg(reg)
+            prog.push_reg(reg)
+            prog.op(MUL)
+            prog.push_num(rng.uniform(1, 5))
+            prog.op(ADD)
+            prog.op(SQRT)
+
+        prog.pop_reg(reg)
+
+
+def init_regs(prog):
+    for reg in (AX, BX, DX):
+        prog.push_num(1)
+        prog.pop_reg(reg)
+
+
+def put_result(prog):
+    """prints ax, bx and dx, so that configurations can be checked against each other"""
+    for reg in (AX, BX, DX):
+        prog.push_reg(reg)
+        prog.op(OUT)
+    prog.op(HLT)
+
+
+def straight_line(rng, n_ops, n_iterations, const_share):
+    prog = Program()
+    init_regs(prog)
+    put_loop(prog, "loop", n_iterations, lambda: put_arithmetics(prog, rng, n_ops, const_share))
+    put_result(prog)
+    return prog.link()
+
+
+def procedures(rng, n_procs, n_ops, n_iterations):
+    prog = Program()
+    init_regs(prog)
+
+    def call_all():
+        for proc_i in range(n_procs):
+            prog.jump(CALL, "proc_%d" % proc_i)
+
+    put_loop(prog, "loop", n_iterations, call_all)
+    put_result(prog)
+
+    for proc_i in range(n_procs):
+        prog.label("proc_%d" % proc_i)
+        put_arithmetics(prog, rng, n_ops, 0.1)
+        prog.op(RET)
+
+    return prog.link()
+
+
+def nested_loops(rng, depth, n_iterations, n_ops):
+    prog = Program()
+    init_regs(prog)
+
+    def level(level_i):
+        if level_i == depth:
+            put_arithmetics(prog, rng, n_ops, 0.1)
+        else:
+            put_loop(prog, "loop_%d" % level_i, n_iterations, lambda: level(level_i + 1))
+
+    level(0)
+    put_result(prog)
+    return prog.link()
+
+
+def generate_corpus(directory, seed):
+    rng = random.Random(seed)
+    programs = {
+        "gen_straight_small":  straight_line(rng, 100,   10000, 0.1),
+        "gen_straight_medium": straight_line(rng, 1000,  1000,  0.1),
+        "gen_straight_large":  straight_line(rng, 10000, 100,   0.1),
+        "gen_constants":       straight_line(rng, 2000,  500,   0.6),
+        "gen_procedures":      procedures(rng, 200, 20, 500),
+        "gen_nested_loops":    nested_loops(rng, 3, 30, 50),
+    }
+
+    os.makedirs(directory, exist_ok=True)
+    paths = []
+    for name, code in programs.items():
+        path = os.path.join(directory, name + ".bin")
+        with open(path, "wb") as file:
+            file.write(code)
+        paths.append(path)
+
+    return paths
+
+#=====================================================================================#
+
+#=====================================================================================#
+#                                     MEASUREMENTS                                    #
+#=====================================================================================#
+
+def percentile(sorted_ns, percent):
+    """nearest-rank percentile, the same as in the translator"""
+    rank = -(-percent * len(sorted_ns) // 100)
+    return sorted_ns[max(rank, 1) - 1]
+
+
+def stats(samples_ns):
+    samples = sorted(samples_ns)
+    mean = sum(samples) / len(samples)
+    variance = sum((x - mean) ** 2 for x in samples) / max(len(samples) - 1, 1)
+    result = {"unit": "ns", "samples": len(samples), "batch": 1, "min": samples[0], "max": samples[-1],
+              "mean": mean, "stddev": variance ** 0.5}
+    for percent in (5, 25, 50, 75, 95):
+        result["median" if percent == 50 else "p%d" % percent] = percentile(samples, percent)
+    return result
+
+
+def input_file():
+    """numbers for programs with "in": every run reads as many as it needs"""
+    file = tempfile.TemporaryFile("w+")
+    file.write("1\n" * 100000)
+    file.seek(0)
+    return file
+
+
+def run_translator(translator, program, flags, args):
+    with tempfile.NamedTemporaryFile(suffix=".json") as report, input_file() as stdin:
+        command = [translator] + flags + ["--bench", report.name, "--bench-runs", str(args.runs),
+                                          "--bench-warmup", str(args.warmup), program]
+        subprocess.run(command, stdin=stdin, stdout=subprocess.DEVNULL, check=True, timeout=args.timeout)
+        return json.load(report)
+
+
+def run_emulator(emulator, program, args):
+    command = emulator.replace("{input}", program).split()
+    samples = []
+    for run_i in range(args.warmup + args.runs):
+        with input_file() as stdin:
+            start = time.perf_counter_ns()
+            subprocess.run(command, stdin=stdin, stdout=subprocess.DEVNULL, check=True, timeout=args.timeout)
+            duration = time.perf_counter_ns() - start
+        if run_i >= args.warmup:
+            samples.append(duration)
+
+    return {"program": os.path.basename(program), "execution": stats(samples)}
+
+#=====================================================================================#
+
+
+def print_summary(results):
+    print("%-28s %-8s %14s %14s %14s %9s" %
+          ("program", "config", "translate, us", "execute, us", "p95, us", "vs jit"))
+
+    jit_median = {r["program"]: r["execution"]["median"] for r in results if r["config"] == "jit"}
+
+    for result in results:
+        translation = result.get("translation")
+        execution   = result["execution"]
+        base = jit_median.get(result["program"])
+        print("%-28s %-8s %14s %14.3f %14.3f %9s" %
+              (result["program"], result["config"],
+               "%.3f" % (translation["median"] / 1000) if translation else "-",
+               execution["median"] / 1000, execution["p95"] / 1000,
+               "%.3gx" % (base / execution["median"]) if base and execution["median"] else "-"))
+
+
+def main():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--translator", default=os.path.join(root, "bin", "Binary_Translator.out"))
+    parser.add_argument("--emulator", help='command running the processor emulator, "{input}" is the bytecode file')
+    parser.add_argument("--runs",     type=int, default=21, help="measured samples of each stage")
+    parser.add_argument("--warmup",   type=int, default=3,  help="runs of each stage before measurements")
+    parser.add_argument("--timeout",  type=int, default=600)
+    parser.add_argument("--seed",     type=int, default=1,  help="seed of the generated corpus")
+    parser.add_argument("--corpus",   default=os.path.join(root, "build", "bench_corpus"))
+    parser.add_argument("--output",   default=os.path.join(root, "build", "bench.json"))
+    args = parser.parse_args()
+
+    data = os.path.join(root, "data")
+    programs = sorted(os.path.join(data, name) for name in os.listdir(data) if name.endswith(".bin"))
+    programs += generate_corpus(args.corpus, args.seed)
+
+    results = []
+    for program in programs:
+        for config, flags in CONFIGS.items():
+            result = run_translator(args.translator, program, flags, args)
+            result["program"] = os.path.basename(program)
+            result["config"]  = config
+            results.append(result)
+
+        if args.emulator:
+            result = run_emulator(args.emulator, program, args)
+            result["config"] = "emulator"
+            results.append(result)
+
+    report = {"translator": args.translator, "runs": args.runs, "warmup": args.warmup, "seed": args.seed,
+              "results": results}
+
+    os.makedirs(os.path.dirname(os.path.abspath(args.output)), exist_ok=True)
+    with open(args.output, "w") as file:
+        json.dump(report, file, indent=4)
+
+    print_summary(results)
+    print("Report is written to \"%s\"" % args.output)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
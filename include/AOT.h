@@ -0,0 +1,13 @@
+#ifndef AOT_INCLUDED
+#define AOT_INCLUDED
+
+#include "Binary_Translator.h"
+
+// RAM of a static executable, r15 points at it. The executable maps nothing else from 2 GB below
+// to 6 GB above it (the text segment is at 4 MiB), so accesses out of bounds fault like in JIT mode
+#define AOT_RAM_VADDR 0xC0000000
+
+int Write_ELF (const char *const name, const char *const x86_code, const long x86_size,
+               const struct Relocs *const relocs);
+
+#endif
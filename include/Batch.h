@@ -0,0 +1,12 @@
+#ifndef BATCH_INCLUDED
+#define BATCH_INCLUDED
+
+#include "Binary_Translator.h"
+
+// Runs the jobs of a manifest on options->n_threads workers. A line of the manifest is
+// "program input [output]" separated by spaces or tabs; empty lines and lines starting with '#' are skipped.
+// Every distinct program is translated once and its code is shared by all workers. Without an output file
+// the numbers of the job go to /dev/null.
+int Batch (const char *const manifest_name, const struct Tr_Options *const options);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef BENCHMARK_INCLUDED
+#define BENCHMARK_INCLUDED
+
+#include "Binary_Translator.h"
+#include <time.h>
+
+// Durations of repeated runs of one stage in nanoseconds
+struct Samples
+{
+    long *ns;
+    int n_samples;
+};
+
+static inline long Clock_Ns (void)
+{
+    struct timespec time = {};
+    clock_gettime (CLOCK_MONOTONIC_RAW, &time);
+
+    return time.tv_sec * 1000000000L + time.tv_nsec;
+}
+
+int Write_Bench_Report (const char *const input_name, const struct Tr_Options *const options,
+                        struct Samples *const translation, struct Samples *const execution,
+                        const long n_batch, const long x86_size);
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef BIN_TR_LIB_INCLUDED
+#define BIN_TR_LIB_INCLUDED
+
+#include <stdbool.h>
+
+// Binary translator as a library (libBinary_Translator.a, libBinary_Translator.so): bytecode is translated
+// once into a code handle, which any number of instances execute. An instance has its own RAM, registers and
+// I/O, so instances of one or different programs can run one after another or in different threads.
+//
+//     struct Bin_Tr *code = Bin_Tr_Compile (bytecode, size, &options);
+//     struct Bin_Tr_Instance *instance = Bin_Tr_New_Instance (code, &io);
+//
+//     Bin_Tr_Run (instance);      // as many times as needed
+//
+//     Bin_Tr_Delete_Instance (instance);
+//     Bin_Tr_Free (code);
+//
+// Nothing is printed and no global state is changed. An access out of RAM is a segmentation fault.
+
+// Instruction set of the generated code; it's never above what the CPU running the translator has
+enum Code_Target
+{
+    TARGET_AUTO,            // TARGET_NATIVE for code run by the translator, TARGET_SSE2 for executables
+    TARGET_NATIVE,          // the best of the CPU, found by CPUID
+    TARGET_SSE2,            // any x86-64
+    TARGET_AVX,             // VEX three-operand forms of arithmetics
+    TARGET_FMA              // AVX and fused multiply-add for fp_contract
+};
+
+// Options of the translation: Bin_Tr_Compile () uses all of them
+struct Bin_Tr_Options
+{
+    bool reg_stack;         // keep the top of the operand stack in xmm registers inside basic blocks
+    bool peephole;          // fold short instruction sequences (push/pop pairs, in/out pairs)
+    bool const_fold;        // evaluate constant expressions and conditional jumps at translation time
+    bool short_branches;    // use rel8 jmp and jcc wherever the destination is close enough
+    bool huge_pages;        // ask for 2 MB pages for the code of programs that large, it doesn't change the code
+    int  inline_budget;     // copy leaf procedures of at most this many instructions into callers (0 - no inlining),
+                            // at most BIN_TR_MAX_INLINE_BUDGET
+    bool licm;              // keep loop counters and invariant values in xmm registers (with reg_stack, not lazy)
+    enum Code_Target target;    // instruction set of the code
+    bool fp_contract;       // mul followed by add or sub is one fused multiply-add with one rounding (peephole, FMA)
+    bool lazy;              // translate a procedure at its first call instead of the whole program (no cache)
+    bool tiered;            // interpret the program and translate its hot blocks (no cache)
+    int  tier_threshold;    // executions of a block before it's translated
+    bool perf_map;          // name the code of every procedure in /tmp/perf-PID.map (no cache)
+    bool jitdump;           // write the code with bytecode ips as line numbers to /tmp/jit-PID.dump (no cache)
+    const char *perf_name;  // the program in symbols and line tables of perf (NULL - "bytecode")
+    bool instrument;        // count executions of blocks and conditional jumps, see Bin_Tr_Write_Profile () (no cache)
+    const char *layout_profile; // lay blocks out by this profile of Bin_Tr_Write_Profile () (NULL - bytecode order, no cache)
+
+    const char *cache_dir;  // directory of translated code keyed by bytecode hash (NULL - no cache)
+    long cache_size;        // limit of the cache directory size in bytes
+};
+
+// What in and out of the running program do; called in the thread of Bin_Tr_Run ()
+struct Bin_Tr_IO
+{
+    double (* in) (void *context);                      // the number for in
+    void   (* out)(void *context, const double number); // the number of out
+    void  *context;
+};
+
+#define BIN_TR_N_REGS 4     // ax, bx, cx, dx
+
+#define BIN_TR_MAX_INLINE_BUDGET (1 << 16)  // the budget is a part of cache keys
+
+struct Bin_Tr;              // translated code, read-only after Bin_Tr_Compile () (lazy code grows under a lock)
+struct Bin_Tr_Instance;     // RAM, registers and I/O of one execution of the code
+
+// NULL if the bytecode can't be translated or the options are out of range; the bytecode isn't needed afterwards
+struct Bin_Tr *Bin_Tr_Compile (const char *const bytecode, const long size, const struct Bin_Tr_Options *const options);
+void           Bin_Tr_Free    (struct Bin_Tr *const code);
+
+// NULL if RAM or the stacks of the interpreter of tiered code can't be mapped; RAM and registers are zero,
+// the code has to outlive the instance
+struct Bin_Tr_Instance *Bin_Tr_New_Instance    (const struct Bin_Tr *const code, const struct Bin_Tr_IO *const io);
+void                    Bin_Tr_Delete_Instance (struct Bin_Tr_Instance *const instance);
+
+// gives the instance another code (or the same one) and I/O; RAM and registers are zero as in a new instance,
+// but the RAM mapping is kept, which is much cheaper than a new instance for short runs
+void Bin_Tr_Reset_Instance (struct Bin_Tr_Instance *const instance, const struct Bin_Tr *const code,
+                            const struct Bin_Tr_IO *const io);
+
+// runs the code until hlt; RAM and registers keep their values between runs. false if lazy code
+// couldn't compile a procedure: the run stops at its call
+bool Bin_Tr_Run (struct Bin_Tr_Instance *const instance);
+
+double *Bin_Tr_Registers (struct Bin_Tr_Instance *const instance);                     // BIN_TR_N_REGS doubles
+char   *Bin_Tr_RAM       (struct Bin_Tr_Instance *const instance, long *const size);
+
+// writes the counts of instrumented code summed over all its runs, "block ip executions" and "branch ip taken
+// not_taken" lines; false if the code isn't instrumented or the file can't be written
+bool Bin_Tr_Write_Profile (const struct Bin_Tr *const code, const char *const file_name);
+
+#endif
@@ -5,6 +5,7 @@
 #include <inttypes.h>
 #include <string.h>
 #include <sys/mman.h>   // for mprotect ()
+#include "Bin_Tr_Lib.h"
 
 #ifndef DEBUG
 #undef MY_ASSERT
@@ -50,7 +51,23 @@ enum ISA
     sub,
     mul,
     dvd,
-    Sqrt
+    Sqrt,
+
+    nop,    // IR only: instruction removed by an optimization pass
+
+    // IR only: negations of jae, ja, jbe and jb put by block layout, NaN takes them
+    jnae,
+    jna,
+    jnbe,
+    jnb,
+
+    // IR only: loop forms put by Hoist_Loop_Invariants (), xmm is the register of the value
+    load_const,     // pops the value of a hoisted expression into xmm
+    push_const,     // pushes xmm
+    load_shadow,    // copies reg into xmm
+    push_shadow,    // pushes xmm, the copy of reg
+    pop_shadow,     // pops into xmm, the copy of reg
+    pop_shadow_reg  // pops into xmm and reg
 };
 
 enum PUSH_POP
@@ -76,6 +93,83 @@ enum PUSH_POP
     RAM_DX_NUM = 141,   // push/pop [dx + 4]   
 };
 
-int Binary_Translator (const char *const input);
+enum Registers
+{
+    ax = 0x01,
+    bx = 0x02,
+    cx = 0x03,
+    dx = 0x04
+};
+
+// Host functions called from the translated code
+enum Host_Func
+{
+    HOST_IN,
+    HOST_OUT,
+
+    N_HOST_FUNCS
+};
+
+// rel32 of a call to a host function; it depends on the address the code is loaded to
+struct Reloc
+{
+    uint32_t x86_ip;        // offset of rel32 in x86 code
+    uint32_t func;          // enum Host_Func
+};
+
+struct Relocs
+{
+    struct Reloc *table;    // grows while calls are emitted
+    int n_relocs;
+    int capacity;
+};
+
+// x86 offset of the code of a bytecode instruction
+struct Line
+{
+    int ip;
+    int x86_ip;
+};
+
+struct Lines
+{
+    struct Line *table;     // in order of x86 offsets
+    int n_lines;
+    int capacity;
+};
+
+// When the output of the translated code is written
+enum Flush_Policy
+{
+    FLUSH_AUTO,             // FLUSH_LINE for a terminal, FLUSH_FULL otherwise
+    FLUSH_LINE,             // after every number and prompt
+    FLUSH_FULL              // when the buffer is full and at hlt
+};
+
+// Options of the command line program: the translation and what is done with the code
+struct Tr_Options
+{
+    struct Bin_Tr_Options compile;  // passed to Bin_Tr_Compile ()
+
+    const char *aot_output; // write a static ELF executable instead of running the code (NULL - JIT)
+    const char *profile_output;     // instrument the code and write its profile here after the run (NULL - no profile)
+
+    enum Flush_Policy out_flush;    // when numbers printed by out are written
+    bool out_shortest;              // print the shortest digits that read back to the same double instead of %g
+
+    const char *input_file; // numbers for in (NULL - stdin)
+    bool input_binary;      // the input holds raw 8-byte doubles instead of text
+
+    const char *bench_output;   // measure translation and execution, write JSON report here ("-" - stdout, NULL - run once)
+    int bench_runs;             // measured samples of each stage
+    int bench_warmup;           // runs of each stage before measurements
+
+    bool batch;                 // the input file is a manifest of jobs "program input [output]" run in parallel
+    int n_threads;              // workers of a batch (0 - one per online CPU)
+};
+
+// command line program: translates bytecode of the file input_name and runs it, writes an executable or a benchmark report
+int Binary_Translator (const char *const input_name, const char *const bytecode, const long size,
+                       const struct Tr_Options *const options);
 
 #endif
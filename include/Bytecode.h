@@ -0,0 +1,18 @@
+#ifndef BYTECODE_INCLUDED
+#define BYTECODE_INCLUDED
+
+#include "Binary_Translator.h"
+
+// Bytecode of a program: a regular file is mapped read-only and decoded in place, a pipe or stdin ("-")
+// is read into a buffer, so bytecode can come straight from a generator
+struct Bytecode
+{
+    char *data;
+    long  size;
+    bool  mapped;
+};
+
+int  Bytecode_Load (struct Bytecode *const bytecode, const char *const file_name);
+void Bytecode_Free (struct Bytecode *const bytecode);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef CODE_ARENA_INCLUDED
+#define CODE_ARENA_INCLUDED
+
+#include "Binary_Translator.h"
+
+#define ARENA_PAGE      4096L
+#define ARENA_HUGE_PAGE (2L << 20)
+
+// Executable memory of all translated programs of the process. One reservation lies within rel32 reach of
+// the host functions; regions are cut from it by a bump pointer, and freed regions are reused first.
+// A region is PROT_NONE when allocated and never writable and executable at once: the code is written
+// after Arena_Write () and runs after Arena_Seal (). Sizes and addresses are multiples of ARENA_PAGE.
+// All functions are thread-safe.
+
+static inline long Arena_Round_Up (const long size)
+{
+    return (size + ARENA_PAGE - 1) / ARENA_PAGE * ARENA_PAGE;
+}
+
+// NULL if there is no room; host is a function that the code calls with rel32
+char *Arena_Alloc (const long size, const bool huge_pages, const void *const host);
+void  Arena_Free  (char *const region, const long size);
+
+int   Arena_Write (char *const region, const long size);    // read and write
+int   Arena_Seal  (char *const region, const long size);    // read and execute
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef CODE_CACHE_INCLUDED
+#define CODE_CACHE_INCLUDED
+
+#include "Binary_Translator.h"
+
+struct Code_Cache
+{
+    const char *dir;
+    long max_size;          // total size of cache files in bytes, the least recently used are evicted
+    uint32_t options;       // translation options the code depends on
+};
+
+// A cache file mapped into memory
+struct Cache_Entry
+{
+    char  *map;             // NULL if there is no valid entry
+    size_t map_size;
+
+    const char *x86_code;
+    long x86_size;
+
+    const struct Reloc *relocs;
+    int n_relocs;
+};
+
+int  Open_Cache_Entry  (const struct Code_Cache *const cache, const char *const bytecode, const long max_ip,
+                        struct Cache_Entry *const entry);
+void Close_Cache_Entry (struct Cache_Entry *const entry);
+int  Store_Cache_Entry (const struct Code_Cache *const cache, const char *const bytecode, const long max_ip,
+                        const char *const x86_code, const long x86_size, const struct Relocs *const relocs);
+
+#endif
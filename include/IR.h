@@ -0,0 +1,83 @@
+#ifndef IR_INCLUDED
+#define IR_INCLUDED
+
+#include "Binary_Translator.h"
+
+// One decoded bytecode instruction (16 bytes)
+struct IR_Instr
+{
+    unsigned char type;     // enum ISA
+    unsigned char reg;      // enum Registers for push/pop forms with a register
+    unsigned char xmm;      // xmm8 - xmm14 of the loop forms: load_const ... pop_shadow
+
+    int ip;                 // offset of the instruction in bytecode
+
+    union
+    {
+        double num;         // push_num
+        int    disp;        // RAM forms with a number: [num], [reg + num]
+
+        struct
+        {
+            int to;         // destination ip
+            int block;      // index of destination basic block
+        } jump;             // call, jmp and conditional jumps
+    };
+};
+
+struct Jump
+{
+    int from;               // index of jump instruction in IR
+    int to;                 // destination ip
+    enum Instructions type;
+};
+
+struct IR_Block
+{
+    int first;              // index of the first instruction of the block
+    int n_instrs;
+
+    int fall_through;       // block executed next if the last instruction doesn't transfer control (-1 if none)
+    int branch;             // destination of the last jump or call (-1 if none)
+};
+
+struct IR
+{
+    struct IR_Instr *instrs;
+    int n_instrs;
+
+    struct Jump *jumps;     // all call, jmp and jcc in bytecode order
+    int n_jumps;
+
+    struct IR_Block *blocks;
+    int n_blocks;
+};
+
+static inline bool Is_Jcc (const int type)
+{
+    return (jae <= type && type <= jne) || (jnae <= type && type <= jnb);
+}
+
+int  Build_IR   (const char *const proc_buff, const long max_ip, struct IR *const ir);
+int  Compact_IR (struct IR *const ir);
+void Free_IR    (struct IR *const ir);
+
+// optimization passes
+int Fold_Constants (struct IR *const ir);
+
+// Copies leaf procedures of at most budget instructions into their callers and turns call X; ret into jmp X.
+// The blocks are renumbered, so it goes before the other passes.
+int Inline_Procedures (struct IR *const ir, const int budget);
+
+// Keeps registers that loops push and pop in xmm registers and evaluates loop-invariant expressions once,
+// before the loop. The loop forms of instructions it puts are lowered only with the register stack.
+int Hoist_Loop_Invariants (struct IR *const ir);
+
+struct Profile;
+
+// Fills order with the blocks in the order they are emitted: the hot path of the profile falls through and blocks
+// that never ran go last. Conditional jumps to the block placed after theirs are negated, jmps to it become nops.
+// Block 0 stays first.
+int Order_Blocks (struct IR *const ir, const struct Profile *const profile, int *const order);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef INPUT_INCLUDED
+#define INPUT_INCLUDED
+
+#include "Binary_Translator.h"
+
+// Numbers for in: a regular file is mapped as a whole, other files (pipes, terminals) are read in chunks
+struct Input
+{
+    int fd;
+    bool is_file;           // fd is opened by Input_Open ()
+
+    char  *buffer;          // the mapped file or read () buffer; data is followed by '\0'
+    size_t pos;
+    size_t start;           // where a mapped file starts for Input_Rewind ()
+    size_t size;
+    size_t capacity;
+
+    bool mapped;
+    bool eof;               // nothing left to read into the buffer
+
+    bool binary;            // raw little-endian doubles instead of text
+    bool prompt;            // "Write a number: " before every number: text from a terminal
+};
+
+int    Input_Open   (struct Input *const input, const char *const file_name, const bool binary);
+void   Input_Close  (struct Input *const input);
+double Input_Number (struct Input *const input);
+void   Input_Rewind (struct Input *const input);
+
+const char *Parse_Double (const char *const str, double *const number);
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef INTERPRETER_INCLUDED
+#define INTERPRETER_INCLUDED
+
+#include "IR.h"
+#include <stdatomic.h>
+
+// Direct-threaded code: every instruction of the IR is the address of its handler in Interpret () with
+// the operand, jumps and calls hold the instruction they go to. Every basic block starts with a counter of
+// its executions; when it reaches the threshold, the block is compiled with everything reachable from it
+// and the interpreter enters the native code as soon as the operand stack of the frame is empty.
+struct Thr_Instr
+{
+    const void *handler;
+
+    union
+    {
+        double num;                             // push_num
+        const struct Thr_Instr *target;         // call, jmp and conditional jumps
+        int block;                              // the counter at the start of a block
+
+        struct
+        {
+            int disp;                           // RAM forms with a number
+            int reg;                            // index in the registers, 0 - ax
+        };
+    };
+};
+
+struct Threaded_Code
+{
+    struct Thr_Instr *instrs;
+    int n_instrs;
+
+    int *block_start;                           // index of the counter of every block
+    int  n_blocks;
+
+    _Atomic int *counters;                      // executions of every block, they stop at the threshold
+    _Atomic (const void *) *native;             // compiled code of every block (NULL - not compiled yet)
+    int threshold;
+};
+
+// How the native code of a block ended
+enum Native_Exit
+{
+    NATIVE_RET,             // its procedure returned
+    NATIVE_HLT,             // the program stopped
+    NATIVE_ERROR            // the code couldn't go on, the run stops
+};
+
+// What the interpreter does with hot blocks
+struct Tier_Up
+{
+    // native code of the block, NULL if it can't be compiled (the block is interpreted for good)
+    const void *(* compile)(void *context, const int block);
+
+    // runs the native code of a block until its procedure returns or the program stops
+    enum Native_Exit (* run)(void *context, const void *const native, double *const regs);
+
+    void *context;
+};
+
+struct Frame
+{
+    const struct Thr_Instr *ret;    // the instruction after the call
+    double *base;                   // the top of the operand stack at the call
+};
+
+// Operand and call stacks of an instance; overflows hit guard pages as in the native code
+struct Interp_Stacks
+{
+    char *reservation;
+
+    double *values;
+    struct Frame *frames;
+};
+
+// One run of threaded code; RAM is addressed like in the native code
+struct Interp_Run
+{
+    double *regs;
+    char   *ram;
+
+    const struct Bin_Tr_IO *io;
+    struct Interp_Stacks *stacks;
+
+    struct Tier_Up tier;
+
+    bool failed;            // the run stopped at NATIVE_ERROR
+};
+
+int  Thread_IR          (const struct IR *const ir, const int threshold, struct Threaded_Code *const code);
+void Free_Threaded_Code (struct Threaded_Code *const code);
+
+int  Interp_Stacks_Map   (struct Interp_Stacks *const stacks);
+void Interp_Stacks_Unmap (struct Interp_Stacks *const stacks);
+
+// Runs the code from the first block until hlt, ret at the top level or the return of native code entered
+// at the top level. Interpret (NULL, NULL) returns the table of handlers.
+const void *const *Interpret (const struct Threaded_Code *const code, struct Interp_Run *const run);
+
+#endif
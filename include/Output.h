@@ -0,0 +1,29 @@
+#ifndef OUTPUT_INCLUDED
+#define OUTPUT_INCLUDED
+
+#include "Binary_Translator.h"
+
+#define MAX_NUMBER_LEN 32   // "-1.2345678901234567e-308\n" and some spare
+
+// Output of the translated code: numbers are formatted into the buffer, which goes out with one write ()
+struct Output
+{
+    char  *buffer;
+    size_t size;
+    size_t capacity;
+
+    int  fd;
+    bool line_flush;        // written after every number and prompt
+    bool shortest;          // shortest round-trip digits instead of %g
+};
+
+int  Output_Init   (struct Output *const output, const int fd, const enum Flush_Policy policy, const bool shortest);
+void Output_Free   (struct Output *const output);
+int  Output_Flush  (struct Output *const output);
+void Output_String (struct Output *const output, const char *const str);
+void Output_Number (struct Output *const output, const double number);
+
+int Format_G        (char *const str, const double number);
+int Format_Shortest (char *const str, const double number);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef PERF_MAP_INCLUDED
+#define PERF_MAP_INCLUDED
+
+#include "Binary_Translator.h"
+
+// Translated code as perf sees it. /tmp/perf-PID.map names the code of every symbol, which is enough for
+// perf report. /tmp/jit-PID.dump (the jitdump format) also has the code itself and bytecode ips as line
+// numbers: perf record -k 1, then perf inject --jit makes ELF images that perf report and perf annotate
+// attribute to procedures and ips of the bytecode file. Both files are shared by all threads of the process.
+struct Perf_Symbol
+{
+    const char *buffer;         // the code and the lines are at offsets in it
+    long x86_ip;
+    long size;
+
+    const char *name;
+    const char *file;           // bytecode file the lines refer to
+
+    const struct Line *lines;   // lines of the symbol
+    int n_lines;
+};
+
+// a failure only leaves the code without a name
+int Perf_Describe (const struct Perf_Symbol *const symbol, const bool perf_map, const bool jitdump);
+
+#endif
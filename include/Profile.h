@@ -0,0 +1,29 @@
+#ifndef PROFILE_INCLUDED
+#define PROFILE_INCLUDED
+
+#include "IR.h"
+
+// Counts of instrumented code, a side table out of the VM stack and RAM. The code increments counts[block]
+// when the block starts and counts[n_blocks + block] when the conditional jump that ends the block falls
+// through, so a jump is taken the difference of the two times. Instances in different threads share the
+// counts and may lose some increments.
+struct Profile
+{
+    uint64_t *counts;
+    int n_blocks;
+
+    int *block_ip;          // first instruction of every block (-1 - the block is empty)
+    int *jcc_ip;            // conditional jump that ends every block (-1 - none)
+};
+
+struct Profile *Profile_New  (const struct IR *const ir);
+void            Profile_Free (struct Profile *const profile);
+
+// Text file keyed by bytecode ip, lines "block ip executions" and "branch ip taken not_taken"
+int Profile_Write (const struct Profile *const profile, const char *const file_name);
+
+// Adds the counts of the file to a profile of the same IR; ips that aren't blocks or conditional jumps of it
+// are skipped, so a profile of an older version of the program still fits the code that didn't change
+int Profile_Read (struct Profile *const profile, const char *const file_name);
+
+#endif
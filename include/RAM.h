@@ -0,0 +1,22 @@
+#ifndef RAM_INCLUDED
+#define RAM_INCLUDED
+
+#include "Binary_Translator.h"
+
+#define RAM_SIZE (1L << 20)     // readable and writable bytes of one instance
+
+// Memory of one running program. The translated code addresses it through r15 as [r15 + index + disp32],
+// where index is a 32-bit unsigned number: every such address lies in [base - 2 GB, base + 6 GB), which is
+// reserved as a whole. Only RAM_SIZE bytes at base are accessible, the rest are guard pages, so an access
+// out of bounds faults and the code needs no bounds checks.
+struct RAM
+{
+    char *reservation;
+    char *base;             // what r15 points at
+};
+
+int  RAM_Map   (struct RAM *const ram);
+void RAM_Unmap (struct RAM *const ram);
+void RAM_Clear (struct RAM *const ram);
+
+#endif
@@ -0,0 +1,267 @@
+#include "../include/AOT.h"
+#include "../include/RAM.h"
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Static executable: one read-execute segment with headers, entry stub, runtime and translated code,
+// one read-write segment for RAM. Section headers are only there for symbols (perf, gdb).
+//
+// | Ehdr | Phdr x 3 | stub | runtime | x86 code | symtab | strtab | shstrtab | Shdr x 5 |
+
+#define TEXT_VADDR  0x400000
+
+#define ALIGN_16(offset) (((offset) + 15) & ~15L)
+
+//=====================================================================================//
+//                                       RUNTIME                                       //
+//=====================================================================================//
+
+// In () and Out () of executables are assembled from AOT_Runtime.S into read-only data of the translator:
+// they are copied into every executable and never run here
+extern const unsigned char AOT_Runtime[], AOT_Runtime_In[], AOT_Runtime_Out[], AOT_Runtime_End[];
+
+#define RUNTIME_SIZE  (AOT_Runtime_End - AOT_Runtime)
+#define RT_IN_OFFSET  (AOT_Runtime_In  - AOT_Runtime)
+#define RT_OUT_OFFSET (AOT_Runtime_Out - AOT_Runtime)
+
+// _start: the translated code returns to the stub, which exits with status 0; hlt goes to the same exit
+// through the address r14 points at
+static const unsigned char Entry_Stub[] =
+{
+    0x41, 0xBF, 0x00, 0x00, 0x00, 0x00, // mov r15d, AOT_RAM_VADDR (0 is changed below)
+    0x48, 0x8D, 0x05, 0x0A, 0x00, 0x00, 0x00,   // lea rax, [rip + exit]
+    0x50,                               // push rax
+    0x50,                               // push rax (the code gets the stack aligned like a function)
+    0x49, 0x89, 0xE6,                   // mov r14, rsp
+    0xE8, 0x00, 0x00, 0x00, 0x00,       // call program (0 is changed below)
+                                        // exit:
+    0x31, 0xFF,                         // xor edi, edi
+    0xB8, 0xE7, 0x00, 0x00, 0x00,       // mov eax, 231 (exit_group)
+    0x0F, 0x05                          // syscall
+};
+
+static long Host_Func_Offset (const uint32_t func)
+{
+    return (func == HOST_IN) ? RT_IN_OFFSET : RT_OUT_OFFSET;
+}
+
+//=====================================================================================//
+
+//=====================================================================================//
+//                                       LAYOUT                                        //
+//=====================================================================================//
+
+enum Sections
+{
+    SH_NULL,
+    SH_TEXT,
+    SH_SYMTAB,
+    SH_STRTAB,
+    SH_SHSTRTAB,
+
+    N_SECTIONS
+};
+
+enum Symbols
+{
+    SYM_NULL,
+    SYM_START,
+    SYM_IN,
+    SYM_OUT,
+    SYM_PROGRAM,
+
+    N_SYMBOLS
+};
+
+static const char Sym_Names[]     = "\0_start\0In\0Out\0program";
+static const char Section_Names[] = "\0.text\0.symtab\0.strtab\0.shstrtab";
+
+#define N_PHDRS 3
+
+struct ELF_Layout
+{
+    long stub;
+    long runtime;
+    long code;
+    long text_end;
+
+    long symtab;
+    long strtab;
+    long shstrtab;
+    long shdrs;
+    long file_size;
+};
+
+static void Make_Layout (struct ELF_Layout *const layout, const long x86_size)
+{
+    layout->stub      = sizeof (Elf64_Ehdr) + N_PHDRS * sizeof (Elf64_Phdr);
+    layout->runtime   = ALIGN_16 (layout->stub + (long)sizeof Entry_Stub);
+    layout->code      = ALIGN_16 (layout->runtime + RUNTIME_SIZE);
+    layout->text_end  = layout->code + x86_size;
+
+    layout->symtab    = ALIGN_16 (layout->text_end);
+    layout->strtab    = layout->symtab + N_SYMBOLS * sizeof (Elf64_Sym);
+    layout->shstrtab  = layout->strtab + sizeof Sym_Names;
+    layout->shdrs     = ALIGN_16 (layout->shstrtab + (long)sizeof Section_Names);
+    layout->file_size = layout->shdrs + N_SECTIONS * sizeof (Elf64_Shdr);
+}
+
+static void Put_Headers (char *const image, const struct ELF_Layout *const layout)
+{
+    Elf64_Ehdr *ehdr = (Elf64_Ehdr *)image;
+
+    memcpy (ehdr->e_ident, ELFMAG, SELFMAG);
+    ehdr->e_ident[EI_CLASS]   = ELFCLASS64;
+    ehdr->e_ident[EI_DATA]    = ELFDATA2LSB;
+    ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr->e_ident[EI_OSABI]   = ELFOSABI_SYSV;
+
+    ehdr->e_type      = ET_EXEC;
+    ehdr->e_machine   = EM_X86_64;
+    ehdr->e_version   = EV_CURRENT;
+    ehdr->e_entry     = TEXT_VADDR + layout->stub;
+    ehdr->e_phoff     = sizeof (Elf64_Ehdr);
+    ehdr->e_shoff     = layout->shdrs;
+    ehdr->e_ehsize    = sizeof (Elf64_Ehdr);
+    ehdr->e_phentsize = sizeof (Elf64_Phdr);
+    ehdr->e_phnum     = N_PHDRS;
+    ehdr->e_shentsize = sizeof (Elf64_Shdr);
+    ehdr->e_shnum     = N_SECTIONS;
+    ehdr->e_shstrndx  = SH_SHSTRTAB;
+
+    Elf64_Phdr *phdrs = (Elf64_Phdr *)(image + ehdr->e_phoff);
+
+    phdrs[0] = (Elf64_Phdr){.p_type   = PT_LOAD,
+                            .p_flags  = PF_R | PF_X,
+                            .p_offset = 0,
+                            .p_vaddr  = TEXT_VADDR,
+                            .p_paddr  = TEXT_VADDR,
+                            .p_filesz = layout->text_end,
+                            .p_memsz  = layout->text_end,
+                            .p_align  = 0x1000};
+
+    // RAM is zero-filled by the kernel, nothing of it is in the file
+    phdrs[1] = (Elf64_Phdr){.p_type   = PT_LOAD,
+                            .p_flags  = PF_R | PF_W,
+                            .p_offset = 0,
+                            .p_vaddr  = AOT_RAM_VADDR,
+                            .p_paddr  = AOT_RAM_VADDR,
+                            .p_filesz = 0,
+                            .p_memsz  = RAM_SIZE,
+                            .p_align  = 0x1000};
+
+    phdrs[2] = (Elf64_Phdr){.p_type  = PT_GNU_STACK,
+                            .p_flags = PF_R | PF_W};
+}
+
+static void Put_Symbols (char *const image, const struct ELF_Layout *const layout, const long x86_size)
+{
+    Elf64_Sym *syms = (Elf64_Sym *)(image + layout->symtab);
+
+    const unsigned char func = ELF64_ST_INFO (STB_GLOBAL, STT_FUNC);
+
+    syms[SYM_START]   = (Elf64_Sym){1,  func, STV_DEFAULT, SH_TEXT, TEXT_VADDR + layout->stub, sizeof Entry_Stub};
+    syms[SYM_IN]      = (Elf64_Sym){8,  func, STV_DEFAULT, SH_TEXT, TEXT_VADDR + layout->runtime + RT_IN_OFFSET,
+                                    RT_OUT_OFFSET - RT_IN_OFFSET};
+    syms[SYM_OUT]     = (Elf64_Sym){11, func, STV_DEFAULT, SH_TEXT, TEXT_VADDR + layout->runtime + RT_OUT_OFFSET,
+                                    RUNTIME_SIZE - RT_OUT_OFFSET};
+    syms[SYM_PROGRAM] = (Elf64_Sym){15, func, STV_DEFAULT, SH_TEXT, TEXT_VADDR + layout->code, x86_size};
+
+    memcpy (image + layout->strtab,   Sym_Names,     sizeof Sym_Names);
+    memcpy (image + layout->shstrtab, Section_Names, sizeof Section_Names);
+
+    Elf64_Shdr *shdrs = (Elf64_Shdr *)(image + layout->shdrs);
+
+    shdrs[SH_TEXT] = (Elf64_Shdr){.sh_name      = 1,
+                                  .sh_type      = SHT_PROGBITS,
+                                  .sh_flags     = SHF_ALLOC | SHF_EXECINSTR,
+                                  .sh_addr      = TEXT_VADDR + layout->stub,
+                                  .sh_offset    = layout->stub,
+                                  .sh_size      = layout->text_end - layout->stub,
+                                  .sh_addralign = 16};
+
+    shdrs[SH_SYMTAB] = (Elf64_Shdr){.sh_name      = 7,
+                                    .sh_type      = SHT_SYMTAB,
+                                    .sh_offset    = layout->symtab,
+                                    .sh_size      = N_SYMBOLS * sizeof (Elf64_Sym),
+                                    .sh_link      = SH_STRTAB,
+                                    .sh_info      = SYM_START,     // index of the first global symbol
+                                    .sh_addralign = 8,
+                                    .sh_entsize   = sizeof (Elf64_Sym)};
+
+    shdrs[SH_STRTAB] = (Elf64_Shdr){.sh_name      = 15,
+                                    .sh_type      = SHT_STRTAB,
+                                    .sh_offset    = layout->strtab,
+                                    .sh_size      = sizeof Sym_Names,
+                                    .sh_addralign = 1};
+
+    shdrs[SH_SHSTRTAB] = (Elf64_Shdr){.sh_name      = 23,
+                                      .sh_type      = SHT_STRTAB,
+                                      .sh_offset    = layout->shstrtab,
+                                      .sh_size      = sizeof Section_Names,
+                                      .sh_addralign = 1};
+}
+
+// rel32 of calls from the code to the runtime and from the stub to the code, RAM address in the stub
+static void Link (char *const image, const struct ELF_Layout *const layout, const struct Relocs *const relocs)
+{
+    char *const code = image + layout->code;
+
+    for (int reloc_i = 0; reloc_i < relocs->n_relocs; reloc_i++)
+    {
+        const long rel_offset = layout->code + relocs->table[reloc_i].x86_ip;
+        const long target     = layout->runtime + Host_Func_Offset (relocs->table[reloc_i].func);
+
+        *(int32_t *)(code + relocs->table[reloc_i].x86_ip) = target - (rel_offset + sizeof (int32_t));
+    }
+
+    *(uint32_t *)(image + layout->stub + 2)  = AOT_RAM_VADDR;
+    *(int32_t  *)(image + layout->stub + 19) = layout->code - (layout->stub + 19 + sizeof (int32_t));
+}
+
+//=====================================================================================//
+
+int Write_ELF (const char *const name, const char *const x86_code, const long x86_size,
+               const struct Relocs *const relocs)
+{
+    MY_ASSERT (name,     "const char *const name",            NULL_PTR, ERROR);
+    MY_ASSERT (x86_code, "const char *const x86_code",        NULL_PTR, ERROR);
+    MY_ASSERT (relocs,   "const struct Relocs *const relocs", NULL_PTR, ERROR);
+
+    struct ELF_Layout layout = {};
+    Make_Layout (&layout, x86_size);
+
+    char *image = (char *)calloc (layout.file_size, sizeof (char));
+    MY_ASSERT (image, "char *image", NE_MEM, ERROR);
+
+    Put_Headers (image, &layout);
+
+    memcpy (image + layout.stub,    Entry_Stub,  sizeof Entry_Stub);
+    memcpy (image + layout.runtime, AOT_Runtime, RUNTIME_SIZE);
+    memcpy (image + layout.code,    x86_code,    x86_size);
+
+    Link (image, &layout, relocs);
+    Put_Symbols (image, &layout, x86_size);
+
+    const int fd = open (name, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+    if (fd < 0)
+    {
+        free (image);
+        return ERROR;
+    }
+
+    bool written = write (fd, image, layout.file_size) == layout.file_size;
+    written = (close (fd) == 0) && written;
+
+    free (image);
+
+    return (written) ? NO_ERRORS : ERROR;
+}
+
+#undef TEXT_VADDR
+#undef RUNTIME_SIZE
+#undef RT_IN_OFFSET
+#undef RT_OUT_OFFSET
+#undef ALIGN_16
+#undef N_PHDRS
@@ -0,0 +1,522 @@
+#include "../include/Batch.h"
+#include "../include/Benchmark.h"
+#include "../include/Bytecode.h"
+#include "../include/Input.h"
+#include "../include/Output.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#define CACHE_LINE  64
+#define SEPARATORS  " \t\r\n"
+#define NO_OUTPUT   "/dev/null"
+
+// Jobs [begin, end) that a worker hasn't started, packed in one word. The owner takes the first job,
+// a thief takes the upper half, both with compare-and-swap of the whole word. Begin only grows and end
+// only falls while jobs are left, and a job is in one range at a time, so a stale range never compares equal.
+#define RANGE(begin, end) (((uint64_t)(end) << 32) | (uint32_t)(begin))
+#define BEGIN(range)      ((uint32_t)(range))
+#define END(range)        ((uint32_t)((range) >> 32))
+
+struct Program
+{
+    char *file_name;
+    struct Bin_Tr *code;    // NULL: the program can't be read or translated
+};
+
+struct Job
+{
+    int program;            // index in programs
+    char *input_name;
+    char *output_name;
+};
+
+struct Batch;
+
+// Everything a worker writes while running is in its own cache lines
+struct Worker
+{
+    _Alignas (CACHE_LINE) _Atomic uint64_t range;
+
+    struct Batch *batch;
+    int index;
+    pthread_t thread;
+
+    struct Bin_Tr_Instance *instance;   // RAM and registers of all jobs of the worker
+    struct Input  input;                // of the current job
+    struct Output output;               // buffer of the worker, fd of the current job
+
+    long n_jobs;
+    long n_stolen;
+    long n_failed;
+    long n_numbers;                     // read by in and written by out
+    long busy_ns;
+};
+
+struct Batch
+{
+    const struct Tr_Options *options;
+
+    struct Program *programs;
+    int n_programs;
+    int programs_capacity;
+
+    struct Job *jobs;
+    int n_jobs;
+    int jobs_capacity;
+
+    struct Worker *workers;
+    int n_workers;
+
+    atomic_int next_program;            // the next one to translate
+};
+
+//=====================================================================================//
+//                                       MANIFEST                                      //
+//=====================================================================================//
+
+static int Find_Program (struct Batch *const batch, const char *const file_name)
+{
+    for (int program_i = 0; program_i < batch->n_programs; program_i++)
+        if (strcmp (batch->programs[program_i].file_name, file_name) == 0)
+            return program_i;
+
+    if (batch->n_programs == batch->programs_capacity)
+    {
+        const int new_capacity = (batch->programs_capacity) ? 2 * batch->programs_capacity : 16;
+
+        struct Program *programs = (struct Program *)realloc (batch->programs, new_capacity * sizeof (struct Program));
+        MY_ASSERT (programs, "struct Program *programs", NE_MEM, -1);
+
+        batch->programs          = programs;
+        batch->programs_capacity = new_capacity;
+    }
+
+    char *const name_copy = strdup (file_name);
+    MY_ASSERT (name_copy, "char *const name_copy", NE_MEM, -1);
+
+    batch->programs[batch->n_programs] = (struct Program){name_copy, NULL};
+
+    return batch->n_programs++;
+}
+
+static int Add_Job (struct Batch *const batch, const char *const program_name, const char *const input_name,
+                    const char *const output_name)
+{
+    if (batch->n_jobs == INT_MAX)
+        return ERROR;
+
+    if (batch->n_jobs == batch->jobs_capacity)
+    {
+        const int new_capacity = (batch->jobs_capacity) ? 2 * batch->jobs_capacity : 64;
+
+        struct Job *jobs = (struct Job *)realloc (batch->jobs, new_capacity * sizeof (struct Job));
+        MY_ASSERT (jobs, "struct Job *jobs", NE_MEM, ERROR);
+
+        batch->jobs          = jobs;
+        batch->jobs_capacity = new_capacity;
+    }
+
+    const int program_i = Find_Program (batch, program_name);
+    if (program_i < 0)
+        return ERROR;
+
+    char *const input_copy  = strdup (input_name);
+    char *const output_copy = strdup ((output_name) ? output_name : NO_OUTPUT);
+
+    if (input_copy == NULL || output_copy == NULL)
+    {
+        free (input_copy);
+        free (output_copy);
+        return ERROR;
+    }
+
+    batch->jobs[batch->n_jobs++] = (struct Job){program_i, input_copy, output_copy};
+
+    return NO_ERRORS;
+}
+
+static int Read_Manifest (struct Batch *const batch, const char *const manifest_name)
+{
+    FILE *manifest = fopen (manifest_name, "r");
+    if (manifest == NULL)
+    {
+        printf ("Can't read manifest \"%s\"\n", manifest_name);
+        return ERROR;
+    }
+
+    char  *line          = NULL;
+    size_t line_capacity = 0;
+    int    line_i        = 0;
+    int    ret_val       = NO_ERRORS;
+
+    while (ret_val == NO_ERRORS && getline (&line, &line_capacity, manifest) > 0)
+    {
+        line_i++;
+
+        char *fields[3] = {};
+        int n_fields = 0;
+
+        char *save_ptr = NULL;
+        for (char *field = strtok_r (line, SEPARATORS, &save_ptr); field; field = strtok_r (NULL, SEPARATORS, &save_ptr))
+        {
+            if (n_fields < 3)
+                fields[n_fields] = field;
+
+            n_fields++;
+        }
+
+        if (n_fields == 0 || fields[0][0] == '#')
+            continue;
+
+        if (n_fields < 2 || n_fields > 3)
+        {
+            printf ("Line %d of manifest \"%s\" isn't \"program input [output]\"\n", line_i, manifest_name);
+            ret_val = ERROR;
+        }
+        else if (Add_Job (batch, fields[0], fields[1], fields[2]) == ERROR)
+        {
+            printf ("Can't add job of line %d of manifest \"%s\"\n", line_i, manifest_name);
+            ret_val = ERROR;
+        }
+    }
+
+    free (line);
+    fclose (manifest);
+
+    if (ret_val == NO_ERRORS && batch->n_jobs == 0)
+    {
+        printf ("Manifest \"%s\" has no jobs\n", manifest_name);
+        ret_val = ERROR;
+    }
+
+    return ret_val;
+}
+
+static void Free_Batch (struct Batch *const batch)
+{
+    for (int program_i = 0; program_i < batch->n_programs; program_i++)
+    {
+        free (batch->programs[program_i].file_name);
+        Bin_Tr_Free (batch->programs[program_i].code);
+    }
+
+    for (int job_i = 0; job_i < batch->n_jobs; job_i++)
+    {
+        free (batch->jobs[job_i].input_name);
+        free (batch->jobs[job_i].output_name);
+    }
+
+    for (int worker_i = 0; worker_i < batch->n_workers; worker_i++)
+    {
+        Bin_Tr_Delete_Instance (batch->workers[worker_i].instance);
+        Output_Free (&batch->workers[worker_i].output);
+    }
+
+    free (batch->programs);
+    free (batch->jobs);
+    free (batch->workers);
+
+    *batch = (struct Batch){};
+}
+
+//=====================================================================================//
+
+//=====================================================================================//
+//                                        WORKERS                                      //
+//=====================================================================================//
+
+// the main thread is worker 0; a worker whose thread can't be created just has its jobs stolen
+static void Run_Workers (struct Batch *const batch, void *(* routine)(void *))
+{
+    bool *const started = (bool *)calloc (batch->n_workers, sizeof (bool));
+
+    for (int worker_i = 1; started && worker_i < batch->n_workers; worker_i++)
+        started[worker_i] = pthread_create (&batch->workers[worker_i].thread, NULL, routine, batch->workers + worker_i) == 0;
+
+    routine (batch->workers);
+
+    for (int worker_i = 1; started && worker_i < batch->n_workers; worker_i++)
+        if (started[worker_i])
+            pthread_join (batch->workers[worker_i].thread, NULL);
+
+    free (started);
+}
+
+static void *Translate_Programs (void *arg)
+{
+    struct Batch *const batch = ((struct Worker *)arg)->batch;
+
+    for (int program_i = atomic_fetch_add (&batch->next_program, 1); program_i < batch->n_programs;
+             program_i = atomic_fetch_add (&batch->next_program, 1))
+    {
+        struct Program *const program = batch->programs + program_i;
+
+        struct Bytecode bytecode = {};
+
+        if (Bytecode_Load (&bytecode, program->file_name) == NO_ERRORS)
+        {
+            struct Bin_Tr_Options options = batch->options->compile;
+            options.perf_name = program->file_name;
+
+            program->code = Bin_Tr_Compile (bytecode.data, bytecode.size, &options);
+            Bytecode_Free (&bytecode);
+        }
+    }
+
+    return NULL;
+}
+
+static bool Take_Job (struct Worker *const worker, uint32_t *const job_i)
+{
+    uint64_t range = atomic_load (&worker->range);
+
+    while (BEGIN (range) < END (range))
+    {
+        if (atomic_compare_exchange_weak (&worker->range, &range, RANGE (BEGIN (range) + 1, END (range))))
+        {
+            *job_i = BEGIN (range);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// the range of the thief is empty, nobody else changes it, so the stolen jobs are simply stored there
+static bool Steal_Jobs (struct Worker *const thief, uint32_t *const job_i)
+{
+    struct Batch *const batch = thief->batch;
+
+    for (int shift = 1; shift < batch->n_workers; shift++)
+    {
+        struct Worker *const victim = batch->workers + (thief->index + shift) % batch->n_workers;
+
+        uint64_t range = atomic_load (&victim->range);
+
+        while (BEGIN (range) < END (range))
+        {
+            const uint32_t middle = BEGIN (range) + (END (range) - BEGIN (range)) / 2;
+
+            if (atomic_compare_exchange_weak (&victim->range, &range, RANGE (BEGIN (range), middle)))
+            {
+                atomic_store (&thief->range, RANGE (middle + 1, END (range)));
+
+                thief->n_stolen += END (range) - middle;
+                *job_i = middle;
+
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static double Job_In (void *context)
+{
+    struct Worker *const worker = (struct Worker *)context;
+
+    worker->n_numbers++;
+
+    return Input_Number (&worker->input);
+}
+
+static void Job_Out (void *context, const double number)
+{
+    struct Worker *const worker = (struct Worker *)context;
+
+    worker->n_numbers++;
+
+    Output_Number (&worker->output, number);
+}
+
+static int Run_Job (struct Worker *const worker, const struct Job *const job)
+{
+    const struct Bin_Tr *const code = worker->batch->programs[job->program].code;
+    if (code == NULL)
+        return ERROR;
+
+    const struct Bin_Tr_IO io = {Job_In, Job_Out, worker};
+
+    if (worker->instance)
+        Bin_Tr_Reset_Instance (worker->instance, code, &io);
+    else if ((worker->instance = Bin_Tr_New_Instance (code, &io)) == NULL)
+        return ERROR;
+
+    if (Input_Open (&worker->input, job->input_name, worker->batch->options->input_binary) == ERROR)
+    {
+        Input_Close (&worker->input);
+        return ERROR;
+    }
+
+    worker->output.fd = open (job->output_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    int ret_val = ERROR;
+
+    if (worker->output.fd >= 0)
+    {
+        const bool completed = Bin_Tr_Run (worker->instance);
+
+        ret_val = Output_Flush (&worker->output);     // hlt
+        close (worker->output.fd);
+
+        if (!completed)
+            ret_val = ERROR;
+    }
+
+    Input_Close (&worker->input);
+
+    return ret_val;
+}
+
+static void *Run_Jobs (void *arg)
+{
+    struct Worker *const worker = (struct Worker *)arg;
+    const struct Job *const jobs = worker->batch->jobs;
+
+    uint32_t job_i = 0;
+
+    while (Take_Job (worker, &job_i) || Steal_Jobs (worker, &job_i))
+    {
+        const long start = Clock_Ns ();
+
+        if (Run_Job (worker, jobs + job_i) == ERROR)
+        {
+            worker->n_failed++;
+            printf ("Job %" PRIu32 " failed: \"%s\" \"%s\" \"%s\"\n", job_i + 1,
+                    worker->batch->programs[jobs[job_i].program].file_name, jobs[job_i].input_name, jobs[job_i].output_name);
+        }
+
+        worker->busy_ns += Clock_Ns () - start;
+        worker->n_jobs++;
+    }
+
+    return NULL;
+}
+
+//=====================================================================================//
+
+//=====================================================================================//
+//                                        BATCH                                        //
+//=====================================================================================//
+
+static int Init_Workers (struct Batch *const batch)
+{
+    long n_workers = batch->options->n_threads;
+
+    if (n_workers <= 0)
+        n_workers = sysconf (_SC_NPROCESSORS_ONLN);
+
+    if (n_workers <= 0)
+        n_workers = 1;
+
+    if (n_workers > batch->n_jobs)
+        n_workers = batch->n_jobs;
+
+    batch->workers = (struct Worker *)aligned_alloc (CACHE_LINE, n_workers * sizeof (struct Worker));
+    MY_ASSERT (batch->workers, "batch->workers", NE_MEM, ERROR);
+
+    memset (batch->workers, 0, n_workers * sizeof (struct Worker));
+    batch->n_workers = n_workers;
+
+    // contiguous ranges of equal size; stealing evens out the rest
+    for (int worker_i = 0; worker_i < n_workers; worker_i++)
+    {
+        struct Worker *const worker = batch->workers + worker_i;
+
+        worker->batch = batch;
+        worker->index = worker_i;
+
+        atomic_init (&worker->range, RANGE ((long)batch->n_jobs *  worker_i      / n_workers,
+                                            (long)batch->n_jobs * (worker_i + 1) / n_workers));
+
+        if (Output_Init (&worker->output, -1, FLUSH_FULL, batch->options->out_shortest) == ERROR)
+            return ERROR;
+    }
+
+    return NO_ERRORS;
+}
+
+static void Print_Report (const struct Batch *const batch, const long translation_ns, const long execution_ns)
+{
+    long n_failed  = 0;
+    long n_numbers = 0;
+
+    for (int worker_i = 0; worker_i < batch->n_workers; worker_i++)
+    {
+        n_failed  += batch->workers[worker_i].n_failed;
+        n_numbers += batch->workers[worker_i].n_numbers;
+    }
+
+    const double execution_s = (execution_ns > 0) ? execution_ns * 1e-9 : 1e-9;
+    const double jobs_per_s  = batch->n_jobs / execution_s;
+
+    printf ("Batch of %d jobs of %d programs on %d threads\n", batch->n_jobs, batch->n_programs, batch->n_workers);
+    printf ("Translation: %.3f s\n", translation_ns * 1e-9);
+    printf ("Execution:   %.3f s, %.1f jobs/s, %.1f jobs/s per thread, %.3g numbers/s\n",
+            execution_s, jobs_per_s, jobs_per_s / batch->n_workers, n_numbers / execution_s);
+
+    for (int worker_i = 0; worker_i < batch->n_workers; worker_i++)
+    {
+        const struct Worker *const worker = batch->workers + worker_i;
+
+        printf ("Thread %3d: %6ld jobs, %6ld stolen, busy %5.1f%%\n",
+                worker_i, worker->n_jobs, worker->n_stolen, 100.0 * worker->busy_ns / execution_s * 1e-9);
+    }
+
+    if (n_failed > 0)
+        printf ("Failed jobs: %ld\n", n_failed);
+}
+
+int Batch (const char *const manifest_name, const struct Tr_Options *const options)
+{
+    MY_ASSERT (manifest_name, "const char *const manifest_name",       NULL_PTR, ERROR);
+    MY_ASSERT (options,       "const struct Tr_Options *const options", NULL_PTR, ERROR);
+
+    struct Batch batch = {.options = options};
+
+    if (Read_Manifest (&batch, manifest_name) == ERROR || Init_Workers (&batch) == ERROR)
+    {
+        Free_Batch (&batch);
+        return ERROR;
+    }
+
+    atomic_init (&batch.next_program, 0);
+
+    const long translation_start = Clock_Ns ();
+    Run_Workers (&batch, Translate_Programs);
+    const long translation_ns = Clock_Ns () - translation_start;
+
+    for (int program_i = 0; program_i < batch.n_programs; program_i++)
+        if (batch.programs[program_i].code == NULL)
+            printf ("Can't read or translate \"%s\"\n", batch.programs[program_i].file_name);
+
+    fflush (stdout);    // job failures are printed by workers
+
+    const long execution_start = Clock_Ns ();
+    Run_Workers (&batch, Run_Jobs);
+    const long execution_ns = Clock_Ns () - execution_start;
+
+    Print_Report (&batch, translation_ns, execution_ns);
+
+    bool failed = false;
+    for (int worker_i = 0; worker_i < batch.n_workers; worker_i++)
+        failed = failed || batch.workers[worker_i].n_failed > 0;
+
+    Free_Batch (&batch);
+
+    return (failed) ? ERROR : NO_ERRORS;
+}
+
+//=====================================================================================//
+
+#undef CACHE_LINE
+#undef SEPARATORS
+#undef NO_OUTPUT
+
+#undef RANGE
+#undef BEGIN
+#undef END
@@ -0,0 +1,100 @@
+#include "../include/Benchmark.h"
+#include <math.h>
+
+static int Cmp_Ns (const void *first, const void *second)
+{
+    const long first_ns  = *(const long *)first;
+    const long second_ns = *(const long *)second;
+
+    return (first_ns > second_ns) - (first_ns < second_ns);
+}
+
+// nearest-rank percentile of sorted samples
+static inline long Percentile (const struct Samples *const samples, const int percent)
+{
+    const int rank = (int)ceil (percent / 100.0 * samples->n_samples);
+
+    return samples->ns[(rank > 0) ? rank - 1 : 0];
+}
+
+static void Write_Stats (FILE *const file, const char *const name, struct Samples *const samples, const long n_batch)
+{
+    qsort (samples->ns, samples->n_samples, sizeof (long), Cmp_Ns);
+
+    double mean = 0;
+    for (int sample_i = 0; sample_i < samples->n_samples; sample_i++)
+        mean += samples->ns[sample_i];
+    mean /= samples->n_samples;
+
+    double variance = 0;
+    for (int sample_i = 0; sample_i < samples->n_samples; sample_i++)
+        variance += (samples->ns[sample_i] - mean) * (samples->ns[sample_i] - mean);
+    variance /= (samples->n_samples > 1) ? samples->n_samples - 1 : 1;
+
+    // a sample is n_batch runs, the report is per run
+    const double scale = 1.0 / n_batch;
+
+    fprintf (file, "    \"%s\": {\"unit\": \"ns\", \"samples\": %d, \"batch\": %ld, "
+                   "\"min\": %.1f, \"p5\": %.1f, \"p25\": %.1f, \"median\": %.1f, \"p75\": %.1f, \"p95\": %.1f, "
+                   "\"max\": %.1f, \"mean\": %.1f, \"stddev\": %.1f}",
+             name, samples->n_samples, n_batch,
+             samples->ns[0] * scale,
+             Percentile (samples, 5)  * scale,
+             Percentile (samples, 25) * scale,
+             Percentile (samples, 50) * scale,
+             Percentile (samples, 75) * scale,
+             Percentile (samples, 95) * scale,
+             samples->ns[samples->n_samples - 1] * scale,
+             mean * scale, sqrt (variance) * scale);
+}
+
+// JSON object with statistics of translation and execution time of one program
+int Write_Bench_Report (const char *const input_name, const struct Tr_Options *const options,
+                        struct Samples *const translation, struct Samples *const execution,
+                        const long n_batch, const long x86_size)
+{
+    MY_ASSERT (input_name,  "const char *const input_name",           NULL_PTR, ERROR);
+    MY_ASSERT (options,     "const struct Tr_Options *const options", NULL_PTR, ERROR);
+    MY_ASSERT (translation, "struct Samples *const translation",      NULL_PTR, ERROR);
+    MY_ASSERT (execution,   "struct Samples *const execution",        NULL_PTR, ERROR);
+
+    // names of --target
+    static const char *const Target_Names[] =
+    {
+        [TARGET_AUTO]   = "auto",
+        [TARGET_NATIVE] = "native",
+        [TARGET_SSE2]   = "sse2",
+        [TARGET_AVX]    = "avx",
+        [TARGET_FMA]    = "fma"
+    };
+
+    FILE *file = (strcmp (options->bench_output, "-") == 0) ? stdout : fopen (options->bench_output, "w");
+    if (file == NULL)
+        return ERROR;
+
+    fprintf (file, "{\n"
+                   "    \"program\": \"%s\",\n"
+                   "    \"options\": {\"reg_stack\": %s, \"peephole\": %s, \"const_fold\": %s, \"short_branches\": %s, "
+                   "\"licm\": %s, \"inline_budget\": %d, \"target\": \"%s\", \"fp_contract\": %s},\n"
+                   "    \"x86_size\": %ld,\n"
+                   "    \"warmup\": %d,\n",
+             input_name,
+             (options->compile.reg_stack)      ? "true" : "false",
+             (options->compile.peephole)       ? "true" : "false",
+             (options->compile.const_fold)     ? "true" : "false",
+             (options->compile.short_branches) ? "true" : "false",
+             (options->compile.licm)           ? "true" : "false",
+             options->compile.inline_budget, Target_Names[options->compile.target],
+             (options->compile.fp_contract)    ? "true" : "false",
+             x86_size, options->bench_warmup);
+
+    Write_Stats (file, "translation", translation, 1);
+    fprintf (file, ",\n");
+    Write_Stats (file, "execution", execution, n_batch);
+    fprintf (file, "\n}\n");
+
+    if (file == stdout)
+        return NO_ERRORS;
+
+    return (fclose (file) == 0) ? NO_ERRORS : ERROR;
+}
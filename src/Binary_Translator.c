@@ -1,325 +1,268 @@
-#include "../include/Binary_Translator.h"
-
-//=====================================================================================//
-//                                    FIRST PASSING                                    //
-//=====================================================================================//
-
-struct Instruction
-{
-    int name;
-    int proc_num;
-    int proc_sz;
-    int x86_sz;
-};
-
-static const struct Instruction ISA_Consts[N_INSTRUCTIONS] =
-{
-    {hlt,               HLT,  1,  1},
-    {call,             CALL,  5,  5},
-    {jmp,               JMP,  5,  5},
-    {jae,               JAE,  5, 11},
-    {ja,                 JA,  5, 11},
-    {jbe,               JBE,  5, 11},
-    {jb,                 JB,  5, 11},
-    {je,                 JE,  5, 11},
-    {jne,               JNE,  5, 11},
-    {ret,               RET,  1,  1},
-    {in,                 IN,  1, 19},
-    {out,               OUT,  1, 19},
-    {push_num,         PUSH, 12, 11},
-    {push_ram_num,     PUSH,  8,  9},
-    {push_reg,         PUSH,  4,  1},
-    {push_ram_reg,     PUSH,  4,  4},
-    {push_ram_reg_num, PUSH,  8,  8},
-    {pop,               POP,  4,  1},
-    {pop_ram_num,       POP,  8,  9},
-    {pop_reg,           POP,  4,  1},
-    {pop_ram_reg,       POP,  4,  4},
-    {pop_ram_reg_num,   POP,  8,  8},
-    {add,               ADD,  1, 24},
-    {sub,               SUB,  1, 24},
-    {mul,               MUL,  1, 24},
-    {dvd,               DVD,  1, 24},
-    {Sqrt,             SQRT,  1, 14}
-};
+#include "../include/IR.h"
+#include "../include/Code_Cache.h"
+#include "../include/AOT.h"
+#include "../include/Benchmark.h"
+#include "../include/Output.h"
+#include "../include/Input.h"
+#include "../include/RAM.h"
+#include "../include/Code_Arena.h"
+#include "../include/Interpreter.h"
+#include "../include/Perf_Map.h"
+#include "../include/Profile.h"
+#include <cpuid.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+struct Lazy;
 
 struct Bin_Tr
 {
-    char *input_buff;
+    const char *input_buff;     // bytecode of the caller while it's translated
     char *x86_buff;
     long  max_ip;
     long  x86_max_ip;
+    long  x86_capacity;         // writable bytes of x86_buff, it grows while the code is emitted
+    long  x86_reserved;         // size of the arena region of x86_buff
+    long  x86_sealed;           // bytes at the start of x86_buff that are never writable again
+    long  x86_entry;            // offset of the entry stub
+    long  x86_start;            // offset of the code of ip 0
+    bool  huge_pages;           // the region of a large program is backed by 2 MB pages
+    unsigned char x86_ext;      // enum x86_Ext: extensions of x86-64 the code uses, see Code_Extensions ()
+
+    long  n_peephole_bytes;     // x86 code removed by peephole optimizer
+    long  n_relaxed_bytes;      // x86 code removed by branch relaxation
+
+    struct Relocs relocs;       // calls to In and Out
+    struct Lines  lines;        // bytecode ip of the code, recorded for perf
+    int n_described_lines;      // lines of the code that perf already knows
+
+    bool cached;                // the code is loaded from the cache
+
+    struct Lazy *lazy;          // procedures are compiled on the first call (NULL - all code is compiled)
+
+    struct Profile *profile;    // counters of instrumented code (NULL - the code isn't instrumented)
 };
 
-static int Handle_Push_Pop_First (const char *const proc_buff, int *const ip, int *const x86_ip)
-{    
-    MY_ASSERT (proc_buff, "const char *const proc_buff", NULL_PTR, ERROR);
-    MY_ASSERT (ip,        "int *const ip",               NULL_PTR, ERROR);
-    MY_ASSERT (x86_ip,    "int *const x86_ip",           NULL_PTR, ERROR);
-    
-    const int checksum = proc_buff[*ip + 1] + 10 * proc_buff[*ip + 2] + 100 * proc_buff[*ip + 3];
-    //                         |                        |                         |
-    //                       if RAM                   if reg                    if num
-
-    switch (checksum)
-    {                    
-        case EMPTY:
-            *ip     += ISA_Consts[pop].proc_sz;
-            *x86_ip += ISA_Consts[pop].x86_sz;
-            break;
-        
-        case NUM:
-            *ip     += ISA_Consts[push_num].proc_sz;
-            *x86_ip += ISA_Consts[push_num].x86_sz;
-            break;
+struct Bin_Tr_Instance
+{
+    const struct Bin_Tr *code;
 
-        case RAM_NUM:
-            *ip     += ISA_Consts[push_ram_num].proc_sz;
-            *x86_ip += ISA_Consts[push_ram_num].x86_sz;
-            break;
+    struct RAM ram;                 // memory of push [...] and pop [...]
+    double regs[BIN_TR_N_REGS];     // ax, bx, cx, dx between runs
 
-        case AX:
-        case BX:
-        case CX:
-        case DX:
-            *ip     += ISA_Consts[push_reg].proc_sz;
-            *x86_ip += ISA_Consts[push_reg].x86_sz;
-            break;
+    struct Bin_Tr_IO io;
 
-        case RAM_AX:
-        case RAM_BX:
-        case RAM_CX:
-        case RAM_DX:
-            *ip     += ISA_Consts[push_ram_reg].proc_sz;
-            *x86_ip += ISA_Consts[push_ram_reg].x86_sz;
-            break;
+    struct Interp_Stacks stacks;    // operand and call stacks of the interpreter of tiered code
 
-        case RAM_AX_NUM:
-        case RAM_BX_NUM:
-        case RAM_CX_NUM:
-        case RAM_DX_NUM:
-            *ip     += ISA_Consts[push_ram_reg_num].proc_sz;
-            *x86_ip += ISA_Consts[push_ram_reg_num].x86_sz;
-            break;
+    bool failed;                    // a procedure of lazy code couldn't be compiled, the run is stopped
+};
 
-        default:
-            MY_ASSERT (false, "int checksum", UNEXP_VAL, ERROR);
-            break;
-    }
+//=====================================================================================//
+//                                   X86-64 EMITTERS                                   //
+//=====================================================================================//
 
-    return NO_ERRORS;
+static const char x86_Reg_Codes[] =
+{
+    [ax] = 0x00,    // rax
+    [bx] = 0x03,    // rbx
+    [cx] = 0x01,    // rcx
+    [dx] = 0x02     // rdx
+};
+
+static inline void Put_In_x86_Buffer (char *const x86_buffer, int *const x86_ip, const char *const opcode, const size_t opcode_size)
+{
+    if (x86_buffer)
+        memcpy (x86_buffer + *x86_ip, opcode, opcode_size);
+    *x86_ip += opcode_size;
 }
 
-struct Jump
+static inline void Put_Byte_In_x86_Buffer (char *const x86_buffer, int *const x86_ip, const char byte)
 {
-    int from;
-    int to;
-    int x86_from;
-    enum Instructions type;
-};
+    if (x86_buffer)
+        x86_buffer[*x86_ip] = byte;
+    (*x86_ip)++;
+}
 
-static int Fill_Jumps_Arr (const char *const proc_buff, const int ip, const int x86_ip, struct Jump *const jumps_arr, const int jump_i)
+// Extensions of x86-64 above SSE2, chosen once for all the code of a translation
+enum x86_Ext
 {
-    MY_ASSERT (proc_buff, "const char *const proc_buff", NULL_PTR, ERROR);
-    MY_ASSERT (jumps_arr, "char *const jumps_arr",       NULL_PTR, ERROR);
-    
-    char instr_code = proc_buff[ip];
-    int jump_to = *(int *)(proc_buff + ip + 1);
+    EXT_AVX = 1 << 0,   // VEX-encoded arithmetics with a destination apart from the sources
+    EXT_FMA = 1 << 1    // vfmadd231sd and vfnmadd231sd, only with fp_contract
+};
 
-    jumps_arr[jump_i].from = ip;
-    jumps_arr[jump_i].to   = jump_to;
+static inline void Translate_Ret (char *const x86_buffer, int *const x86_ip)
+{
+    Put_Byte_In_x86_Buffer (x86_buffer, x86_ip, 0xC3);     // ret
+}
 
-    if (instr_code == CALL || instr_code == JMP)
-        jumps_arr[jump_i].x86_from = x86_ip;
-    else
-        jumps_arr[jump_i].x86_from = x86_ip + 5;    
-        // the first byte of x86-64 jump is 5 bytes further than the beginning of instruction
+// the entry stub keeps the address of its exit for hlt in r14, so hlt stops the program inside procedures too
+static inline void Translate_Hlt (char *const x86_buffer, int *const x86_ip)
+{
+    const char opcode[] = {
+                              0x4C, 0x89, 0xF4,     // mov rsp, r14
+                              0xC3                  // ret
+                          };
 
-    jumps_arr[jump_i].type = (int)proc_buff[ip];
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+}
 
-    return NO_ERRORS;
+static inline void Translate_Call (char *const x86_buffer, int *const x86_ip)
+{
+    Put_Byte_In_x86_Buffer (x86_buffer, x86_ip, 0xE8); // call
+    
+    (*x86_ip) += 4; // making free space of 4 bytes for call argument (relative offset)
 }
 
-static struct Jump *First_Passing (struct Bin_Tr *bin_tr, int *const n_jumps)
+// call qword [rip + disp32] through the slot of a procedure, which holds its address
+static inline void Translate_Slot_Call (char *const x86_buffer, int *const x86_ip, const int slot_x86)
 {
-    MY_ASSERT (bin_tr,             "struct Bin_Tr bin_tr",    NULL_PTR, NULL);
-    MY_ASSERT (bin_tr->input_buff, "const char *const input", NULL_PTR, NULL);
-    MY_ASSERT (n_jumps,            "int *const n_jumps",      NULL_PTR, NULL);
+    char opcode[] = {0xFF, 0x15, 0x00, 0x00, 0x00, 0x00};  // call qword [rip + 0]
 
-    const int   max_ip    = bin_tr->max_ip;
-    const char *proc_buff = bin_tr->input_buff;
+    *(int *)(opcode + 2) = slot_x86 - (*x86_ip + (int)sizeof opcode);
 
-    struct Jump *jumps_arr = (struct Jump *)calloc (max_ip, sizeof (struct Jump));
-    MY_ASSERT (jumps_arr, "struct Jump *jumps_arr", NE_MEM, NULL);
-    int jump_i = 0;
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+}
 
-    int x86_ip = 0;
+static inline void Translate_Jmp (char *const x86_buffer, int *const x86_ip)
+{
+    Put_Byte_In_x86_Buffer (x86_buffer, x86_ip, 0xE9); // jmp
+    
+    (*x86_ip) += 4; // making free space of 4 bytes for jump argument (relative offset)
+}
 
-    for (int ip = 0; ip < max_ip; )
+// ucomisd sets CF and ZF like an unsigned compare does, so unsigned jcc forms are used.
+// Unordered operands (NaN) set ZF, PF and CF: jae and ja aren't taken, je and jne check PF,
+// negations of jae and ja are jb and jbe, which are.
+static inline char Jcc_Opcode (const enum ISA jcc)
+{
+    switch (jcc)
     {
-        switch (proc_buff[ip])
-        {
-            case HLT:
-                ip     += ISA_Consts[hlt].proc_sz;
-                x86_ip += ISA_Consts[hlt].x86_sz;
-                break;
+        case jae:
+        case jbe:           // operands are swapped
+            return 0x83;    // jae
+        case ja:
+        case jb:            // operands are swapped
+            return 0x87;    // ja
+        case je:
+            return 0x84;    // je
+        case jne:
+            return 0x85;    // jne
+        case jnae:
+        case jnbe:          // operands are swapped
+            return 0x82;    // jb
+        case jna:
+        case jnb:           // operands are swapped
+            return 0x86;    // jbe
 
-            case CALL:
-            case JMP:
-            {
-                Fill_Jumps_Arr (proc_buff, ip, x86_ip, jumps_arr, jump_i);
-                jump_i++;
-
-                ip     += ISA_Consts[call].proc_sz;
-                x86_ip += ISA_Consts[call].x86_sz;
+        default:
+            MY_ASSERT (false, "const enum ISA jcc", UNEXP_VAL, 0);
+            break;
+    }
 
-                break;
-            }
+    return 0;
+}
 
-            case JAE:
-            case JA:
-            case JBE:
-            case JB:
-            case JNE:
-            case JE:
-            {
-                Fill_Jumps_Arr (proc_buff, ip, x86_ip, jumps_arr, jump_i);
-                jump_i++;
+// a <= b and a < b are checked as b >= a and b > a, so that NaN isn't taken by them either
+static inline bool Jcc_Swaps_Operands (const enum ISA jcc)
+{
+    return jcc == jbe || jcc == jb || jcc == jnbe || jcc == jnb;
+}
 
-                ip     += ISA_Consts[jae].proc_sz;
-                x86_ip += ISA_Consts[jae].x86_sz;
+// compares two doubles on top of the stack; jcc itself is put by the lowering
+static inline void Translate_Conditional_Jmp (char *const x86_buffer, int *const x86_ip, const enum ISA jcc)
+{
+    char opcode[] = {
+                        0xF2, 0x0F, 0x10, 0x4C, 0x24, 0x08,     // movsd   xmm1, qword [rsp + 8]
+                        0x66, 0x0F, 0x2E, 0x0C, 0x24,           // ucomisd xmm1, qword [rsp]
+                        0x48, 0x8D, 0x64, 0x24, 0x10,           // lea     rsp, [rsp + 16] (flags are kept)
+                    };
 
-                break;
-            }
+    if (Jcc_Swaps_Operands (jcc))
+    {
+        const char swapped[] = {
+                                    0xF2, 0x0F, 0x10, 0x0C, 0x24,           // movsd   xmm1, qword [rsp]
+                                    0x66, 0x0F, 0x2E, 0x4C, 0x24, 0x08,     // ucomisd xmm1, qword [rsp + 8]
+                                };
 
-            case RET:
-                ip     += ISA_Consts[ret].proc_sz;
-                x86_ip += ISA_Consts[ret].x86_sz;
-                break;
-
-            case IN:
-                ip     += ISA_Consts[in].proc_sz;
-                x86_ip += ISA_Consts[in].x86_sz;
-
-                break;
-
-            case OUT:
-                ip     += ISA_Consts[out].proc_sz;
-                x86_ip += ISA_Consts[out].x86_sz;
-                break;
-
-            case PUSH:
-            case POP:
-                Handle_Push_Pop_First (proc_buff, &ip, &x86_ip);
-                break;
-                
-            case ADD:
-            case SUB:
-            case MUL:
-            case DVD:
-                ip     += ISA_Consts[add].proc_sz;
-                x86_ip += ISA_Consts[add].x86_sz;
-                break;
-
-            case SQRT:
-                ip     += ISA_Consts[Sqrt].proc_sz;
-                x86_ip += ISA_Consts[Sqrt].x86_sz;
-                break;
-
-            default: 
-                MY_ASSERT (false, "proc_buff[ip]", UNEXP_VAL, NULL);
-                break;
-        }
+        memcpy (opcode, swapped, sizeof swapped);
     }
 
-    bin_tr->x86_max_ip = x86_ip;
-
-    *n_jumps = jump_i;
-    jumps_arr = realloc (jumps_arr, jump_i * sizeof (struct Jump));
-
-    return jumps_arr;
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
 }
 
-//=====================================================================================//
-
-//=====================================================================================//
-//                                   SECOND PASSING                                    //
-//=====================================================================================//
+// In and Out get no pointer to the instance: it's set by Bin_Tr_Run () for the thread that runs the code
+static _Thread_local struct Bin_Tr_Instance *Host_Instance = NULL;
 
-static inline void Put_In_x86_Buffer (char *const x86_buffer, int *const x86_ip, const char *const opcode, const size_t opcode_size)
+// The code calls them with the stack aligned to 8 or 16 bytes, as the operand stack and calls left it,
+// so they align it for the callbacks themselves
+__attribute__ ((force_align_arg_pointer))
+static inline void In (double *num_ptr)
 {
-    memcpy (x86_buffer + *x86_ip, opcode, opcode_size);
-    *x86_ip += opcode_size;
+    *num_ptr = Host_Instance->io.in (Host_Instance->io.context);
 }
 
-static inline void Translate_Ret (char *const x86_buffer, int *const x86_ip)
+__attribute__ ((force_align_arg_pointer))
+static inline void Out (const double number)
 {
-    x86_buffer[(*x86_ip)++] = 0xC3;     // ret
+    Host_Instance->io.out (Host_Instance->io.context, number);
 }
 
-static inline void Translate_Call (char *const x86_buffer, int *const x86_ip)
+static void *const Host_Funcs[N_HOST_FUNCS] =
 {
-    x86_buffer[(*x86_ip)++] = 0xE8; // call
-    
-    (*x86_ip) += 4; // making free space of 4 bytes for call argument (relative offset)
-}
+    [HOST_IN]  = (void *)In,
+    [HOST_OUT] = (void *)Out
+};
 
-static inline void Translate_Jmp (char *const x86_buffer, int *const x86_ip)
+// room for n_relocs more relocations: emitters append them without checks
+static int Reserve_Relocs (struct Relocs *const relocs, const int n_relocs)
 {
-    x86_buffer[(*x86_ip)++] = 0xE9; // jmp
-    
-    (*x86_ip) += 4; // making free space of 4 bytes for jump argument (relative offset)
+    if (relocs->n_relocs + n_relocs <= relocs->capacity)
+        return NO_ERRORS;
+
+    int capacity = (relocs->capacity) ? 2 * relocs->capacity : 16;
+    while (capacity < relocs->n_relocs + n_relocs)
+        capacity *= 2;
+
+    struct Reloc *table = (struct Reloc *)realloc (relocs->table, capacity * sizeof (struct Reloc));
+    if (table == NULL)
+        return ERROR;
+
+    relocs->table    = table;
+    relocs->capacity = capacity;
+
+    return NO_ERRORS;
 }
 
-static inline int Translate_Conditional_Jmp (char *const x86_buffer, int *const x86_ip, const enum Instructions jcc)
+// fills rel32 at opcode + rel_i of the call to func; opcode is put at x86_ip. The relocation is reserved
+// by Reserve_Relocs ().
+static inline int Put_Host_Call (char *const opcode, const int rel_i, const char *const x86_buffer, const int x86_ip,
+                                 const enum Host_Func func, struct Relocs *const relocs)
 {
-    char opcode[] = {
-                        0x5E,                   // pop rsi           
-                        0x5F,                   // pop rdi
-                        0x48, 0x39, 0xF7,       // cmp rdi, rsi
-                        0x0F, 0x00,             // jcc (can be jae, ja, jbe, jb, jne or je)
-                    };
+    *(uint32_t *)(opcode + rel_i) = (uint64_t)Host_Funcs[func] - ((uint64_t)x86_buffer + x86_ip + rel_i + sizeof (int));
 
-    switch (jcc)
-    {
-        case JAE:
-            opcode[6] = 0x8D;   // jge
-            break;
-        case JA:
-            opcode[6] = 0x8F;   // jg
-            break;
-        case JBE:
-            opcode[6] = 0x8E;   // jle
-            break;
-        case JB:
-            opcode[6] = 0x8C;   // jl
-            break;
-        case JE:
-            opcode[6] = 0x84;   // je
-            break;
-        case JNE:
-            opcode[6] = 0x85;   // jne
-            break;
+    if (relocs == NULL)
+        return NO_ERRORS;
 
-        default:
-            MY_ASSERT (false, "const enum Instructions jcc", UNEXP_VAL, ERROR);
-            break;
-    }
+    MY_ASSERT (relocs->n_relocs < relocs->capacity, "relocs->n_relocs", UNEXP_VAL, ERROR);
 
-    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+    relocs->table[relocs->n_relocs++] = (struct Reloc){x86_ip + rel_i, func};
 
-    (*x86_ip) += 4; // making free space of 4 bytes for jump argument (relative offset)
-    
     return NO_ERRORS;
 }
 
-static inline void In (double *num_ptr)
+// points calls to host functions at their addresses in this process
+static void Apply_Relocs (char *const x86_buffer, const struct Reloc *const relocs, const int n_relocs)
 {
-    printf ("Write a number: ");
-    scanf ("%lf", num_ptr);
+    for (int reloc_i = 0; reloc_i < n_relocs; reloc_i++)
+    {
+        const int x86_ip = relocs[reloc_i].x86_ip;
+
+        *(uint32_t *)(x86_buffer + x86_ip) = (uint64_t)Host_Funcs[relocs[reloc_i].func] -
+                                             ((uint64_t)x86_buffer + x86_ip + sizeof (int));
+    }
 }
 
-static inline void Translate_In_Align_16 (char *const x86_buffer, int *const x86_ip)
+static inline void Translate_In_Align_16 (char *const x86_buffer, int *const x86_ip, struct Relocs *const relocs)
 {
     char opcode[] = {
                         0x57,   // push rdi <---------------------------------------+
@@ -338,18 +281,13 @@ static inline void Translate_In_Align_16 (char *const x86_buffer, int *const x86
                         0x58    // pop rax
                     };
 
-    *(uint32_t *)(opcode + 11) = (uint64_t )In - (uint64_t)(x86_buffer + *x86_ip + 11 + sizeof (int));
+    Put_Host_Call (opcode, 11, x86_buffer, *x86_ip, HOST_IN, relocs);
     // 11 - offset of call argument relatively to the beginning of opcode
 
     Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
 }
 
-static inline void Out (const double number)
-{
-    printf ("%g\n", number);
-}
-
-static inline void Translate_Out_Align_8 (char *const x86_buffer, int *const x86_ip)
+static inline void Translate_Out_Align_8 (char *const x86_buffer, int *const x86_ip, struct Relocs *const relocs)
 {
     char opcode[] = {
                         0xF2, 0x0F, 0x10, 0x04, 0x24,   // movsd xmm0, qword [rsp]
@@ -369,7 +307,7 @@ static inline void Translate_Out_Align_8 (char *const x86_buffer, int *const x86
                         0x5F        // pop rdi
                     };
 
-    *(uint32_t *)(opcode + 10) = (uint64_t )Out - (uint64_t)(x86_buffer + *x86_ip + 10 + sizeof (int));
+    Put_Host_Call (opcode, 10, x86_buffer, *x86_ip, HOST_OUT, relocs);
     // 10 - offset of call argument relatively to the beginning of opcode
 
     Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
@@ -377,7 +315,7 @@ static inline void Translate_Out_Align_8 (char *const x86_buffer, int *const x86
 
 static inline void Translate_Pop (char *const x86_buff, int *const x86_ip)
 {
-    x86_buff[(*x86_ip)++] = 0x5F;
+    Put_Byte_In_x86_Buffer (x86_buff, x86_ip, 0x5F);
 }
 
 static inline void Translate_Push_Num (char *const x86_buffer, int *const x86_ip, const double num)
@@ -394,16 +332,17 @@ static inline void Translate_Push_Num (char *const x86_buffer, int *const x86_ip
     Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
 }
 
+// RAM of the running instance is addressed through r15 (struct RAM): [num] is [r15 + num]
 static inline void Translate_Push_RAM_Num (char *const x86_buffer, int *const x86_ip, const int num)
 {
     char opcode[] = {
-                        0x48, 0x8B, 0x3C, 0x25,     // mov rdi, qword [0]
+                        0x49, 0x8B, 0xBF,           // mov rdi, qword [r15 + 0]
                         0x00, 0x00, 0x00, 0x00,     // (0 is changed below)
 
                         0x57                        // push rdi
                     };
 
-    *(int *)(opcode + 4) = num;
+    *(int *)(opcode + 3) = num;
 
     Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
 }
@@ -413,23 +352,15 @@ static inline void Translate_Pop_RAM_Num (char *const x86_buffer, int *const x86
     char opcode[] = {
                         0x5F,                       // pop rdi
 
-                        0x48, 0x89, 0x3C, 0x25,     // mov [0], rdi
+                        0x49, 0x89, 0xBF,           // mov qword [r15 + 0], rdi
                         0x00, 0x00, 0x00, 0x00,     // (0 is changed below)
                     };
 
-    *(int *)(opcode + 5) = num;
+    *(int *)(opcode + 4) = num;
 
     Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
 }
 
-enum Registers
-{
-    ax = 0x01,
-    bx = 0x02,
-    cx = 0x03,
-    dx = 0x04
-};
-
 static inline int Translate_Push_Reg (char *const x86_buffer, int *const x86_ip, const enum Registers reg)
 {
     char opcode = 0;
@@ -454,7 +385,7 @@ static inline int Translate_Push_Reg (char *const x86_buffer, int *const x86_ip,
             break;
     }
 
-    x86_buffer[(*x86_ip)++] = opcode;
+    Put_Byte_In_x86_Buffer (x86_buffer, x86_ip, opcode);
 
     return NO_ERRORS;
 }
@@ -483,40 +414,38 @@ static inline int Translate_Pop_Reg (char *const x86_buffer, int *const x86_ip,
             break;
     }
 
-    x86_buffer[(*x86_ip)++] = opcode;
+    Put_Byte_In_x86_Buffer (x86_buffer, x86_ip, opcode);
 
     return NO_ERRORS;
 }
 
-static inline int Translate_Push_RAM_Reg (char *const x86_buffer, int *const x86_ip, const enum Registers reg)
+// [reg] is [r15 + rdi], where edi = (int)reg: the register holds a double. Negative, too large
+// and NaN indices are 2^31 and more as unsigned numbers, they hit the guard pages.
+static inline int Translate_RAM_Index (char *const x86_buffer, int *const x86_ip, const enum Registers reg)
 {
+    MY_ASSERT (ax <= reg && reg <= dx, "const enum Registers reg", UNEXP_VAL, ERROR);
+
     char opcode[] = {
-                        0x48, 0x8B, 0x00,     // mov rdi, qword [r?x]
-                                //    |
-                        0x57    //    +--- 0 is changed below  
-                    //    | 
-                    //    +---- push rdi              
+                        0x66, 0x4C, 0x0F, 0x6E, 0xF8,   // movq      xmm15, r?x
+                        0xF2, 0x41, 0x0F, 0x2C, 0xFF    // cvttsd2si edi, xmm15
                     };
 
-    switch (reg)
-    {
-        case ax:
-            opcode[2] = 0x38;      // rax
-            break;
-        case bx:
-            opcode[2] = 0x3B;      // rbx
-            break;
-        case cx:
-            opcode[2] = 0x39;      // rcx
-            break;
-        case dx:
-            opcode[2] = 0x3A;      // rdx
-            break;
+    opcode[4] |= x86_Reg_Codes[reg];
 
-        default:
-            MY_ASSERT (false, "const enum Registers reg", UNEXP_VAL, ERROR);
-            break;   
-    }
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+
+    return NO_ERRORS;
+}
+
+static inline int Translate_Push_RAM_Reg (char *const x86_buffer, int *const x86_ip, const enum Registers reg)
+{
+    const char opcode[] = {
+                              0x49, 0x8B, 0x3C, 0x3F,   // mov rdi, qword [r15 + rdi]
+                              0x57                      // push rdi
+                          };
+
+    if (Translate_RAM_Index (x86_buffer, x86_ip, reg) == ERROR)
+        return ERROR;
 
     Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
 
@@ -525,33 +454,13 @@ static inline int Translate_Push_RAM_Reg (char *const x86_buffer, int *const x86
 
 static inline int Translate_Pop_RAM_Reg (char *const x86_buffer, int *const x86_ip, const enum Registers reg)
 {
-    char opcode[] = {
-                        0x5F,               // pop rdi
-                        
-                        0x48, 0x89, 0x00,   // mov rdi, qword [r?x]
-                        //           |
-                        //           +--- 0 is changed below               
-                    };
-
-    switch (reg)
-    {
-        case ax:
-            opcode[3] = 0x38;      // rax
-            break;
-        case bx:
-            opcode[3] = 0x3B;      // rbx
-            break;
-        case cx:
-            opcode[3] = 0x39;      // rcx
-            break;
-        case dx:
-            opcode[3] = 0x3A;      // rdx
-            break;
+    const char opcode[] = {
+                              0x5E,                     // pop rsi
+                              0x49, 0x89, 0x34, 0x3F    // mov qword [r15 + rdi], rsi
+                          };
 
-        default:
-            MY_ASSERT (false, "const enum Registers reg", UNEXP_VAL, ERROR);
-            break;   
-    }
+    if (Translate_RAM_Index (x86_buffer, x86_ip, reg) == ERROR)
+        return ERROR;
 
     Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
 
@@ -559,34 +468,17 @@ static inline int Translate_Pop_RAM_Reg (char *const x86_buffer, int *const x86_
 }
 
 static inline int Translate_Push_RAM_Reg_Num (char *const x86_buffer, int *const x86_ip, const enum Registers reg, const int num)
-{    
+{
     char opcode[] = {
-                        0x48, 0x8B, 0x00,       // mov rdi, qword [r?x + num]
-                        0x00, 0x00, 0x00, 0x00, // <-- num
-                        0x57                    // push rdi
-                    }; 
-    
-    switch (reg)
-    {
-        case ax:
-            opcode[2] = 0xB8;      // rax
-            break;
-        case bx:
-            opcode[2] = 0xBB;      // rbx
-            break;
-        case cx:
-            opcode[2] = 0xB9;      // rcx
-            break;
-        case dx:
-            opcode[2] = 0xBA;      // rdx
-            break;
+                        0x49, 0x8B, 0xBC, 0x3F,     // mov rdi, qword [r15 + rdi + num]
+                        0x00, 0x00, 0x00, 0x00,     // <-- num
+                        0x57                        // push rdi
+                    };
 
-        default:
-            MY_ASSERT (false, "const enum Registers reg", UNEXP_VAL, ERROR);  
-            break;
-    }
+    *(int *)(opcode + 4) = num;
 
-    *(int *)(opcode + 3) = num;
+    if (Translate_RAM_Index (x86_buffer, x86_ip, reg) == ERROR)
+        return ERROR;
 
     Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
 
@@ -594,42 +486,71 @@ static inline int Translate_Push_RAM_Reg_Num (char *const x86_buffer, int *const
 }
 
 static inline int Translate_Pop_RAM_Reg_Num (char *const x86_buffer, int *const x86_ip, const enum Registers reg, const int num)
-{    
+{
     char opcode[] = {
-                        0x5F,                   // pop rdi
-                        0x48, 0x89, 0x00,       // mov rdi, qword [r?x + num]
-                        0x00, 0x00, 0x00, 0x00, // <-- num
-                    }; 
+                        0x5E,                       // pop rsi
+                        0x49, 0x89, 0xB4, 0x3F,     // mov qword [r15 + rdi + num], rsi
+                        0x00, 0x00, 0x00, 0x00,     // <-- num
+                    };
 
-    switch (reg)
+    *(int *)(opcode + 5) = num;
+
+    if (Translate_RAM_Index (x86_buffer, x86_ip, reg) == ERROR)
+        return ERROR;
+
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+
+    return NO_ERRORS;
+}
+
+// Opcode byte of the scalar form (after F2 0F or VEX.F2.0F)
+static inline char Math_Opcode (const enum ISA instruction)
+{
+    switch (instruction)
     {
-        case ax:
-            opcode[3] = 0xB8;      // rax
-            break;
-        case bx:
-            opcode[3] = 0xBB;      // rbx
-            break;
-        case cx:
-            opcode[3] = 0xB9;      // rcx
-            break;
-        case dx:
-            opcode[3] = 0xBA;      // rdx
-            break;
+        case add:
+            return 0x58;    // addsd
+        case sub:
+            return 0x5C;    // subsd
+        case mul:
+            return 0x59;    // mulsd
+        case dvd:
+            return 0x5E;    // divsd
+        case Sqrt:
+            return 0x51;    // sqrtsd
 
         default:
-            MY_ASSERT (false, "const enum Registers reg", UNEXP_VAL, ERROR);  
+            MY_ASSERT (false, "const enum ISA instruction", UNEXP_VAL, 0);
             break;
     }
-    
-    *(int *)(opcode + 4) = num;
 
-    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+    return 0;
+}
 
-    return NO_ERRORS;
+// the second operand is read from memory straight into the instruction, the first one isn't overwritten
+static inline void Translate_VEX_Arithmetics (char *const x86_buffer, int *const x86_ip, const enum ISA instruction)
+{
+    char opcode[] = {
+                        0xC5, 0xFB, 0x10, 0x4C, 0x24, 0x08,     // vmovsd  xmm1, qword [rsp + 8]
+                        0xC5, 0xF3, 0x00, 0x0C, 0x24,           // "instruction" xmm1, xmm1, qword [rsp]
+                        0x48, 0x83, 0xC4, 0x08,                 // add     rsp, 8
+                        0xC5, 0xFB, 0x11, 0x0C, 0x24            // vmovsd  qword [rsp], xmm1
+                    };
+
+    opcode[8] = Math_Opcode (instruction);
+
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
 }
 
-static int Translate_Arithmetics (char *const x86_buffer, int *const x86_ip, const enum Instructions instruction)
+static int Translate_Arithmetics (char *const x86_buffer, int *const x86_ip, const enum ISA instruction,
+                                  const unsigned x86_ext)
 {
+    if (x86_ext & EXT_AVX)
+    {
+        Translate_VEX_Arithmetics (x86_buffer, x86_ip, instruction);
+        return NO_ERRORS;
+    }
+
     const char first_part[] = {
                                 0xF2, 0x0F, 0x10, 0x4C, 0x24, 0x08,     // movsd   xmm1, qword [rsp + 8]
                                 0xF2, 0x0F, 0x10, 0x14, 0x24,           // movsd   xmm2, qword [rsp]
@@ -644,21 +565,21 @@ static int Translate_Arithmetics (char *const x86_buffer, int *const x86_ip, con
 
     switch (instruction)
     {
-        case ADD:
+        case add:
             math_instruction[2] = 0x58;     // addsd   xmm1, xmm2
             break;
-        case SUB:
+        case sub:
             math_instruction[2] = 0x5C;     // subsd   xmm1, xmm2
             break;
-        case MUL:
+        case mul:
             math_instruction[2] = 0x59;     // mulsd   xmm1, xmm2
             break;
-        case DVD:
+        case dvd:
             math_instruction[2] = 0x5E;     // divsd   xmm1, xmm2
             break;
 
         default:
-            MY_ASSERT (false, "const enum Instructions instruction", UNEXP_VAL, ERROR);
+            MY_ASSERT (false, "const enum ISA instruction", UNEXP_VAL, ERROR);
     }
 
     Put_In_x86_Buffer (x86_buffer, x86_ip, math_instruction, sizeof math_instruction);
@@ -672,367 +593,2648 @@ static int Translate_Arithmetics (char *const x86_buffer, int *const x86_ip, con
     return NO_ERRORS;
 }
 
-static inline void Translate_Sqrt (char *const x86_buffer, int *const x86_ip)
+static inline void Translate_Sqrt (char *const x86_buffer, int *const x86_ip, const unsigned x86_ext)
 {
+    if (x86_ext & EXT_AVX)
+    {
+        const char opcode[] = {
+                                0xC5, 0xFB, 0x10, 0x04, 0x24,   // vmovsd  xmm0, qword [rsp]
+                                0xC5, 0xFB, 0x51, 0xC0,         // vsqrtsd xmm0, xmm0, xmm0
+                                0xC5, 0xFB, 0x11, 0x04, 0x24    // vmovsd  qword [rsp], xmm0
+                              };
+
+        Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+        return;
+    }
+
     const char opcode[] = {
                             0xF2, 0x0F, 0x10, 0x04, 0x24,   // movsd   xmm0, qword [rsp]
-                            0x66, 0x0F, 0x51, 0xC0,         // sqrtpd  xmm0, xmm0
+                            0xF2, 0x0F, 0x51, 0xC0,         // sqrtsd  xmm0, xmm0
                             0xF2, 0x0F, 0x11, 0x04, 0x24    // movsd   qword [rsp], xmm0
                           };
     
     Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
 }
 
-#define PAGE_SIZE 4096
-static void *aligned_calloc (const size_t n_elems, const size_t one_elem_size)
+// Counters are put between instructions, where rdi and flags are free. The address is absolute, so the code
+// can be moved by branch relaxation.
+static inline void Translate_Count (char *const x86_buffer, int *const x86_ip, uint64_t *const counter)
 {
-    size_t new_size = ((n_elems * one_elem_size >> 12) + 1) << 12;     // 2^12 = 4096 - page size in Linux
-    
-    void *array = aligned_alloc (PAGE_SIZE, new_size);
+    char opcode[] = {
+                        0x48, 0xBF, 0, 0, 0, 0, 0, 0, 0, 0, // mov rdi, counter
+                        0x48, 0xFF, 0x07                    // inc qword [rdi]
+                    };
 
-    memset (array, 0, new_size);
+    *(uint64_t **)(opcode + 2) = counter;
 
-    return array;
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
 }
-#undef PAGE_SIZE
 
-static int Handle_Push_Pop_Second (const char *const proc_buff, int *const ip, char *const x86_buffer, int *const x86_ip)
+// Translated code keeps VM register bx in rbx, which is callee-saved. The stub is put right after
+// the code and saves rbx around it, so the caller's rbx survives.
+// entry (code, ram, regs): VM registers are loaded from regs and stored back at hlt; rbx, r14 and r15 are
+// callee-saved in the host, the code gets the stack aligned like a function. r14 points at the address
+// of the exit of hlt: the stub returns 1 if the program stopped at hlt and 0 if the code returned.
+static const char Entry_Stub[] =
 {
-    MY_ASSERT (proc_buff,  "const char *const proc_buff", NULL_PTR, ERROR);
-    MY_ASSERT (ip,         "int *const ip",               NULL_PTR, ERROR);
-    MY_ASSERT (x86_buffer, "char *const x86_buffer",      NULL_PTR, ERROR);
-    MY_ASSERT (x86_ip,     "int *const x86_ip",           NULL_PTR, ERROR);
-    
-    const char instr_name = proc_buff[*ip];
+    0x53,                       // push rbx
+    0x41, 0x57,                 // push r15
+    0x41, 0x56,                 // push r14
+    0x52,                       // push rdx
+    0x49, 0x89, 0xF7,           // mov  r15, rsi
+
+    0x48, 0x8D, 0x05, 0x1A, 0x00, 0x00, 0x00,   // lea rax, [rip + halt]
+    0x50,                       // push rax
+    0x49, 0x89, 0xE6,           // mov  r14, rsp
+
+    0x48, 0x8B, 0x02,           // mov  rax, qword [rdx]
+    0x48, 0x8B, 0x5A, 0x08,     // mov  rbx, qword [rdx + 8]
+    0x48, 0x8B, 0x4A, 0x10,     // mov  rcx, qword [rdx + 16]
+    0x48, 0x8B, 0x52, 0x18,     // mov  rdx, qword [rdx + 24]
+
+    0xFF, 0xD7,                 // call rdi
+
+    0x5E,                       // pop  rsi (the address of halt)
+    0x31, 0xF6,                 // xor  esi, esi
+    0xEB, 0x05,                 // jmp  store
+                                // halt:
+    0xBE, 0x01, 0x00, 0x00, 0x00,   // mov esi, 1
+                                // store:
+    0x5F,                       // pop  rdi
+    0x48, 0x89, 0x07,           // mov  qword [rdi], rax
+    0x48, 0x89, 0x5F, 0x08,     // mov  qword [rdi + 8], rbx
+    0x48, 0x89, 0x4F, 0x10,     // mov  qword [rdi + 16], rcx
+    0x48, 0x89, 0x57, 0x18,     // mov  qword [rdi + 24], rdx
+    0x89, 0xF0,                 // mov  eax, esi
+
+    0x41, 0x5E,                 // pop  r14
+    0x41, 0x5F,                 // pop  r15
+    0x5B,                       // pop  rbx
+    0xC3                        // ret
+};
 
-    const int checksum = proc_buff[*ip + 1] + 10 * proc_buff[*ip + 2] + 100 * proc_buff[*ip + 3];
-    //                         |                        |                         |
-    //                       if RAM                   if reg                    if num
-    
-    switch (checksum)
-    {
-        case EMPTY:
-            Translate_Pop (x86_buffer, x86_ip);
-            *ip += ISA_Consts[pop].proc_sz;
-            break;
-        
-        case NUM:
-        {
-            const double num = *(double *)(proc_buff + *ip + 1 + 3);
+static inline size_t x86_Buffer_Size (const struct Bin_Tr *const bin_tr)
+{
+    return bin_tr->x86_max_ip + sizeof Entry_Stub;
+}
 
-            Translate_Push_Num (x86_buffer, x86_ip, num);
-            *ip += ISA_Consts[push_num].proc_sz;
+#define COMMIT_STEP  (64L << 10)
+#define RESERVE_SIZE (256L << 20)  // the largest buffer; it never moves, so rel32 to In, Out and inside the code stays valid
 
-            break;
-        }
+static bool Is_In_Reach (const char *const buffer, const long size)
+{
+    for (int func_i = 0; func_i < N_HOST_FUNCS; func_i++)
+    {
+        const int64_t to_begin = (int64_t)Host_Funcs[func_i] - (int64_t)buffer;
+        const int64_t to_end   = (int64_t)Host_Funcs[func_i] - (int64_t)(buffer + size);
+
+        if (to_begin < INT32_MIN || to_begin > INT32_MAX || to_end < INT32_MIN || to_end > INT32_MAX)
+            return false;
+    }
+
+    return true;
+}
+
+// Calls to In and Out are rel32, so the code has to be within 2 GB of them: the buffer is a region of the
+// code arena, which lies right below the binary. The region is as large as the code can get (max_size),
+// pages are made writable by Grow_x86_Buffer () and the rest goes back to the arena in Make_Executable ().
+// Returns NULL on failure.
+static char *Alloc_x86_Buffer (struct Bin_Tr *const bin_tr, const long max_size)
+{
+    const long size = Arena_Round_Up ((max_size < RESERVE_SIZE) ? max_size : RESERVE_SIZE);
+
+    bin_tr->x86_capacity = 0;
+    bin_tr->x86_reserved = 0;
+
+    char *buffer = Arena_Alloc (size, bin_tr->huge_pages, (const void *)Host_Funcs[HOST_IN]);
+    if (buffer == NULL)
+        return NULL;
+
+    if (!Is_In_Reach (buffer, size))
+    {
+        Arena_Free (buffer, size);
+        return NULL;
+    }
+
+    bin_tr->x86_reserved = size;
+
+    return buffer;
+}
+
+// makes at least size bytes of the buffer writable
+static int Grow_x86_Buffer (struct Bin_Tr *const bin_tr, const long size)
+{
+    if (size <= bin_tr->x86_capacity)
+        return NO_ERRORS;
+
+    long capacity = (bin_tr->x86_capacity) ? bin_tr->x86_capacity : COMMIT_STEP;
+    while (capacity < size)
+        capacity *= 2;
+
+    if (capacity > bin_tr->x86_reserved)
+        capacity = bin_tr->x86_reserved;
+
+    if (capacity < size ||
+        Arena_Write (bin_tr->x86_buff + bin_tr->x86_sealed, capacity - bin_tr->x86_sealed) == ERROR)
+        return ERROR;
+
+    bin_tr->x86_capacity = capacity;
+
+    return NO_ERRORS;
+}
+
+static inline void Free_x86_Buffer (struct Bin_Tr *const bin_tr)
+{
+    Arena_Free (bin_tr->x86_buff, bin_tr->x86_reserved);
+
+    bin_tr->x86_buff     = NULL;
+    bin_tr->x86_capacity = 0;
+    bin_tr->x86_reserved = 0;
+    bin_tr->x86_sealed   = 0;
+}
+
+#undef COMMIT_STEP
+#undef RESERVE_SIZE
+
+
+//=====================================================================================//
+//                                   REGISTER STACK                                    //
+//=====================================================================================//
+
+// In this mode the top of the operand stack lives in xmm registers while a basic block
+// is translated. The hardware stack is touched only when the cache overflows, at block
+// boundaries (jump targets, jumps, call, ret, hlt) and around in/out. Loops may keep registers
+// and invariant values in xmm8 - xmm14, see Hoist_Loop_Invariants ().
+
+#define N_XMM_SLOTS 8   // xmm0 - xmm7 are encoded without REX prefix
+
+struct Reg_Stack
+{
+    int n_cached;   // stack entries cached in xmm0 ... xmm(n_cached - 1);
+                    // xmm(n_cached - 1) is the top of the operand stack
+};
+
+enum x86_GPR
+{
+    RSI = 0x06,
+    RDI = 0x07
+};
+
+enum Movsd_Direction
+{
+    XMM_LOAD  = 0x10,   // movsd xmm, qword [mem]
+    XMM_STORE = 0x11    // movsd qword [mem], xmm
+};
+
+static inline void Translate_Add_Rsp (char *const x86_buffer, int *const x86_ip, const int n_bytes)
+{
+    char opcode[] = {0x48, 0x83, 0xC4, 0x00};   // add rsp, n_bytes (imm8, sign-extended)
+
+    opcode[3] = (char)n_bytes;
+
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+}
+
+static inline void Translate_Movsd_Rsp (char *const x86_buffer, int *const x86_ip, const enum Movsd_Direction dir,
+                                        const int xmm, const int disp)
+{
+    if (disp == 0)
+    {
+        char opcode[] = {0xF2, 0x0F, dir, 0x04 | (xmm << 3), 0x24};         // movsd xmm, qword [rsp]
+
+        Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+    }
+    else
+    {
+        char opcode[] = {0xF2, 0x0F, dir, 0x44 | (xmm << 3), 0x24, disp};   // movsd xmm, qword [rsp + disp8]
+
+        Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+    }
+}
+
+// xmm8 - xmm15 get REX.R
+static inline void Translate_Movq_To_Xmm (char *const x86_buffer, int *const x86_ip, const int xmm, const int gpr)
+{
+    char opcode[] = {0x66, 0x48 | ((xmm & 8) >> 1), 0x0F, 0x6E, 0xC0 | ((xmm & 7) << 3) | gpr};    // movq xmm, r64
+
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+}
+
+static inline void Translate_Movq_From_Xmm (char *const x86_buffer, int *const x86_ip, const int gpr, const int xmm)
+{
+    char opcode[] = {0x66, 0x48 | ((xmm & 8) >> 1), 0x0F, 0x7E, 0xC0 | ((xmm & 7) << 3) | gpr};    // movq r64, xmm
+
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+}
+
+static inline void Translate_Movaps (char *const x86_buffer, int *const x86_ip, const int dst, const int src)
+{
+    if (dst < 8 && src < 8)
+    {
+        char opcode[] = {0x0F, 0x28, 0xC0 | (dst << 3) | src};                          // movaps xmm(dst), xmm(src)
+
+        Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+    }
+    else
+    {
+        char opcode[] = {0x40 | ((dst & 8) >> 1) | ((src & 8) >> 3), 0x0F, 0x28,        // REX.R, REX.B
+                         0xC0 | ((dst & 7) << 3) | (src & 7)};                          // movaps xmm(dst), xmm(src)
+
+        Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+    }
+}
+
+enum VEX_Map
+{
+    VEX_0F   = 0x01,
+    VEX_0F38 = 0x02
+};
+
+enum VEX_Prefix     // the legacy prefix the VEX prefix stands for
+{
+    VEX_66 = 0x01,
+    VEX_F2 = 0x03
+};
+
+// VEX prefix of an instruction on xmm registers: reg is the destination, src1 goes to vvvv and rm is the other
+// source; the 2-byte form has neither the 0F38 map, nor W, nor REX.B for rm
+static inline void Translate_VEX_Prefix (char *const x86_buffer, int *const x86_ip, const enum VEX_Map map,
+                                         const enum VEX_Prefix pp, const bool w,
+                                         const int reg, const int src1, const int rm)
+{
+    if (map == VEX_0F && !w && rm < 8)
+    {
+        char opcode[] = {0xC5, ((~reg & 8) << 4) | ((~src1 & 0xF) << 3) | pp};                 // ~R, ~vvvv, L = 0, pp
+
+        Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+    }
+    else
+    {
+        char opcode[] = {0xC4, ((~reg & 8) << 4) | 0x40 | ((~rm & 8) << 2) | map,            // ~R, ~X, ~B, map
+                         (w << 7) | ((~src1 & 0xF) << 3) | pp};                              // W, ~vvvv, L = 0, pp
+
+        Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+    }
+}
+
+// "instruction" xmm(dst), xmm(src1), xmm(src2): add, sub, mul, dvd or Sqrt of xmm(src2)
+static inline void Translate_VEX_Math (char *const x86_buffer, int *const x86_ip, const enum ISA instruction,
+                                       const int dst, const int src1, const int src2)
+{
+    Translate_VEX_Prefix (x86_buffer, x86_ip, VEX_0F, VEX_F2, false, dst, src1, src2);
+
+    char opcode[] = {Math_Opcode (instruction), 0xC0 | ((dst & 7) << 3) | (src2 & 7)};
+
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+}
+
+// xmm(dst) + xmm(src1) * xmm(src2) for add, xmm(dst) - xmm(src1) * xmm(src2) for sub, rounded once
+static inline void Translate_FMA (char *const x86_buffer, int *const x86_ip, const enum ISA instruction,
+                                  const int dst, const int src1, const int src2)
+{
+    Translate_VEX_Prefix (x86_buffer, x86_ip, VEX_0F38, VEX_66, true, dst, src1, src2);
+
+    char opcode[] = {0xB9, 0xC0 | ((dst & 7) << 3) | (src2 & 7)};     // vfmadd231sd xmm(dst), xmm(src1), xmm(src2)
+
+    if (instruction == sub)
+        opcode[0] = 0xBD;                                               // vfnmadd231sd
+
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+}
+
+static void Flush_Reg_Stack (struct Reg_Stack *const stack, char *const x86_buffer, int *const x86_ip)
+{
+    const int n_cached = stack->n_cached;
+
+    if (n_cached == 0)
+        return;
+
+    Translate_Add_Rsp (x86_buffer, x86_ip, -8 * n_cached);
+
+    for (int xmm = 0; xmm < n_cached; xmm++)
+        Translate_Movsd_Rsp (x86_buffer, x86_ip, XMM_STORE, xmm, 8 * (n_cached - 1 - xmm));
+
+    stack->n_cached = 0;
+}
+
+// makes sure that at least n_needed top entries are cached
+static void Fill_Reg_Stack (struct Reg_Stack *const stack, char *const x86_buffer, int *const x86_ip, const int n_needed)
+{
+    const int n_missing = n_needed - stack->n_cached;
+
+    if (n_missing <= 0)
+        return;
+
+    for (int xmm = stack->n_cached - 1; xmm >= 0; xmm--)
+        Translate_Movaps (x86_buffer, x86_ip, xmm + n_missing, xmm);
+
+    for (int xmm = 0; xmm < n_missing; xmm++)
+        Translate_Movsd_Rsp (x86_buffer, x86_ip, XMM_LOAD, xmm, 8 * (n_missing - 1 - xmm));
+
+    Translate_Add_Rsp (x86_buffer, x86_ip, 8 * n_missing);
+
+    stack->n_cached = n_needed;
+}
+
+static inline int New_Reg_Slot (struct Reg_Stack *const stack, char *const x86_buffer, int *const x86_ip)
+{
+    if (stack->n_cached == N_XMM_SLOTS)
+        Flush_Reg_Stack (stack, x86_buffer, x86_ip);
+
+    return stack->n_cached++;
+}
+
+static int Translate_Movsd_RAM (char *const x86_buffer, int *const x86_ip, const enum Movsd_Direction dir,
+                                const int xmm, const struct IR_Instr *const instr)
+{
+    switch (instr->type)
+    {
+        case push_ram_num:
+        case pop_ram_num:
+        {
+            char opcode[] = {0xF2, 0x41, 0x0F, dir, 0x87 | (xmm << 3),     // movsd xmm, qword [r15 + num]
+                             0x00, 0x00, 0x00, 0x00};
+            *(int *)(opcode + 5) = instr->disp;
+
+            Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+            break;
+        }
+
+        case push_ram_reg:
+        case pop_ram_reg:
+        {
+            char opcode[] = {0xF2, 0x41, 0x0F, dir, 0x04 | (xmm << 3), 0x3F};   // movsd xmm, qword [r15 + rdi]
+
+            if (Translate_RAM_Index (x86_buffer, x86_ip, instr->reg) == ERROR)
+                return ERROR;
+
+            Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+            break;
+        }
+
+        case push_ram_reg_num:
+        case pop_ram_reg_num:
+        {
+            char opcode[] = {0xF2, 0x41, 0x0F, dir, 0x84 | (xmm << 3), 0x3F,   // movsd xmm, qword [r15 + rdi + num]
+                             0x00, 0x00, 0x00, 0x00};
+            *(int *)(opcode + 6) = instr->disp;
+
+            if (Translate_RAM_Index (x86_buffer, x86_ip, instr->reg) == ERROR)
+                return ERROR;
+
+            Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+            break;
+        }
+
+        default:
+            MY_ASSERT (false, "instr->type", UNEXP_VAL, ERROR);
+            break;
+    }
+
+    return NO_ERRORS;
+}
+
+static int Reg_Translate_Arithmetics (char *const x86_buffer, int *const x86_ip, const enum ISA instruction,
+                                      struct Reg_Stack *const stack, const unsigned x86_ext)
+{
+    Fill_Reg_Stack (stack, x86_buffer, x86_ip, 2);
+
+    const int src = --stack->n_cached;
+    const int dst = src - 1;
+
+    if (x86_ext & EXT_AVX)
+    {
+        Translate_VEX_Math (x86_buffer, x86_ip, instruction, dst, dst, src);
+        return NO_ERRORS;
+    }
+
+    char opcode[] = {0xF2, 0x0F, 0x00, 0xC0 | (dst << 3) | src};   // "instruction" xmm(dst), xmm(src)
+    //                           |
+    //   this byte will be changed --+
+
+    switch (instruction)
+    {
+        case add:
+            opcode[2] = 0x58;     // addsd
+            break;
+        case sub:
+            opcode[2] = 0x5C;     // subsd
+            break;
+        case mul:
+            opcode[2] = 0x59;     // mulsd
+            break;
+        case dvd:
+            opcode[2] = 0x5E;     // divsd
+            break;
+
+        default:
+            MY_ASSERT (false, "const enum ISA instruction", UNEXP_VAL, ERROR);
+    }
+
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+
+    return NO_ERRORS;
+}
+
+static inline void Reg_Translate_Sqrt (char *const x86_buffer, int *const x86_ip, struct Reg_Stack *const stack,
+                                       const unsigned x86_ext)
+{
+    Fill_Reg_Stack (stack, x86_buffer, x86_ip, 1);
+
+    const int xmm = stack->n_cached - 1;
+
+    if (x86_ext & EXT_AVX)
+    {
+        Translate_VEX_Math (x86_buffer, x86_ip, Sqrt, xmm, xmm, xmm);
+        return;
+    }
+
+    const char opcode[] = {0xF2, 0x0F, 0x51, 0xC0 | (xmm << 3) | xmm};    // sqrtsd xmm, xmm
+
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+}
+
+static void Reg_Translate_Conditional_Jmp (char *const x86_buffer, int *const x86_ip, const enum ISA jcc,
+                                           struct Reg_Stack *const stack)
+{
+    Fill_Reg_Stack (stack, x86_buffer, x86_ip, 2);
+
+    int first  = stack->n_cached - 2;
+    int second = stack->n_cached - 1;
+    stack->n_cached -= 2;
+
+    Flush_Reg_Stack (stack, x86_buffer, x86_ip);   // the rest of the block's values go to memory
+
+    if (Jcc_Swaps_Operands (jcc))
+    {
+        const int tmp = first;
+        first  = second;
+        second = tmp;
+    }
+
+    const char opcode[] = {0x66, 0x0F, 0x2E, 0xC0 | (first << 3) | second};   // ucomisd xmm, xmm
+
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+}
+
+//=====================================================================================//
+
+//=====================================================================================//
+//                                      PEEPHOLE                                       //
+//=====================================================================================//
+
+// Rewrites of short instruction sequences inside one basic block. Every rule replaces
+// x86 code that the instructions would get one by one with a shorter equivalent.
+
+static inline void Fold_Drop (const struct IR_Instr *const instrs, char *const x86_buffer, int *const x86_ip,
+                              struct Reg_Stack *const stack, struct Relocs *const relocs)
+{
+    // push num, push reg, push_const or push_shadow; pop: nothing is left
+}
+
+static inline void Fold_Push_Num_Pop_Reg (const struct IR_Instr *const instrs, char *const x86_buffer, int *const x86_ip,
+                                          struct Reg_Stack *const stack, struct Relocs *const relocs)
+{
+    char opcode[] = {
+                        0x48, 0x00,                                         // mov r?x, 0
+                        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,     // (0 is changed below)
+                    };
+
+    opcode[1] = 0xB8 | x86_Reg_Codes[instrs[1].reg];
+    *(double *)(opcode + 2) = instrs[0].num;
+
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+}
+
+static inline void Fold_Push_Reg_Pop_Reg (const struct IR_Instr *const instrs, char *const x86_buffer, int *const x86_ip,
+                                          struct Reg_Stack *const stack, struct Relocs *const relocs)
+{
+    if (instrs[0].reg == instrs[1].reg)
+        return;
+
+    const char opcode[] = {0x48, 0x89, 0xC0 | (x86_Reg_Codes[instrs[0].reg] << 3) | x86_Reg_Codes[instrs[1].reg]};
+    //                                           mov r?x (pop), r?x (push)
+
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+}
+
+// the copy of a register kept by its loop (and the register itself for pop_shadow_reg) gets the number
+static inline void Fold_Push_Num_Pop_Shadow (const struct IR_Instr *const instrs, char *const x86_buffer, int *const x86_ip,
+                                             struct Reg_Stack *const stack, struct Relocs *const relocs)
+{
+    const int gpr = (instrs[1].type == pop_shadow_reg) ? x86_Reg_Codes[instrs[1].reg] : RDI;
+
+    char opcode[] = {
+                        0x48, 0xB8 | gpr,                                   // mov r64, 0
+                        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,     // (0 is changed below)
+                    };
+
+    *(double *)(opcode + 2) = instrs[0].num;
+
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+    Translate_Movq_To_Xmm (x86_buffer, x86_ip, instrs[1].xmm, gpr);
+}
+
+// push_const or push_shadow; pop_shadow or pop_shadow_reg: one xmm register to another
+static inline void Fold_Push_Xmm_Pop_Shadow (const struct IR_Instr *const instrs, char *const x86_buffer, int *const x86_ip,
+                                             struct Reg_Stack *const stack, struct Relocs *const relocs)
+{
+    if (instrs[0].xmm != instrs[1].xmm)
+        Translate_Movaps (x86_buffer, x86_ip, instrs[1].xmm, instrs[0].xmm);
+
+    if (instrs[1].type == pop_shadow_reg)
+        Translate_Movq_From_Xmm (x86_buffer, x86_ip, x86_Reg_Codes[instrs[1].reg], instrs[1].xmm);
+}
+
+// push_const or push_shadow; add, sub, mul or dvd: the value kept by the loop is a source of the instruction
+static inline void Fold_Push_Xmm_Math (const struct IR_Instr *const instrs, char *const x86_buffer, int *const x86_ip,
+                                       struct Reg_Stack *const stack, struct Relocs *const relocs)
+{
+    Fill_Reg_Stack (stack, x86_buffer, x86_ip, 1);
+
+    const int dst = stack->n_cached - 1;
+
+    Translate_VEX_Math (x86_buffer, x86_ip, instrs[1].type, dst, dst, instrs[0].xmm);
+}
+
+// mul; add or mul; sub: c + a * b or c - a * b rounded once instead of twice
+static inline void Fold_Mul_Add (const struct IR_Instr *const instrs, char *const x86_buffer, int *const x86_ip,
+                                 struct Reg_Stack *const stack, struct Relocs *const relocs)
+{
+    if (stack)
+    {
+        Fill_Reg_Stack (stack, x86_buffer, x86_ip, 3);
+
+        const int src2 = --stack->n_cached;
+        const int src1 = --stack->n_cached;
+
+        Translate_FMA (x86_buffer, x86_ip, instrs[1].type, src1 - 1, src1, src2);
+        return;
+    }
+
+    char opcode[] = {
+                        0xC5, 0xFB, 0x10, 0x4C, 0x24, 0x10,     // vmovsd      xmm1, qword [rsp + 16]
+                        0xC5, 0xFB, 0x10, 0x54, 0x24, 0x08,     // vmovsd      xmm2, qword [rsp + 8]
+                        0xC4, 0xE2, 0xE9, 0xB9, 0x0C, 0x24,     // vfmadd231sd xmm1, xmm2, qword [rsp]
+                        0x48, 0x83, 0xC4, 0x10,                 // add         rsp, 16
+                        0xC5, 0xFB, 0x11, 0x0C, 0x24            // vmovsd      qword [rsp], xmm1
+                    };
+
+    if (instrs[1].type == sub)
+        opcode[15] = 0xBD;                                      // vfnmadd231sd
+
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+}
+
+// registers saved for "out" are kept on the stack for the following "in"
+static inline void Fold_Out_In (const struct IR_Instr *const instrs, char *const x86_buffer, int *const x86_ip,
+                                struct Reg_Stack *const stack, struct Relocs *const relocs)
+{
+    char opcode[] = {
+                        0xF2, 0x0F, 0x10, 0x04, 0x24,   // movsd xmm0, qword [rsp]
+
+                        0x50,        // push rax
+                        0x53,        // push rbx
+                        0x51,        // push rcx
+                        0x52,        // push rdx
+
+                        0xE8, 0x00, 0x00, 0x00, 0x00,   // call Out
+                                                        // the slot of printed number is reused by In
+                        0x48, 0x8D, 0x7C, 0x24, 0x20,   // lea rdi, [rsp + 32]
+                        0xE8, 0x00, 0x00, 0x00, 0x00,   // call In
+
+                        0x5A,       // pop rdx
+                        0x59,       // pop rcx
+                        0x5B,       // pop rbx
+                        0x58,       // pop rax
+                    };
+
+    Put_Host_Call (opcode, 10, x86_buffer, *x86_ip, HOST_OUT, relocs);
+    Put_Host_Call (opcode, 20, x86_buffer, *x86_ip, HOST_IN,  relocs);
+
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+}
+
+static inline void Fold_In_Out (const struct IR_Instr *const instrs, char *const x86_buffer, int *const x86_ip,
+                                struct Reg_Stack *const stack, struct Relocs *const relocs)
+{
+    char opcode[] = {
+                        0x57,   // push rdi
+
+                        0x50,   // push rax
+                        0x53,   // push rbx
+                        0x51,   // push rcx
+                        0x52,   // push rdx
+
+                        0x48, 0x8D, 0x7C, 0x24, 0x20,           // lea rdi, [rsp + 32]
+                        0xE8, 0x00, 0x00, 0x00, 0x00,           // call In
+
+                        0xF2, 0x0F, 0x10, 0x44, 0x24, 0x20,     // movsd xmm0, qword [rsp + 32]
+                        0xE8, 0x00, 0x00, 0x00, 0x00,           // call Out
+
+                        0x5A,   // pop rdx
+                        0x59,   // pop rcx
+                        0x5B,   // pop rbx
+                        0x58,   // pop rax
+
+                        0x5F    // pop rdi
+                    };
+
+    Put_Host_Call (opcode, 11, x86_buffer, *x86_ip, HOST_IN,  relocs);
+    Put_Host_Call (opcode, 22, x86_buffer, *x86_ip, HOST_OUT, relocs);
+
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+}
+
+#define PATTERN_LEN 2
+
+struct Peephole_Rule
+{
+    unsigned char pattern[PATTERN_LEN];     // types of consecutive instructions
+    bool on_memory_stack;                   // the rewrite expects operand stack in memory (for --reg-stack)
+    void (* rewrite)(const struct IR_Instr *const instrs, char *const x86_buffer, int *const x86_ip,
+                     struct Reg_Stack *const stack, struct Relocs *const relocs);    // stack is NULL without --reg-stack
+    unsigned char x86_ext;                  // enum x86_Ext the rewrite needs
+};
+
+static const struct Peephole_Rule Peephole_Rules[] =
+{
+    {{push_num, pop_reg}, false, Fold_Push_Num_Pop_Reg},
+    {{push_reg, pop_reg}, false, Fold_Push_Reg_Pop_Reg},
+    {{push_num, pop},     false, Fold_Drop},
+    {{push_reg, pop},     false, Fold_Drop},
+
+    {{push_num,    pop_shadow},     false, Fold_Push_Num_Pop_Shadow},
+    {{push_num,    pop_shadow_reg}, false, Fold_Push_Num_Pop_Shadow},
+    {{push_const,  pop_shadow},     false, Fold_Push_Xmm_Pop_Shadow},
+    {{push_const,  pop_shadow_reg}, false, Fold_Push_Xmm_Pop_Shadow},
+    {{push_shadow, pop_shadow},     false, Fold_Push_Xmm_Pop_Shadow},
+    {{push_shadow, pop_shadow_reg}, false, Fold_Push_Xmm_Pop_Shadow},
+    {{push_const,  pop},            false, Fold_Drop},
+    {{push_shadow, pop},            false, Fold_Drop},
+
+    {{push_const,  add},            false, Fold_Push_Xmm_Math, EXT_AVX},
+    {{push_const,  sub},            false, Fold_Push_Xmm_Math, EXT_AVX},
+    {{push_const,  mul},            false, Fold_Push_Xmm_Math, EXT_AVX},
+    {{push_const,  dvd},            false, Fold_Push_Xmm_Math, EXT_AVX},
+    {{push_shadow, add},            false, Fold_Push_Xmm_Math, EXT_AVX},
+    {{push_shadow, sub},            false, Fold_Push_Xmm_Math, EXT_AVX},
+    {{push_shadow, mul},            false, Fold_Push_Xmm_Math, EXT_AVX},
+    {{push_shadow, dvd},            false, Fold_Push_Xmm_Math, EXT_AVX},
+    {{mul,         add},            false, Fold_Mul_Add,       EXT_FMA},
+    {{mul,         sub},            false, Fold_Mul_Add,       EXT_FMA},
+
+    {{out,      in},      true,  Fold_Out_In},
+    {{in,       out},     true,  Fold_In_Out}
+};
+
+static const int N_PEEPHOLE_RULES = sizeof Peephole_Rules / sizeof Peephole_Rules[0];
+
+// returns the rule matching instructions [instr_i; instr_i + PATTERN_LEN) or NULL
+static const struct Peephole_Rule *Find_Rule (const struct IR *const ir, const struct IR_Block *const block,
+                                              const int instr_i, const unsigned x86_ext)
+{
+    if (instr_i + PATTERN_LEN > block->first + block->n_instrs)
+        return NULL;
+
+    for (int rule_i = 0; rule_i < N_PEEPHOLE_RULES; rule_i++)
+    {
+        const struct Peephole_Rule *rule = Peephole_Rules + rule_i;
+
+        if (rule->x86_ext & ~x86_ext)
+            continue;
+
+        int match_i = 0;
+        while (match_i < PATTERN_LEN && ir->instrs[instr_i + match_i].type == rule->pattern[match_i])
+            match_i++;
+
+        if (match_i == PATTERN_LEN)
+            return rule;
+    }
+
+    return NULL;
+}
+
+// The rule of instr_i, unless it takes the mul of a fused multiply-add: push_const; mul; add is
+// a movaps and vfmadd231sd rather than vmulsd and vaddsd.
+static const struct Peephole_Rule *Match_Peephole (const struct IR *const ir, const struct IR_Block *const block,
+                                                   const int instr_i, const unsigned x86_ext)
+{
+    const struct Peephole_Rule *rule = Find_Rule (ir, block, instr_i, x86_ext);
+
+    if (rule == NULL || rule->x86_ext == EXT_FMA || !(x86_ext & EXT_FMA))
+        return rule;
+
+    const struct Peephole_Rule *next_rule = Find_Rule (ir, block, instr_i + 1, x86_ext);
+
+    return (next_rule && next_rule->x86_ext == EXT_FMA) ? NULL : rule;
+}
+
+//=====================================================================================//
+
+//=====================================================================================//
+//                                      LOWERING                                       //
+//=====================================================================================//
+
+// fills relative offset of the jump or call that ends at x86_ip
+static inline void Put_Rel32 (char *const x86_buffer, const int x86_ip, const int x86_dest)
+{
+    *(int *)(x86_buffer + x86_ip - sizeof (int)) = x86_dest - x86_ip;
+}
+
+// Branch to a basic block: call, jmp or jcc with rel32
+struct Branch
+{
+    int x86_ip;             // offset of the x86 instruction
+    int block;              // destination
+    unsigned char type;     // enum ISA
+    bool is_short;          // rel8 form, set by branch relaxation
+};
+
+// Branch targets: a block that isn't emitted yet has a chain of branches waiting for it.
+// The chain is threaded through their rel32 fields, each holds the end of the previous one.
+struct Labels
+{
+    int *block_x86;         // x86 offset of every emitted basic block, -1 for the others
+    int *chain;             // x86_ip after the last branch to the block waiting for it (-1 - none)
+
+    struct Branch *branches;    // in order of x86 offsets
+    int n_branches;
+    int capacity;
+
+    int *slot;              // lazy compilation: slot of every call target, -1 for the others (NULL - no slots)
+    int  slots_x86;         // x86 offset of the slot table
+};
+
+// je is guarded by jp over it: 7A 06 0F 84 rel32 or 7A 02 74 rel8
+static inline int Rel32_Branch_Size (const struct Branch *const branch)
+{
+    switch (branch->type)
+    {
+        case call:
+        case jmp:
+            return 5;       // E8/E9 rel32
+        case je:
+            return 8;
+        default:
+            return 6;       // 0F 8x rel32
+    }
+}
+
+static inline int Branch_Size (const struct Branch *const branch)
+{
+    if (branch->is_short)
+        return (branch->type == je) ? 4 : 2;    // EB/7x rel8
+
+    return Rel32_Branch_Size (branch);
+}
+
+// room for n_branches more branches: Put_Branch () appends them without checks
+static int Reserve_Branches (struct Labels *const labels, const int n_branches)
+{
+    if (labels->n_branches + n_branches <= labels->capacity)
+        return NO_ERRORS;
+
+    int capacity = (labels->capacity) ? 2 * labels->capacity : 64;
+    while (capacity < labels->n_branches + n_branches)
+        capacity *= 2;
+
+    struct Branch *branches = (struct Branch *)realloc (labels->branches, capacity * sizeof (struct Branch));
+    if (branches == NULL)
+        return ERROR;
+
+    labels->branches = branches;
+    labels->capacity = capacity;
+
+    return NO_ERRORS;
+}
+
+// x86_buffer == NULL: the code is only measured
+static inline int Put_Branch (char *const x86_buffer, const int x86_ip, struct Labels *const labels,
+                              const struct IR_Instr *const instr)
+{
+    if (x86_buffer == NULL)
+        return NO_ERRORS;
+
+    const int block = instr->jump.block;
+
+    if (labels->block_x86[block] >= 0)
+        Put_Rel32 (x86_buffer, x86_ip, labels->block_x86[block]);
+    else
+    {
+        *(int *)(x86_buffer + x86_ip - sizeof (int)) = labels->chain[block];
+        labels->chain[block] = x86_ip;
+    }
+
+    MY_ASSERT (labels->n_branches < labels->capacity, "labels->n_branches", UNEXP_VAL, ERROR);
+
+    struct Branch *branch = labels->branches + labels->n_branches++;
+    *branch = (struct Branch){0, block, instr->type, false};
+    branch->x86_ip = x86_ip - Branch_Size (branch);
+
+    return NO_ERRORS;
+}
+
+// jcc after ucomisd; jne is also taken by NaN (jp to the same block), je is not (jp over it)
+static int Put_Jcc (char *const x86_buffer, int *const x86_ip, struct Labels *const labels,
+                    const struct IR_Instr *const instr)
+{
+    if (instr->type == jne)
+    {
+        const char jp[] = {0x0F, 0x8A};                 // jp
+
+        Put_In_x86_Buffer (x86_buffer, x86_ip, jp, sizeof jp);
+        (*x86_ip) += 4; // making free space of 4 bytes for jump argument (relative offset)
+
+        Put_Branch (x86_buffer, *x86_ip, labels, instr);
+    }
+    else if (instr->type == je)
+    {
+        const char jp[] = {0x7A, 0x06};                 // jp over je rel32
+
+        Put_In_x86_Buffer (x86_buffer, x86_ip, jp, sizeof jp);
+    }
+
+    char opcode[] = {0x0F, 0x00};                       // jcc (can be jae, ja, je, jne, jb or jbe)
+
+    opcode[1] = Jcc_Opcode (instr->type);
+    MY_ASSERT (opcode[1] != 0, "Jcc_Opcode ()", FUNC_ERROR, ERROR);
+
+    Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+    (*x86_ip) += 4; // making free space of 4 bytes for jump argument (relative offset)
+
+    return Put_Branch (x86_buffer, *x86_ip, labels, instr);
+}
+
+// the block starts at x86_ip: branches waiting for it are patched
+static void Bind_Label (char *const x86_buffer, const int x86_ip, struct Labels *const labels, const int block)
+{
+    labels->block_x86[block] = x86_ip;
+
+    for (int branch_x86_ip = labels->chain[block]; branch_x86_ip >= 0; )
+    {
+        const int next = *(int *)(x86_buffer + branch_x86_ip - sizeof (int));
+
+        Put_Rel32 (x86_buffer, branch_x86_ip, x86_ip);
+        branch_x86_ip = next;
+    }
+
+    labels->chain[block] = -1;
+}
+
+static int Lower_Instr_Stack (const struct IR_Instr *const instr, char *const x86_buffer, int *const x86_ip,
+                              struct Labels *const labels, struct Relocs *const relocs, const unsigned x86_ext)
+{
+    MY_ASSERT (instr,  "const struct IR_Instr *const instr", NULL_PTR, ERROR);
+    MY_ASSERT (x86_ip, "int *const x86_ip",                  NULL_PTR, ERROR);
+
+    switch (instr->type)
+    {
+        case hlt:
+            Translate_Hlt (x86_buffer, x86_ip);
+            break;
+
+        case ret:
+            Translate_Ret (x86_buffer, x86_ip);
+            break;
+
+        case call:
+            // a procedure that isn't compiled yet is called through its slot
+            if (labels->slot && labels->block_x86[instr->jump.block] < 0)
+                Translate_Slot_Call (x86_buffer, x86_ip,
+                                     labels->slots_x86 + labels->slot[instr->jump.block] * (int)sizeof (char *));
+            else
+            {
+                Translate_Call (x86_buffer, x86_ip);
+                Put_Branch (x86_buffer, *x86_ip, labels, instr);
+            }
+            break;
+
+        case jmp:
+            Translate_Jmp (x86_buffer, x86_ip);
+            Put_Branch (x86_buffer, *x86_ip, labels, instr);
+            break;
+
+        case jae:
+        case ja:
+        case jbe:
+        case jb:
+        case je:
+        case jne:
+        case jnae:
+        case jna:
+        case jnbe:
+        case jnb:
+            Translate_Conditional_Jmp (x86_buffer, x86_ip, instr->type);
+            Put_Jcc (x86_buffer, x86_ip, labels, instr);
+            break;
+
+        case in:
+            Translate_In_Align_16 (x86_buffer, x86_ip, relocs);
+            break;
+
+        case out:
+            Translate_Out_Align_8 (x86_buffer, x86_ip, relocs);
+            break;
+
+        case push_num:
+            Translate_Push_Num (x86_buffer, x86_ip, instr->num);
+            break;
+
+        case push_ram_num:
+            Translate_Push_RAM_Num (x86_buffer, x86_ip, instr->disp);
+            break;
+
+        case push_reg:
+            Translate_Push_Reg (x86_buffer, x86_ip, instr->reg);
+            break;
+
+        case push_ram_reg:
+            Translate_Push_RAM_Reg (x86_buffer, x86_ip, instr->reg);
+            break;
+
+        case push_ram_reg_num:
+            Translate_Push_RAM_Reg_Num (x86_buffer, x86_ip, instr->reg, instr->disp);
+            break;
+
+        case pop:
+            Translate_Pop (x86_buffer, x86_ip);
+            break;
+
+        case pop_ram_num:
+            Translate_Pop_RAM_Num (x86_buffer, x86_ip, instr->disp);
+            break;
+
+        case pop_reg:
+            Translate_Pop_Reg (x86_buffer, x86_ip, instr->reg);
+            break;
+
+        case pop_ram_reg:
+            Translate_Pop_RAM_Reg (x86_buffer, x86_ip, instr->reg);
+            break;
+
+        case pop_ram_reg_num:
+            Translate_Pop_RAM_Reg_Num (x86_buffer, x86_ip, instr->reg, instr->disp);
+            break;
+
+        case add:
+        case sub:
+        case mul:
+        case dvd:
+            Translate_Arithmetics (x86_buffer, x86_ip, instr->type, x86_ext);
+            break;
+
+        case Sqrt:
+            Translate_Sqrt (x86_buffer, x86_ip, x86_ext);
+            break;
+
+        case nop:
+            break;
+
+        default:
+            MY_ASSERT (false, "instr->type", UNEXP_VAL, ERROR);
+            break;
+    }
+
+    return NO_ERRORS;
+}
+
+static int Lower_Instr_Reg (const struct IR_Instr *const instr, char *const x86_buffer, int *const x86_ip,
+                            struct Labels *const labels, struct Reg_Stack *const stack, struct Relocs *const relocs,
+                            const unsigned x86_ext)
+{
+    MY_ASSERT (instr,  "const struct IR_Instr *const instr", NULL_PTR, ERROR);
+    MY_ASSERT (x86_ip, "int *const x86_ip",                  NULL_PTR, ERROR);
+    MY_ASSERT (stack,  "struct Reg_Stack *const stack",      NULL_PTR, ERROR);
+
+    switch (instr->type)
+    {
+        case hlt:
+        case ret:
+        case call:
+        case jmp:
+        case in:
+        case out:
+            Flush_Reg_Stack (stack, x86_buffer, x86_ip);
+            Lower_Instr_Stack (instr, x86_buffer, x86_ip, labels, relocs, x86_ext);
+            break;
+
+        case jae:
+        case ja:
+        case jbe:
+        case jb:
+        case je:
+        case jne:
+        case jnae:
+        case jna:
+        case jnbe:
+        case jnb:
+            Reg_Translate_Conditional_Jmp (x86_buffer, x86_ip, instr->type, stack);
+            Put_Jcc (x86_buffer, x86_ip, labels, instr);
+            break;
+
+        case push_num:
+        {
+            char opcode[] = {
+                                0x48, 0xBF,                                         // mov rdi, 0
+                                0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,     // (0 is changed below)
+                            };
+
+            *(double *)(opcode + 2) = instr->num;
+
+            const int xmm = New_Reg_Slot (stack, x86_buffer, x86_ip);
+
+            Put_In_x86_Buffer (x86_buffer, x86_ip, opcode, sizeof opcode);
+            Translate_Movq_To_Xmm (x86_buffer, x86_ip, xmm, RDI);
+            break;
+        }
+
+        case push_reg:
+        {
+            const int xmm = New_Reg_Slot (stack, x86_buffer, x86_ip);
+            Translate_Movq_To_Xmm (x86_buffer, x86_ip, xmm, x86_Reg_Codes[instr->reg]);
+            break;
+        }
+
+        case push_ram_num:
+        case push_ram_reg:
+        case push_ram_reg_num:
+        {
+            const int xmm = New_Reg_Slot (stack, x86_buffer, x86_ip);
+            Translate_Movsd_RAM (x86_buffer, x86_ip, XMM_LOAD, xmm, instr);
+            break;
+        }
+
+        case pop:
+            if (stack->n_cached > 0)
+                stack->n_cached--;  // the value is just forgotten
+            else
+                Translate_Pop (x86_buffer, x86_ip);
+            break;
+
+        case pop_reg:
+            if (stack->n_cached > 0)
+                Translate_Movq_From_Xmm (x86_buffer, x86_ip, x86_Reg_Codes[instr->reg], --stack->n_cached);
+            else
+                Translate_Pop_Reg (x86_buffer, x86_ip, instr->reg);
+            break;
+
+        case pop_ram_num:
+        case pop_ram_reg:
+        case pop_ram_reg_num:
+            Fill_Reg_Stack (stack, x86_buffer, x86_ip, 1);
+            Translate_Movsd_RAM (x86_buffer, x86_ip, XMM_STORE, --stack->n_cached, instr);
+            break;
+
+        case add:
+        case sub:
+        case mul:
+        case dvd:
+            Reg_Translate_Arithmetics (x86_buffer, x86_ip, instr->type, stack, x86_ext);
+            break;
+
+        case Sqrt:
+            Reg_Translate_Sqrt (x86_buffer, x86_ip, stack, x86_ext);
+            break;
+
+        case push_const:
+        case push_shadow:
+        {
+            const int xmm = New_Reg_Slot (stack, x86_buffer, x86_ip);
+            Translate_Movaps (x86_buffer, x86_ip, xmm, instr->xmm);
+            break;
+        }
+
+        case load_const:
+            Fill_Reg_Stack (stack, x86_buffer, x86_ip, 1);
+            Translate_Movaps (x86_buffer, x86_ip, instr->xmm, --stack->n_cached);
+            break;
+
+        case load_shadow:
+            Translate_Movq_To_Xmm (x86_buffer, x86_ip, instr->xmm, x86_Reg_Codes[instr->reg]);
+            break;
+
+        case pop_shadow:
+        case pop_shadow_reg:
+            Fill_Reg_Stack (stack, x86_buffer, x86_ip, 1);
+            Translate_Movaps (x86_buffer, x86_ip, instr->xmm, --stack->n_cached);
+
+            if (instr->type == pop_shadow_reg)
+                Translate_Movq_From_Xmm (x86_buffer, x86_ip, x86_Reg_Codes[instr->reg], stack->n_cached);
+            break;
+
+        case nop:
+            break;
+
+        default:
+            MY_ASSERT (false, "instr->type", UNEXP_VAL, ERROR);
+            break;
+    }
+
+    return NO_ERRORS;
+}
+
+static inline int Lower_Instr (const struct IR_Instr *const instr, char *const x86_buffer, int *const x86_ip,
+                               struct Labels *const labels, struct Reg_Stack *const stack,
+                               struct Relocs *const relocs, const unsigned x86_ext,
+                               const struct Bin_Tr_Options *const options)
+{
+    if (options->reg_stack)
+        return Lower_Instr_Reg (instr, x86_buffer, x86_ip, labels, stack, relocs, x86_ext);
+    else
+        return Lower_Instr_Stack (instr, x86_buffer, x86_ip, labels, relocs, x86_ext);
+}
+
+#define MAX_STEP_SIZE     256   // x86 code of one instruction or one peephole rule with register stack flushes
+#define MAX_STEP_RELOCS   2     // calls to In and Out of one step (out, in)
+#define MAX_STEP_BRANCHES 2     // jp and jne
+
+static int Add_Line (struct Lines *const lines, const int ip, const int x86_ip)
+{
+    if (lines->n_lines == lines->capacity)
+    {
+        const int capacity = (lines->capacity) ? 2 * lines->capacity : 256;
+
+        struct Line *table = (struct Line *)realloc (lines->table, capacity * sizeof (struct Line));
+        if (table == NULL)
+            return ERROR;
+
+        lines->table    = table;
+        lines->capacity = capacity;
+    }
+
+    lines->table[lines->n_lines++] = (struct Line){ip, x86_ip};
+
+    return NO_ERRORS;
+}
+
+// The block is emitted at *x86_ip into the growing bin_tr->x86_buff, the register stack of the block
+// emitted before it is flushed first
+static int Lower_Block (struct Bin_Tr *const bin_tr, const struct IR *const ir, const int block_i,
+                        struct Labels *const labels, struct Reg_Stack *const stack, int *const x86_ip,
+                        const struct Bin_Tr_Options *const options)
+{
+    const struct IR_Block *block = ir->blocks + block_i;
+
+    if (Grow_x86_Buffer (bin_tr, *x86_ip + MAX_STEP_SIZE) == ERROR)
+        return ERROR;
+
+    if (options->reg_stack)
+        Flush_Reg_Stack (stack, bin_tr->x86_buff, x86_ip);     // blocks meet on the memory stack
+
+    Bind_Label (bin_tr->x86_buff, *x86_ip, labels, block_i);
+
+    struct Profile *const profile = bin_tr->profile;
+
+    if (profile)
+        Translate_Count (bin_tr->x86_buff, x86_ip, profile->counts + block_i);
+
+    const unsigned x86_ext = bin_tr->x86_ext;
+
+    for (int instr_i = block->first; instr_i < block->first + block->n_instrs; )
+    {
+        if (Grow_x86_Buffer (bin_tr, *x86_ip + MAX_STEP_SIZE) == ERROR ||
+            Reserve_Relocs (&bin_tr->relocs, MAX_STEP_RELOCS) == ERROR ||
+            Reserve_Branches (labels, MAX_STEP_BRANCHES) == ERROR)
+            return ERROR;
+
+        const struct Peephole_Rule *rule = (options->peephole) ? Match_Peephole (ir, block, instr_i, x86_ext) : NULL;
+
+        if ((options->perf_map || options->jitdump) && ir->instrs[instr_i].type != nop &&
+            Add_Line (&bin_tr->lines, ir->instrs[instr_i].ip, *x86_ip) == ERROR)
+            return ERROR;
+
+        if (rule == NULL)
+        {
+            if (Lower_Instr (ir->instrs + instr_i, bin_tr->x86_buff, x86_ip, labels, stack, &bin_tr->relocs, x86_ext,
+                             options) == ERROR)
+                return ERROR;
+
+            instr_i++;
+
+            continue;
+        }
+
+        // the code these instructions would get without the rewrite
+        struct Reg_Stack plain_stack = *stack;
+        int plain_x86_ip = *x86_ip;
+
+        for (int match_i = 0; match_i < PATTERN_LEN; match_i++)
+            Lower_Instr (ir->instrs + instr_i + match_i, NULL, &plain_x86_ip, labels, &plain_stack, NULL, x86_ext,
+                         options);
+
+        bin_tr->n_peephole_bytes += plain_x86_ip - *x86_ip;
+
+        const int rule_x86_ip = *x86_ip;
+
+        if (options->reg_stack && rule->on_memory_stack)
+            Flush_Reg_Stack (stack, bin_tr->x86_buff, x86_ip);
+
+        rule->rewrite (ir->instrs + instr_i, bin_tr->x86_buff, x86_ip, (options->reg_stack) ? stack : NULL,
+                       &bin_tr->relocs);
+        instr_i += PATTERN_LEN;
+
+        bin_tr->n_peephole_bytes -= *x86_ip - rule_x86_ip;
+    }
+
+    // the conditional jump at the end isn't taken
+    if (profile && profile->jcc_ip[block_i] >= 0)
+    {
+        if (Grow_x86_Buffer (bin_tr, *x86_ip + MAX_STEP_SIZE) == ERROR)
+            return ERROR;
+
+        Translate_Count (bin_tr->x86_buff, x86_ip, profile->counts + profile->n_blocks + block_i);
+    }
+
+    return NO_ERRORS;
+}
+
+// a block that falls through to a block emitted elsewhere ends with a jmp to it
+static int Put_Fall_Through (struct Bin_Tr *const bin_tr, const int block_i, struct Labels *const labels,
+                             struct Reg_Stack *const stack, int *const x86_ip, const struct Bin_Tr_Options *const options)
+{
+    if (Grow_x86_Buffer (bin_tr, *x86_ip + MAX_STEP_SIZE) == ERROR || Reserve_Branches (labels, 1) == ERROR)
+        return ERROR;
+
+    if (options->reg_stack)
+        Flush_Reg_Stack (stack, bin_tr->x86_buff, x86_ip);
+
+    const struct IR_Instr jump = {.type = jmp, .jump = {.block = block_i}};
+
+    Translate_Jmp (bin_tr->x86_buff, x86_ip);
+
+    return Put_Branch (bin_tr->x86_buff, *x86_ip, labels, &jump);
+}
+
+// One pass over the IR: blocks are emitted in bytecode order or in the order of the layout (NULL - bytecode
+// order), branches to blocks that aren't emitted yet are backpatched when the blocks are reached
+static int Lower_IR (struct Bin_Tr *const bin_tr, const struct IR *const ir, const int *const order,
+                     struct Labels *const labels, const struct Bin_Tr_Options *const options)
+{
+    MY_ASSERT (bin_tr,  "struct Bin_Tr *const bin_tr",            NULL_PTR, ERROR);
+    MY_ASSERT (ir,      "const struct IR *const ir",              NULL_PTR, ERROR);
+    MY_ASSERT (labels,  "struct Labels *const labels",            NULL_PTR, ERROR);
+    MY_ASSERT (options, "const struct Bin_Tr_Options *const options", NULL_PTR, ERROR);
+
+    struct Reg_Stack stack = {};
+
+    int x86_ip = 0;
+
+    bin_tr->relocs.n_relocs  = 0;
+    bin_tr->lines.n_lines    = 0;
+    bin_tr->n_peephole_bytes = 0;
+
+    for (int order_i = 0; order_i < ir->n_blocks; order_i++)
+    {
+        const int block_i = (order) ? order[order_i] : order_i;
+        const int prev_i  = (order_i > 0) ? ((order) ? order[order_i - 1] : order_i - 1) : -1;
+
+        if (prev_i >= 0 && ir->blocks[prev_i].fall_through >= 0 && ir->blocks[prev_i].fall_through != block_i &&
+            Put_Fall_Through (bin_tr, ir->blocks[prev_i].fall_through, labels, &stack, &x86_ip, options) == ERROR)
+            return ERROR;
+
+        if (Lower_Block (bin_tr, ir, block_i, labels, &stack, &x86_ip, options) == ERROR)
+            return ERROR;
+    }
+
+    // the last block of the layout may fall through to an earlier one
+    const int last_i = (order && ir->n_blocks > 0) ? order[ir->n_blocks - 1] : -1;
+
+    if (last_i >= 0 && ir->blocks[last_i].fall_through >= 0 &&
+        Put_Fall_Through (bin_tr, ir->blocks[last_i].fall_through, labels, &stack, &x86_ip, options) == ERROR)
+        return ERROR;
+
+    bin_tr->x86_max_ip = x86_ip;
+
+    // room for the entry stub
+    return Grow_x86_Buffer (bin_tr, x86_Buffer_Size (bin_tr));
+}
+
+#undef PATTERN_LEN
+#undef N_XMM_SLOTS
+
+//=====================================================================================//
+
+//=====================================================================================//
+//                                  BRANCH RELAXATION                                  //
+//=====================================================================================//
+
+// Branches start optimistically short and only become long again, so the iterations stop.
+
+// offsets of blocks if the branches chosen short are shortened; blocks go in the order they are emitted in
+static void Layout_Blocks (const struct Labels *const labels, const int *const order, const int n_blocks,
+                           int *const new_block_x86)
+{
+    int saved = 0;
+
+    for (int order_i = 0, branch_i = 0; order_i < n_blocks; order_i++)
+    {
+        const int block_i = (order) ? order[order_i] : order_i;
+
+        for ( ; branch_i < labels->n_branches && labels->branches[branch_i].x86_ip < labels->block_x86[block_i];
+              branch_i++)
+            saved += Rel32_Branch_Size (labels->branches + branch_i) - Branch_Size (labels->branches + branch_i);
+
+        new_block_x86[block_i] = labels->block_x86[block_i] - saved;
+    }
+}
+
+static inline bool Fits_In_Rel8 (const int disp)
+{
+    return INT8_MIN <= disp && disp <= INT8_MAX;
+}
+
+// returns true if some short branch doesn't reach its destination and becomes long
+static bool Lengthen_Branches (struct Labels *const labels, const int *const new_block_x86)
+{
+    bool changed = false;
+    int  saved   = 0;
+
+    for (int branch_i = 0; branch_i < labels->n_branches; branch_i++)
+    {
+        struct Branch *branch = labels->branches + branch_i;
+        const int size = Branch_Size (branch);
+
+        if (branch->is_short && !Fits_In_Rel8 (new_block_x86[branch->block] - (branch->x86_ip - saved + size)))
+        {
+            branch->is_short = false;
+            changed = true;
+        }
+
+        saved += Rel32_Branch_Size (branch) - size;
+    }
+
+    return changed;
+}
+
+// moves the code together, rewrites branches and moves relocations and lines
+static void Compact_Code (struct Bin_Tr *const bin_tr, struct Labels *const labels, const int *const new_block_x86)
+{
+    char *const code = bin_tr->x86_buff;
+
+    int src = 0;
+    int dst = 0;
+
+    int reloc_i = 0;
+    int line_i  = 0;
+
+    for (int branch_i = 0; branch_i < labels->n_branches; branch_i++)
+    {
+        const struct Branch *branch = labels->branches + branch_i;
+
+        // a jmp starts at the branch, a jcc before it
+        for ( ; line_i < bin_tr->lines.n_lines && bin_tr->lines.table[line_i].x86_ip <= branch->x86_ip; line_i++)
+            bin_tr->lines.table[line_i].x86_ip -= src - dst;
+
+        for ( ; reloc_i < bin_tr->relocs.n_relocs && (int)bin_tr->relocs.table[reloc_i].x86_ip < branch->x86_ip;
+              reloc_i++)
+            bin_tr->relocs.table[reloc_i].x86_ip -= src - dst;
+
+        memmove (code + dst, code + src, branch->x86_ip - src);
+        dst += branch->x86_ip - src;
+
+        const int rel32_size = Rel32_Branch_Size (branch);
+
+        if (branch->is_short)
+        {
+            if (branch->type == je)
+            {
+                code[dst++] = 0x7A;     // jp over je rel8
+                code[dst++] = 2;
+            }
+
+            // 0F 8x -> 7x, E9 -> EB
+            code[dst] = (branch->type == jmp) ? 0xEB : 0x70 | (code[branch->x86_ip + rel32_size - 5] & 0x0F);
+            code[dst + 1] = new_block_x86[branch->block] - (dst + 2);
+            dst += 2;
+        }
+        else
+        {
+            memmove (code + dst, code + branch->x86_ip, rel32_size - sizeof (int));
+            dst += rel32_size;
+            Put_Rel32 (code, dst, new_block_x86[branch->block]);
+        }
+
+        src = branch->x86_ip + rel32_size;
+    }
+
+    for ( ; reloc_i < bin_tr->relocs.n_relocs; reloc_i++)
+        bin_tr->relocs.table[reloc_i].x86_ip -= src - dst;
+
+    for ( ; line_i < bin_tr->lines.n_lines; line_i++)
+        bin_tr->lines.table[line_i].x86_ip -= src - dst;
+
+    memmove (code + dst, code + src, bin_tr->x86_max_ip - src);
+
+    bin_tr->n_relaxed_bytes = src - dst;
+    bin_tr->x86_max_ip     -= src - dst;
+
+    // calls to In and Out moved
+    Apply_Relocs (code, bin_tr->relocs.table, bin_tr->relocs.n_relocs);
+}
+
+static int Relax_Branches (struct Bin_Tr *const bin_tr, struct Labels *const labels, const int *const order,
+                           const int n_blocks)
+{
+    MY_ASSERT (bin_tr, "struct Bin_Tr *const bin_tr", NULL_PTR, ERROR);
+    MY_ASSERT (labels, "struct Labels *const labels", NULL_PTR, ERROR);
+
+    int *new_block_x86 = (int *)calloc (n_blocks + 1, sizeof (int));
+    if (new_block_x86 == NULL)
+        return ERROR;
+
+    for (int branch_i = 0; branch_i < labels->n_branches; branch_i++)
+        labels->branches[branch_i].is_short = (labels->branches[branch_i].type != call);   // no rel8 call
+
+    do
+        Layout_Blocks (labels, order, n_blocks, new_block_x86);
+    while (Lengthen_Branches (labels, new_block_x86));
+
+    Compact_Code (bin_tr, labels, new_block_x86);
+    memcpy (labels->block_x86, new_block_x86, n_blocks * sizeof (int));
+
+    free (new_block_x86);
+
+    return NO_ERRORS;
+}
+
+//=====================================================================================//
+
+//=====================================================================================//
+//                                   PERF SYMBOLS                                      //
+//=====================================================================================//
+
+#define NAME_SIZE 256
+
+// call targets from the jumps, the program itself is block 0
+static bool *Find_Procedures (const struct IR *const ir)
+{
+    bool *is_proc = (bool *)calloc (ir->n_blocks + 1, sizeof (bool));
+    if (is_proc == NULL)
+        return NULL;
+
+    for (int jump_i = 0; jump_i < ir->n_jumps; jump_i++)
+    {
+        const struct IR_Instr *const instr = ir->instrs + ir->jumps[jump_i].from;
+
+        if (instr->type == call)
+            is_proc[instr->jump.block] = true;
+    }
+
+    return is_proc;
+}
+
+static inline int Block_Ip (const struct IR *const ir, const int block_i)
+{
+    const int first = ir->blocks[block_i].first;
+
+    return (first < ir->n_instrs) ? ir->instrs[first].ip : ir->instrs[ir->n_instrs - 1].ip + 1;
+}
+
+// Describes blocks that are emitted one after another (NULL - all blocks of the IR) and end at end_x86.
+// A symbol starts at the first of them, at the program and at every procedure, and the lines recorded since
+// the last description go to the symbols they fall into.
+static void Describe_Code (struct Bin_Tr *const bin_tr, const struct IR *const ir, const struct Labels *const labels,
+                           const bool *const is_proc, const int *const blocks, const int n_blocks, const long end_x86,
+                           const struct Bin_Tr_Options *const options)
+{
+    const char *const file = (options->perf_name) ? options->perf_name : "bytecode";
+    const struct Lines *const lines = &bin_tr->lines;
+
+    int line_i    = bin_tr->n_described_lines;
+    int sym_block = -1;
+
+    for (int order_i = 0; order_i <= n_blocks; order_i++)
+    {
+        const int block_i = (order_i == n_blocks) ? -1 : (blocks) ? blocks[order_i] : order_i;
+
+        if (block_i >= 0 && sym_block >= 0 && block_i != 0 && !is_proc[block_i])
+            continue;
+
+        if (sym_block >= 0)
+        {
+            const long start = labels->block_x86[sym_block];
+            const long end   = (block_i >= 0) ? labels->block_x86[block_i] : end_x86;
+
+            const int first_line = line_i;
+            while (line_i < lines->n_lines && lines->table[line_i].x86_ip < end)
+                line_i++;
+
+            char name[NAME_SIZE] = "";
+
+            if (sym_block == 0)
+                snprintf (name, sizeof name, "%s:main", file);
+            else
+                snprintf (name, sizeof name, (is_proc[sym_block]) ? "%s:proc_%d" : "%s:ip_%d", file,
+                          Block_Ip (ir, sym_block));
+
+            const struct Perf_Symbol symbol = {bin_tr->x86_buff, start, end - start, name, file,
+                                               lines->table + first_line, line_i - first_line};
+
+            Perf_Describe (&symbol, options->perf_map, options->jitdump);
+        }
+
+        sym_block = block_i;
+    }
+
+    bin_tr->n_described_lines = lines->n_lines;
+}
+
+#undef NAME_SIZE
+
+//=====================================================================================//
+
+// the order of blocks by a profile of an earlier run, NULL on failure
+static int *Read_Layout (struct IR *const ir, const char *const profile_file)
+{
+    struct Profile *profile = Profile_New (ir);
+    int *order = (int *)calloc (ir->n_blocks + 1, sizeof (int));
+
+    if (profile == NULL || order == NULL || Profile_Read (profile, profile_file) == ERROR ||
+        Order_Blocks (ir, profile, order) == ERROR)
+    {
+        free (order);
+        order = NULL;
+    }
+
+    Profile_Free (profile);
+
+    return order;
+}
+
+static int Translate (struct Bin_Tr *const bin_tr, const struct Bin_Tr_Options *const options)
+{
+    MY_ASSERT (bin_tr,             "struct Bin_Tr *const bin_tr",            NULL_PTR, ERROR);
+    MY_ASSERT (bin_tr->input_buff, "const char *const input",                NULL_PTR, ERROR);
+    MY_ASSERT (options,            "const struct Bin_Tr_Options *const options", NULL_PTR, ERROR);
+
+    struct IR ir = {};
+
+    // invalid bytecode is an error of the caller, not of the translator, so it's checked in release builds too
+    if (Build_IR (bin_tr->input_buff, bin_tr->max_ip, &ir) == ERROR || ir.n_blocks == 0)
+    {
+        Free_IR (&ir);
+        return ERROR;
+    }
+
+    // the passes fail only if memory runs out
+    if ((options->inline_budget > 0 && Inline_Procedures (&ir, options->inline_budget) == ERROR) ||
+        (options->const_fold && Fold_Constants (&ir) == ERROR) ||
+        (options->licm && options->reg_stack && Hoist_Loop_Invariants (&ir) == ERROR))    // loop forms need registers
+    {
+        Free_IR (&ir);
+        return ERROR;
+    }
+
+    if (options->instrument && (bin_tr->profile = Profile_New (&ir)) == NULL)
+    {
+        Free_IR (&ir);
+        return ERROR;
+    }
+
+    // counters of instrumented code count the jumps of bytecode order
+    int *order = NULL;
+
+    if (options->layout_profile && !options->instrument && (order = Read_Layout (&ir, options->layout_profile)) == NULL)
+    {
+        Free_IR (&ir);
+        return ERROR;
+    }
+
+    struct Labels labels =
+    {
+        .block_x86 = (int *)calloc (ir.n_blocks + 1, sizeof (int)),
+        .chain     = (int *)calloc (ir.n_blocks + 1, sizeof (int))
+    };
+
+    // Lower_IR () needs at most MAX_STEP_SIZE bytes per block, per instruction and per jmp or counter after a block
+    const long max_x86_size = (2L * ir.n_blocks + ir.n_instrs + 1) * MAX_STEP_SIZE + sizeof Entry_Stub;
+
+    int status = ERROR;
+
+    if (labels.block_x86 && labels.chain && (bin_tr->x86_buff = Alloc_x86_Buffer (bin_tr, max_x86_size)))
+    {
+        for (int block_i = 0; block_i < ir.n_blocks; block_i++)
+        {
+            labels.block_x86[block_i] = -1;
+            labels.chain[block_i]     = -1;
+        }
+
+        // Bin_Tr_Free () frees the buffer if anything fails
+        status = Lower_IR (bin_tr, &ir, order, &labels, options);
+
+        if (status != ERROR && options->short_branches)
+            status = Relax_Branches (bin_tr, &labels, order, ir.n_blocks);
+    }
+
+    if (status != ERROR && (options->perf_map || options->jitdump))
+    {
+        bool *is_proc = Find_Procedures (&ir);
+
+        if (is_proc)
+            Describe_Code (bin_tr, &ir, &labels, is_proc, order, ir.n_blocks, bin_tr->x86_max_ip, options);
+
+        free (is_proc);
+    }
+
+    free (order);
+    free (labels.branches);
+    free (labels.chain);
+    free (labels.block_x86);
+    Free_IR (&ir);
+
+    return status;
+}
+
+//=====================================================================================//
+//                                  LAZY COMPILATION                                   //
+//=====================================================================================//
+
+// The region of lazily compiled code:
+//
+//     [slot table][entry stub, resolver][procedure][procedure]...
+//
+// Every call target has a slot, calls to procedures that aren't compiled yet are call [rip + slot].
+// A slot holds the resolver until the first call compiles the procedure with every block reachable from it
+// (but not through calls) into pages after the sealed code; then the slot holds the procedure and calls
+// emitted afterwards are direct. The slot table stays writable, the code is never writable again once sealed.
+struct Lazy
+{
+    pthread_mutex_t lock;       // instances in different threads may call the same procedure
+
+    struct IR ir;
+    struct Labels labels;       // block_x86 >= 0 for compiled blocks
+    struct Bin_Tr_Options options;
+
+    int *slot_block;            // call target of every slot
+    int  n_slots;
+    int  resolver_x86;
+
+    int  *unit;                 // blocks of the procedure being compiled
+    bool *in_unit;
+
+    bool tiered;                // the program starts in the interpreter, hot blocks are compiled
+    struct Threaded_Code threaded;
+
+    bool *is_proc;              // perf symbols start at procedures
+};
+
+static const char *Lazy_Compile (_Atomic (const char *) *const slot);
+
+// The return address follows call [rip + disp32]: the slot is at it plus disp32. VM registers and
+// the return address stay where they are, and the procedure is entered as if it was called directly.
+// If it can't be compiled, the run stops like at hlt.
+static const char Resolver[] =
+{
+    0x50, 0x53, 0x51, 0x52,         // push   rax, rbx, rcx, rdx
+    0x55,                           // push   rbp
+    0x48, 0x89, 0xE5,               // mov    rbp, rsp
+    0x48, 0x83, 0xE4, 0xF0,         // and    rsp, -16
+
+    0x48, 0x8B, 0x7D, 0x28,         // mov    rdi, qword [rbp + 40]
+    0x48, 0x63, 0x47, 0xFC,         // movsxd rax, dword [rdi - 4]
+    0x48, 0x01, 0xC7,               // add    rdi, rax
+
+    0x48, 0xB8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,   // mov rax, Lazy_Compile
+    0xFF, 0xD0,                     // call   rax
+    0x48, 0x89, 0xC7,               // mov    rdi, rax
+
+    0x48, 0x89, 0xEC,               // mov    rsp, rbp
+    0x5D,                           // pop    rbp
+    0x5A, 0x59, 0x5B, 0x58,         // pop    rdx, rcx, rbx, rax
+
+    0x48, 0x85, 0xFF,               // test   rdi, rdi
+    0x74, 0x02,                     // jz     failed
+    0xFF, 0xE7,                     // jmp    rdi
+                                    // failed:
+    0x4C, 0x89, 0xF4,               // mov    rsp, r14
+    0xC3                            // ret
+};
+
+#define RESOLVER_FUNC_OFFSET 25
+
+static inline _Atomic (const char *) *Lazy_Slots (const struct Bin_Tr *const bin_tr)
+{
+    return (_Atomic (const char *) *)(bin_tr->x86_buff + bin_tr->lazy->labels.slots_x86);
+}
+
+static int Compare_Blocks (const void *const first, const void *const second)
+{
+    return *(const int *)first - *(const int *)second;
+}
+
+static inline bool Ends_With_Call (const struct IR *const ir, const struct IR_Block *const block)
+{
+    return block->n_instrs > 0 && ir->instrs[block->first + block->n_instrs - 1].type == call;
+}
+
+// blocks that aren't compiled yet and are reachable from the entry without calls, in bytecode order
+static int Collect_Unit (struct Lazy *const lazy, const int entry)
+{
+    const struct IR *const ir = &lazy->ir;
+
+    int n_unit = 0;
+
+    lazy->unit[n_unit++]  = entry;
+    lazy->in_unit[entry] = true;
+
+    for (int unit_i = 0; unit_i < n_unit; unit_i++)
+    {
+        const struct IR_Block *const block = ir->blocks + lazy->unit[unit_i];
+
+        // a called procedure is a unit of its own
+        const int next[] = {block->fall_through, (Ends_With_Call (ir, block)) ? -1 : block->branch};
+
+        for (int next_i = 0; next_i < (int)(sizeof next / sizeof next[0]); next_i++)
+        {
+            const int block_i = next[next_i];
+
+            if (block_i < 0 || lazy->in_unit[block_i] || lazy->labels.block_x86[block_i] >= 0)
+                continue;
+
+            lazy->unit[n_unit++]    = block_i;
+            lazy->in_unit[block_i] = true;
+        }
+    }
+
+    qsort (lazy->unit, n_unit, sizeof (int), Compare_Blocks);
+
+    return n_unit;
+}
+
+// Emits the procedure that starts at the entry block on new pages and seals them, the slots of call targets
+// among its blocks get their code. Returns the x86 offset of the procedure or -1.
+static int Compile_Unit (struct Bin_Tr *const bin_tr, const int entry)
+{
+    struct Lazy *const lazy = bin_tr->lazy;
+    const struct IR *const ir = &lazy->ir;
+
+    const int n_unit = Collect_Unit (lazy, entry);
+
+    struct Reg_Stack stack = {};
+
+    const int unit_x86 = bin_tr->x86_sealed;
+    int x86_ip = unit_x86;
+    int ret_val = NO_ERRORS;
+
+    for (int unit_i = 0; unit_i <= n_unit && ret_val != ERROR; unit_i++)
+    {
+        const int block_i = (unit_i < n_unit) ? lazy->unit[unit_i] : -1;
+        const int prev_i  = (unit_i > 0) ? lazy->unit[unit_i - 1] : -1;
+
+        if (prev_i >= 0 && ir->blocks[prev_i].fall_through >= 0 && ir->blocks[prev_i].fall_through != block_i)
+            ret_val = Put_Fall_Through (bin_tr, ir->blocks[prev_i].fall_through, &lazy->labels, &stack, &x86_ip,
+                                        &lazy->options);
+
+        if (block_i >= 0 && ret_val != ERROR)
+            ret_val = Lower_Block (bin_tr, ir, block_i, &lazy->labels, &stack, &x86_ip, &lazy->options);
+    }
+
+    for (int unit_i = 0; unit_i < n_unit; unit_i++)
+        lazy->in_unit[lazy->unit[unit_i]] = false;
+
+    if (ret_val == ERROR)
+        return -1;
+
+    const long sealed = Arena_Round_Up (x86_ip);
+
+    if (Arena_Seal (bin_tr->x86_buff + unit_x86, sealed - unit_x86) == ERROR)
+        return -1;
+
+    bin_tr->x86_max_ip   = x86_ip;
+    bin_tr->x86_sealed   = sealed;
+    bin_tr->x86_capacity = sealed;
+
+    if (lazy->is_proc)
+        Describe_Code (bin_tr, ir, &lazy->labels, lazy->is_proc, lazy->unit, n_unit, x86_ip, &lazy->options);
+
+    _Atomic (const char *) *const slots = Lazy_Slots (bin_tr);
+
+    for (int unit_i = 0; unit_i < n_unit; unit_i++)
+    {
+        const int block_i = lazy->unit[unit_i];
+
+        const char *const block_code = bin_tr->x86_buff + lazy->labels.block_x86[block_i];
+
+        if (lazy->labels.slot[block_i] >= 0)
+            atomic_store_explicit (slots + lazy->labels.slot[block_i], block_code, memory_order_release);
+
+        if (lazy->tiered)
+            atomic_store_explicit (lazy->threaded.native + block_i, block_code, memory_order_release);
+    }
+
+    return lazy->labels.block_x86[entry];
+}
+
+// Called by the resolver in the thread of the running instance; NULL stops the run, and Bin_Tr_Run () reports it
+static const char *Lazy_Compile (_Atomic (const char *) *const slot)
+{
+    // the code handle is shared, but lazy state is changed only under the lock
+    struct Bin_Tr *const bin_tr = (struct Bin_Tr *)Host_Instance->code;
+    struct Lazy *const lazy = bin_tr->lazy;
+
+    pthread_mutex_lock (&lazy->lock);
+
+    const char *target = atomic_load_explicit (slot, memory_order_acquire);
+
+    // another thread may have compiled it meanwhile
+    if (target == bin_tr->x86_buff + lazy->resolver_x86)
+    {
+        const int block_i = lazy->slot_block[slot - Lazy_Slots (bin_tr)];
+
+        const int x86_offset = (lazy->labels.block_x86[block_i] >= 0) ? lazy->labels.block_x86[block_i] :
+                                                                         Compile_Unit (bin_tr, block_i);
+        if (x86_offset < 0)
+        {
+            pthread_mutex_unlock (&lazy->lock);
+
+            Host_Instance->failed = true;
+            return NULL;
+        }
+
+        target = bin_tr->x86_buff + x86_offset;
+        atomic_store_explicit (slot, target, memory_order_release);
+    }
+
+    pthread_mutex_unlock (&lazy->lock);
+
+    return target;
+}
+
+static void Free_Lazy (struct Lazy *const lazy)
+{
+    if (lazy == NULL)
+        return;
+
+    pthread_mutex_destroy (&lazy->lock);
+
+    Free_IR (&lazy->ir);
+    Free_Threaded_Code (&lazy->threaded);
+
+    free (lazy->labels.block_x86);
+    free (lazy->labels.chain);
+    free (lazy->labels.branches);
+    free (lazy->labels.slot);
+
+    free (lazy->slot_block);
+    free (lazy->unit);
+    free (lazy->in_unit);
+    free (lazy->is_proc);
+    free (lazy);
+}
+
+// the entry stub, the resolver and the procedure of ip 0; everything else waits for the first call
+static int Translate_Lazy (struct Bin_Tr *const bin_tr, const struct Bin_Tr_Options *const options)
+{
+    MY_ASSERT (bin_tr,             "struct Bin_Tr *const bin_tr",            NULL_PTR, ERROR);
+    MY_ASSERT (bin_tr->input_buff, "const char *const input",                NULL_PTR, ERROR);
+    MY_ASSERT (options,            "const struct Bin_Tr_Options *const options", NULL_PTR, ERROR);
+
+    struct Lazy *lazy = (struct Lazy *)calloc (1, sizeof (struct Lazy));
+    if (lazy == NULL)
+        return ERROR;
+
+    pthread_mutex_init (&lazy->lock, NULL);
+    lazy->options = *options;
+    lazy->tiered  = options->tiered && !options->instrument;     // counters are in the native code only
+    bin_tr->lazy  = lazy;
+
+    struct IR *const ir = &lazy->ir;
+
+    if (Build_IR (bin_tr->input_buff, bin_tr->max_ip, ir) == ERROR || ir->n_blocks == 0)
+        return ERROR;
+
+    if (options->inline_budget > 0 && Inline_Procedures (ir, options->inline_budget) == ERROR)
+        return ERROR;
+
+    if (options->const_fold && Fold_Constants (ir) == ERROR)
+        return ERROR;
+
+    if (lazy->tiered && Thread_IR (ir, options->tier_threshold, &lazy->threaded) == ERROR)
+        return ERROR;
+
+    if ((options->perf_map || options->jitdump) && (lazy->is_proc = Find_Procedures (ir)) == NULL)
+        return ERROR;
+
+    if (options->instrument && (bin_tr->profile = Profile_New (ir)) == NULL)
+        return ERROR;
+
+    lazy->labels.block_x86 = (int *)calloc (ir->n_blocks + 1, sizeof (int));
+    lazy->labels.chain     = (int *)calloc (ir->n_blocks + 1, sizeof (int));
+    lazy->labels.slot      = (int *)calloc (ir->n_blocks + 1, sizeof (int));
+    lazy->slot_block       = (int *)calloc (ir->n_blocks + 1, sizeof (int));
+    lazy->unit             = (int *)calloc (ir->n_blocks + 1, sizeof (int));
+    lazy->in_unit          = (bool *)calloc (ir->n_blocks + 1, sizeof (bool));
+    // Free_Lazy () frees whatever is allocated if anything fails
+    if (!lazy->labels.block_x86 || !lazy->labels.chain || !lazy->labels.slot || !lazy->slot_block || !lazy->unit ||
+        !lazy->in_unit)
+        return ERROR;
+
+    for (int block_i = 0; block_i < ir->n_blocks; block_i++)
+    {
+        lazy->labels.block_x86[block_i] = -1;
+        lazy->labels.chain[block_i]     = -1;
+        lazy->labels.slot[block_i]      = -1;
+    }
+
+    for (int instr_i = 0; instr_i < ir->n_instrs; instr_i++)
+    {
+        const int block_i = ir->instrs[instr_i].jump.block;
 
-        case RAM_NUM:
+        if (ir->instrs[instr_i].type == call && lazy->labels.slot[block_i] < 0)
         {
-            const int num = *(int *)(proc_buff + *ip + 1 + 3);
-            
-            if (instr_name == PUSH)
-                Translate_Push_RAM_Num (x86_buffer, x86_ip, num);
-            else
-                Translate_Pop_RAM_Num  (x86_buffer, x86_ip, num);
+            lazy->labels.slot[block_i]       = lazy->n_slots;
+            lazy->slot_block[lazy->n_slots++] = block_i;
+        }
+    }
 
-            *ip += ISA_Consts[push_ram_num].proc_sz;
+    const long slots_size = Arena_Round_Up (lazy->n_slots * sizeof (char *));
+    const long stubs_size = Arena_Round_Up (sizeof Entry_Stub + sizeof Resolver);
 
-            break;
-        }
+    // as in Translate () and a jmp after every block, each procedure starts on a new page
+    const long max_x86_size = slots_size + stubs_size + (3L * ir->n_blocks + ir->n_instrs + 1) * MAX_STEP_SIZE +
+                              (lazy->n_slots + 1L) * ARENA_PAGE;
 
-        case AX:
-        case BX:
-        case CX:
-        case DX:
-        {
-            const char reg = proc_buff[*ip + 2];
+    bin_tr->x86_buff = Alloc_x86_Buffer (bin_tr, max_x86_size);
 
-            if (instr_name == PUSH)
-                Translate_Push_Reg (x86_buffer, x86_ip, (int)reg);
-            else
-                Translate_Pop_Reg  (x86_buffer, x86_ip, (int)reg);
-            
-            *ip += ISA_Consts[push_reg].proc_sz;
+    if (bin_tr->x86_buff == NULL || Arena_Write (bin_tr->x86_buff, slots_size + stubs_size) == ERROR)
+        return ERROR;
 
-            break;
-        }
+    lazy->labels.slots_x86 = 0;
+    bin_tr->x86_entry      = slots_size;
+    lazy->resolver_x86     = slots_size + sizeof Entry_Stub;
 
-        case RAM_AX:
-        case RAM_BX:
-        case RAM_CX:
-        case RAM_DX:
-        {
-            const char reg = proc_buff[*ip + 2];
+    memcpy (bin_tr->x86_buff + bin_tr->x86_entry,   Entry_Stub, sizeof Entry_Stub);
+    memcpy (bin_tr->x86_buff + lazy->resolver_x86, Resolver,   sizeof Resolver);
 
-            if (instr_name == PUSH)
-                Translate_Push_RAM_Reg (x86_buffer, x86_ip, (int)reg);
-            else
-                Translate_Pop_RAM_Reg  (x86_buffer, x86_ip, (int)reg);
-            
-            *ip += ISA_Consts[push_ram_reg].proc_sz;
-            
-            break;
-        }
+    *(uint64_t *)(bin_tr->x86_buff + lazy->resolver_x86 + RESOLVER_FUNC_OFFSET) = (uint64_t)Lazy_Compile;
 
-        case RAM_AX_NUM:
-        case RAM_BX_NUM:
-        case RAM_CX_NUM:
-        case RAM_DX_NUM:
-        {
-            const char reg = proc_buff[*ip + 2];
-            const int num  = *(int *)(proc_buff + *ip + 1 + 3);
+    _Atomic (const char *) *const slots = Lazy_Slots (bin_tr);
 
-            if (instr_name == PUSH)
-                Translate_Push_RAM_Reg_Num (x86_buffer, x86_ip, (int)reg, num);
-            else
-                Translate_Pop_RAM_Reg_Num  (x86_buffer, x86_ip, (int)reg, num);
+    for (int slot_i = 0; slot_i < lazy->n_slots; slot_i++)
+        atomic_init (slots + slot_i, bin_tr->x86_buff + lazy->resolver_x86);
 
-            *ip += ISA_Consts[push_ram_reg_num].proc_sz;
+    if (Arena_Seal (bin_tr->x86_buff + slots_size, stubs_size) == ERROR)
+        return ERROR;
 
-            break;
-        }
+    bin_tr->x86_sealed   = slots_size + stubs_size;
+    bin_tr->x86_capacity = bin_tr->x86_sealed;
 
-        default:
-            MY_ASSERT (false, "int checksum", UNEXP_VAL, ERROR);
-            break;
-    }
+    bin_tr->relocs.n_relocs  = 0;
+    bin_tr->n_peephole_bytes = 0;
 
-    return NO_ERRORS;
+    if (lazy->tiered)
+        return NO_ERRORS;
+
+    bin_tr->x86_start = Compile_Unit (bin_tr, 0);
+
+    return (bin_tr->x86_start < 0) ? ERROR : NO_ERRORS;
 }
 
-static int Compare_Jumps (const void *jump_v1, const void *jump_v2)
+// the interpreter found a hot block: it's compiled with everything reachable from it, unless it already is
+static const void *Tier_Compile (void *const context, const int block)
 {
-    const struct Jump *jump_1 = (const struct Jump *)jump_v1;
-    const struct Jump *jump_2 = (const struct Jump *)jump_v2;
-    
-    if (jump_1->to < jump_2->to)
-        return -1;
-    else if (jump_1->to > jump_2->to)
-        return 1;
-    else
-        return 0;
+    struct Bin_Tr *const bin_tr = (struct Bin_Tr *)((struct Bin_Tr_Instance *)context)->code;
+    struct Lazy *const lazy = bin_tr->lazy;
+
+    pthread_mutex_lock (&lazy->lock);
+
+    const int x86_offset = (lazy->labels.block_x86[block] >= 0) ? lazy->labels.block_x86[block] :
+                                                                   Compile_Unit (bin_tr, block);
+    pthread_mutex_unlock (&lazy->lock);
+
+    return (x86_offset < 0) ? NULL : bin_tr->x86_buff + x86_offset;
 }
 
-static void Sort_Jumps (struct Jump *const jumps_arr, const int n_jumps)
+// the entry stub runs a block as if it was the start of the program: the code returns to it at hlt or
+// at the ret of the procedure of the block
+static enum Native_Exit Tier_Run (void *const context, const void *const native, double *const regs)
 {
-    qsort (jumps_arr, n_jumps, sizeof (struct Jump), Compare_Jumps);
+    struct Bin_Tr_Instance *const instance = (struct Bin_Tr_Instance *)context;
+
+    int (* entry)(const void *, char *, double *) =
+        (int (*)(const void *, char *, double *))(instance->code->x86_buff + instance->code->x86_entry);
+
+    const int halted = entry (native, instance->ram.base, regs);
+
+    // a procedure that can't be compiled leaves the code like hlt
+    if (instance->failed)
+        return NATIVE_ERROR;
+
+    return (halted) ? NATIVE_HLT : NATIVE_RET;
 }
 
-static int Fill_Jumps_Args (char *const x86_buff, const int x86_ip, const int ip, struct Jump *const jumps_arr, const int n_jumps, int *jump_i)
+static int Interpret_Tiered (struct Bin_Tr_Instance *const instance)
 {
-    MY_ASSERT (x86_buff,  "char *const x86_buff",                NULL_PTR, ERROR);
-    MY_ASSERT (jumps_arr, "const struct Jumps *const jumps_arr", NULL_PTR, ERROR);
-    
-    while (*jump_i < n_jumps && ip == jumps_arr[*jump_i].to)
+    struct Interp_Run run =
     {
-        int x86_from = jumps_arr[*jump_i].x86_from;
+        .regs   = instance->regs,
+        .ram    = instance->ram.base,
+        .io     = &instance->io,
+        .stacks = &instance->stacks,
+        .tier   = {Tier_Compile, Tier_Run, instance}
+    };
 
-        switch (jumps_arr[*jump_i].type)
-        {
-            case CALL:
-            case JMP:
-                *(int *)(x86_buff + x86_from + 1) = x86_ip - (x86_from + 1 + sizeof (int));
+    Interpret (&instance->code->lazy->threaded, &run);
+
+    return (run.failed) ? ERROR : NO_ERRORS;
+}
 
-                break;
+static int Count_Compiled_Blocks (const struct Lazy *const lazy)
+{
+    int n_compiled = 0;
 
-            case JAE:
-            case JA:
-            case JBE:
-            case JB:
-            case JE:
-            case JNE:
-                *(int *)(x86_buff + x86_from + 2) = x86_ip - (x86_from + 2 + sizeof (int));
+    for (int block_i = 0; block_i < lazy->ir.n_blocks; block_i++)
+        n_compiled += (lazy->labels.block_x86[block_i] >= 0);
 
-                break;
+    return n_compiled;
+}
 
-            default:
-                MY_ASSERT (false, "jumps_arr[jump_i].type", UNEXP_VAL, ERROR);
-                break;
-        }
-        
-        (*jump_i)++;
+// procedures are the call targets and the program itself, if nothing calls it
+static void Count_Procedures (const struct Lazy *const lazy, int *const n_compiled, int *const n_procs)
+{
+    const bool program_is_called = (lazy->labels.slot[0] >= 0);
+
+    *n_procs    = lazy->n_slots + !program_is_called;
+    *n_compiled = !program_is_called;
+
+    for (int slot_i = 0; slot_i < lazy->n_slots; slot_i++)
+        if (lazy->labels.block_x86[lazy->slot_block[slot_i]] >= 0)
+            (*n_compiled)++;
+}
+
+#undef RESOLVER_FUNC_OFFSET
+
+//=====================================================================================//
+
+#undef MAX_STEP_SIZE
+#undef MAX_STEP_RELOCS
+#undef MAX_STEP_BRANCHES
+
+
+//=====================================================================================//
+//                                     CODE TARGET                                     //
+//=====================================================================================//
+
+#define XCR0_SSE_AVX 0x06   // xmm and the upper halves of ymm registers are saved by the OS
+
+static unsigned char CPU_Ext;
+static pthread_once_t CPU_Probe_Once = PTHREAD_ONCE_INIT;
+
+// CPUID is slow in a virtual machine, so the CPU is probed once per process
+static void Probe_CPU (void)
+{
+    unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+    if (__get_cpuid (1, &eax, &ebx, &ecx, &edx) == 0 || !(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+        return;
+
+    unsigned xcr0 = 0, xcr0_high = 0;
+    __asm__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0_high) : "c" (0));
+
+    if ((xcr0 & XCR0_SSE_AVX) != XCR0_SSE_AVX)
+        return;
+
+    CPU_Ext = EXT_AVX | ((ecx & bit_FMA) ? EXT_FMA : 0);
+}
+
+// extensions the code of the target may use on this CPU; FMA changes rounding, so it needs fp_contract
+static unsigned char Code_Extensions (const struct Bin_Tr_Options *const options)
+{
+    static const unsigned char Target_Ext[] =
+    {
+        [TARGET_AUTO]   = EXT_AVX | EXT_FMA,
+        [TARGET_NATIVE] = EXT_AVX | EXT_FMA,
+        [TARGET_SSE2]   = 0,
+        [TARGET_AVX]    = EXT_AVX,
+        [TARGET_FMA]    = EXT_AVX | EXT_FMA
+    };
+
+    pthread_once (&CPU_Probe_Once, Probe_CPU);
+
+    unsigned char x86_ext = Target_Ext[options->target] & CPU_Ext;
+
+    if (!options->fp_contract)
+        x86_ext &= ~EXT_FMA;
+
+    return x86_ext;
+}
+
+#undef XCR0_SSE_AVX
+
+//=====================================================================================//
+
+//=====================================================================================//
+//                                     CODE CACHE                                      //
+//=====================================================================================//
+
+// every option that changes generated code has to be here, the target as the extensions it gets on this CPU
+static uint32_t Options_Mask (const struct Bin_Tr_Options *const options, const unsigned x86_ext)
+{
+    return (options->reg_stack << 0) | (options->peephole << 1) | (options->const_fold << 2) |
+           (options->short_branches << 3) | (options->licm << 4) | (x86_ext << 5) |
+           ((uint32_t)options->inline_budget << 7);
+}
+
+// bin_tr->x86_buff stays NULL if the bytecode is not in the cache
+static int Load_Cached_Code (struct Bin_Tr *const bin_tr, const struct Code_Cache *const cache)
+{
+    MY_ASSERT (bin_tr, "struct Bin_Tr *const bin_tr",          NULL_PTR, ERROR);
+    MY_ASSERT (cache,  "const struct Code_Cache *const cache", NULL_PTR, ERROR);
+
+    struct Cache_Entry entry = {};
+
+    // an entry that can't be read is a miss
+    if (Open_Cache_Entry (cache, bin_tr->input_buff, bin_tr->max_ip, &entry) == ERROR || entry.map == NULL)
+        return NO_ERRORS;
+
+    // the code is copied out of the mapping: rel32 of calls to In and Out reaches only the buffer near the binary
+    bin_tr->x86_max_ip   = entry.x86_size;
+    bin_tr->x86_buff     = Alloc_x86_Buffer (bin_tr, x86_Buffer_Size (bin_tr));
+    bin_tr->relocs.table = (struct Reloc *)calloc (entry.n_relocs + 1, sizeof (struct Reloc));
+
+    // too large for the buffer or no memory: translated and reported as usual
+    if (bin_tr->x86_buff == NULL || bin_tr->relocs.table == NULL ||
+        Grow_x86_Buffer (bin_tr, x86_Buffer_Size (bin_tr)) == ERROR)
+    {
+        Free_x86_Buffer (bin_tr);
+        free (bin_tr->relocs.table);
+        bin_tr->relocs.table = NULL;
+        Close_Cache_Entry (&entry);
+
+        return NO_ERRORS;
     }
 
+    memcpy (bin_tr->x86_buff, entry.x86_code, entry.x86_size);
+    Apply_Relocs (bin_tr->x86_buff, entry.relocs, entry.n_relocs);
+
+    // a static executable points the calls at its own runtime
+    memcpy (bin_tr->relocs.table, entry.relocs, entry.n_relocs * sizeof (struct Reloc));
+    bin_tr->relocs.n_relocs = entry.n_relocs;
+    bin_tr->relocs.capacity = entry.n_relocs + 1;
+
+    Close_Cache_Entry (&entry);
+
     return NO_ERRORS;
 }
 
-static int Second_Passing (struct Bin_Tr *const bin_tr, struct Jump *const jumps_arr, const int n_jumps)
+//=====================================================================================//
+
+//=====================================================================================//
+//                                       LIBRARY                                       //
+//=====================================================================================//
+
+// The entry stub goes after the code. The pages past it go back to the arena, the rest is executable
+// and isn't writable any more.
+static int Make_Executable (struct Bin_Tr *const bin_tr)
 {
-    MY_ASSERT (bin_tr,    "struct Bin_Tr *const bin_tr",         NULL_PTR, ERROR);
-    
-    bin_tr->x86_buff = (char *)aligned_calloc (bin_tr->x86_max_ip, sizeof (char *));
-    MY_ASSERT (bin_tr->x86_buff, "bin_tr->x86_buffer", NE_MEM, ERROR);
+    memcpy (bin_tr->x86_buff + bin_tr->x86_max_ip, Entry_Stub, sizeof Entry_Stub);
+    bin_tr->x86_entry = bin_tr->x86_max_ip;
+
+    const long size = Arena_Round_Up (x86_Buffer_Size (bin_tr));
 
-    const char *proc_buff  = bin_tr->input_buff;
-    char       *x86_buffer = bin_tr->x86_buff;
-    const int  max_ip      = bin_tr->max_ip;
+    Arena_Free (bin_tr->x86_buff + size, bin_tr->x86_reserved - size);
 
-    if (n_jumps > 0)
-        Sort_Jumps (jumps_arr, n_jumps);
+    bin_tr->x86_reserved = size;
+    bin_tr->x86_capacity = 0;
 
-    for (int ip = 0, x86_ip = 0, jump_i = 0; ip < max_ip; )
+    return Arena_Seal (bin_tr->x86_buff, size);
+}
+
+struct Bin_Tr *Bin_Tr_Compile (const char *const bytecode, const long size, const struct Bin_Tr_Options *const options)
+{
+    MY_ASSERT (bytecode, "const char *const bytecode",             NULL_PTR, NULL);
+    MY_ASSERT (options,  "const struct Bin_Tr_Options *const options", NULL_PTR, NULL);
+
+    // a larger budget wouldn't fit in Options_Mask ()
+    if (options->inline_budget < 0 || options->inline_budget > BIN_TR_MAX_INLINE_BUDGET)
+        return NULL;
+
+    struct Bin_Tr *bin_tr = (struct Bin_Tr *)calloc (1, sizeof (struct Bin_Tr));
+    if (bin_tr == NULL)
+        return NULL;
+
+    bin_tr->input_buff = bytecode;
+    bin_tr->max_ip     = size;
+    bin_tr->huge_pages = options->huge_pages;
+    bin_tr->x86_ext    = Code_Extensions (options);
+
+    // lazy code is never complete, so it isn't cached
+    if (options->lazy || options->tiered)
     {
-        if (n_jumps > 0)
-            Fill_Jumps_Args (x86_buffer, x86_ip, ip, jumps_arr, n_jumps, &jump_i);
+        const int T_status = Translate_Lazy (bin_tr, options);
+        bin_tr->input_buff = NULL;
 
-        switch (proc_buff[ip])
+        if (T_status == ERROR)
         {
-            case HLT:
-                Translate_Ret (x86_buffer, &x86_ip);
-
-                ip  += ISA_Consts[hlt].proc_sz;
-                break;
-            
-            case CALL:
-                Translate_Call (x86_buffer, &x86_ip);
-
-                ip  += ISA_Consts[call].proc_sz;
-                break;
-
-            case JMP:
-                Translate_Jmp (x86_buffer, &x86_ip);
-
-                ip  += ISA_Consts[jmp].proc_sz;
-                break;
-            
-            case JAE:
-            case JA:
-            case JBE:
-            case JB:
-            case JNE:
-            case JE:
-            {
-                int jcc = (int)proc_buff[ip];
-                
-                Translate_Conditional_Jmp (x86_buffer, &x86_ip, jcc);
+            Bin_Tr_Free (bin_tr);
+            return NULL;
+        }
 
-                ip  += ISA_Consts[jae].proc_sz;
-                break;
-            }
+        return bin_tr;
+    }
+
+    const struct Code_Cache cache = {options->cache_dir, options->cache_size, Options_Mask (options, bin_tr->x86_ext)};
 
-            case RET:
-                Translate_Ret (x86_buffer, &x86_ip);
+    // cached code has no lines for perf and no counters, and the key has no profile of the layout
+    const bool use_cache = options->cache_dir && !options->perf_map && !options->jitdump && !options->instrument &&
+                           !options->layout_profile;
 
-                ip  += ISA_Consts[ret].proc_sz;
-                break;
-            
-            case IN:
-                Translate_In_Align_16 (x86_buffer, &x86_ip);
-                ip += ISA_Consts[in].proc_sz;
+    if (use_cache)
+        Load_Cached_Code (bin_tr, &cache);
 
-                break;
+    bin_tr->cached = (bin_tr->x86_buff != NULL);
+
+    if (!bin_tr->cached)
+    {
+        if (Translate (bin_tr, options) == ERROR)
+        {
+            Bin_Tr_Free (bin_tr);
+            return NULL;
+        }
 
-            case OUT:
-                Translate_Out_Align_8 (x86_buffer, &x86_ip);
-                ip += ISA_Consts[out].proc_sz;
+        // a failed store only means the next compilation translates again
+        if (use_cache)
+            Store_Cache_Entry (&cache, bytecode, size, bin_tr->x86_buff, bin_tr->x86_max_ip, &bin_tr->relocs);
+    }
 
-                break;
+    bin_tr->input_buff = NULL;
 
-            case PUSH:
-            case POP:
-                Handle_Push_Pop_Second (proc_buff, &ip, x86_buffer, &x86_ip);
-                break;    
+    if (Make_Executable (bin_tr) == ERROR)
+    {
+        Bin_Tr_Free (bin_tr);
+        return NULL;
+    }
 
-            case ADD:
-            case SUB:
-            case MUL:
-            case DVD:
-                Translate_Arithmetics (x86_buffer, &x86_ip, proc_buff[ip]);
+    return bin_tr;
+}
 
-                ip  += ISA_Consts[add].proc_sz;
-                break;
+void Bin_Tr_Free (struct Bin_Tr *const code)
+{
+    if (code == NULL)
+        return;
+
+    Free_x86_Buffer (code);
+    Free_Lazy (code->lazy);
+    free (code->relocs.table);
+    free (code->lines.table);
+    Profile_Free (code->profile);
+    free (code);
+}
 
-            case SQRT:
-                Translate_Sqrt (x86_buffer, &x86_ip);
+struct Bin_Tr_Instance *Bin_Tr_New_Instance (const struct Bin_Tr *const code, const struct Bin_Tr_IO *const io)
+{
+    MY_ASSERT (code,                    "const struct Bin_Tr *const code",  NULL_PTR, NULL);
+    MY_ASSERT (io && io->in && io->out, "const struct Bin_Tr_IO *const io", NULL_PTR, NULL);
 
-                ip  += ISA_Consts[Sqrt].proc_sz;
-                break;
+    struct Bin_Tr_Instance *instance = (struct Bin_Tr_Instance *)calloc (1, sizeof (struct Bin_Tr_Instance));
+    if (instance == NULL)
+        return NULL;
 
-            default: MY_ASSERT (false, "proc_buff[ip]", UNEXP_VAL, ERROR);
-        }
+    // the stacks are only reserved, so every instance gets them: Bin_Tr_Reset_Instance () may give it tiered code
+    if (RAM_Map (&instance->ram) == ERROR || Interp_Stacks_Map (&instance->stacks) == ERROR)
+    {
+        RAM_Unmap (&instance->ram);
+        free (instance);
+        return NULL;
     }
 
-    return NO_ERRORS;
+    instance->code = code;
+    instance->io   = *io;
+
+    return instance;
 }
 
-static int Translate (struct Bin_Tr *const bin_tr)
+void Bin_Tr_Delete_Instance (struct Bin_Tr_Instance *const instance)
 {
-    MY_ASSERT (bin_tr,             "struct Bin_Tr *const bin_tr", NULL_PTR, ERROR);
-    MY_ASSERT (bin_tr->input_buff, "const char *const input",     NULL_PTR, ERROR);
+    if (instance == NULL)
+        return;
+
+    RAM_Unmap (&instance->ram);
+    Interp_Stacks_Unmap (&instance->stacks);
+    free (instance);
+}
 
-    int n_jumps = 0;
-    struct Jump *jumps_arr = First_Passing (bin_tr, &n_jumps);
-    MY_ASSERT ((n_jumps == 0 && jumps_arr == NULL) || (n_jumps > 0 && jumps_arr != NULL), "First_Passing ()", FUNC_ERROR, ERROR);
+void Bin_Tr_Reset_Instance (struct Bin_Tr_Instance *const instance, const struct Bin_Tr *const code,
+                            const struct Bin_Tr_IO *const io)
+{
+    RAM_Clear (&instance->ram);
+    memset (instance->regs, 0, sizeof instance->regs);
 
-    #ifdef DEBUG
-    int SP_status = Second_Passing (bin_tr, jumps_arr, n_jumps);
-    #else
-    Second_Passing (bin_tr, jumps_arr, n_jumps);
-    #endif
+    instance->code = code;
+    instance->io   = *io;
+}
+
+bool Bin_Tr_Run (struct Bin_Tr_Instance *const instance)
+{
+    const struct Bin_Tr *const code = instance->code;
 
-    MY_ASSERT (SP_status != ERROR, "Second_Passing ()", FUNC_ERROR, ERROR);
+    // the program is over whether it stopped at hlt or returned
+    int (* entry)(const char *, char *, double *) =
+        (int (*)(const char *, char *, double *))(code->x86_buff + code->x86_entry);
 
-    if (n_jumps > 0)
-        free (jumps_arr);
+    // a callback may run another instance in this thread
+    struct Bin_Tr_Instance *const caller = Host_Instance;
+    Host_Instance = instance;
 
-    return NO_ERRORS;
+    instance->failed = false;
+
+    if (code->lazy && code->lazy->tiered)
+    {
+        if (Interpret_Tiered (instance) == ERROR)
+            instance->failed = true;
+    }
+    else
+        entry (code->x86_buff + code->x86_start, instance->ram.base, instance->regs);
+
+    Host_Instance = caller;
+
+    return !instance->failed;
+}
+
+double *Bin_Tr_Registers (struct Bin_Tr_Instance *const instance)
+{
+    return instance->regs;
+}
+
+char *Bin_Tr_RAM (struct Bin_Tr_Instance *const instance, long *const size)
+{
+    if (size)
+        *size = RAM_SIZE;
+
+    return instance->ram.base;
+}
+
+bool Bin_Tr_Write_Profile (const struct Bin_Tr *const code, const char *const file_name)
+{
+    return code && code->profile && file_name && Profile_Write (code->profile, file_name) != ERROR;
+}
+
+//=====================================================================================//
+
+//=====================================================================================//
+//                                      EXECUTION                                      //
+//=====================================================================================//
+
+// in and out of the command line program: stdin or --input file, stdout
+struct Std_IO
+{
+    struct Input  input;
+    struct Output output;
+};
+
+static double Std_In (void *context)
+{
+    struct Std_IO *const std_io = (struct Std_IO *)context;
+
+    if (std_io->input.prompt)
+    {
+        Output_String (&std_io->output, "Write a number: ");
+        Output_Flush (&std_io->output);
+    }
+
+    return Input_Number (&std_io->input);
+}
+
+static void Std_Out (void *context, const double number)
+{
+    struct Std_IO *const std_io = (struct Std_IO *)context;
+
+    Output_Number (&std_io->output, number);
+}
+
+static inline int Run (struct Bin_Tr_Instance *const instance, struct Std_IO *const std_io)
+{
+    Input_Rewind (&std_io->input);
+
+    const bool completed = Bin_Tr_Run (instance);
+
+    Output_Flush (&std_io->output);     // hlt
+
+    return (completed) ? NO_ERRORS : ERROR;
 }
 
 #ifdef STRESS_TEST
 const long long n_tests = 100000000;
 #endif
 
-static int JIT (struct Bin_Tr *bin_tr)
+static int JIT (struct Bin_Tr_Instance *const instance, struct Std_IO *const std_io)
 {
-    #ifdef DEBUG
-    int mprotect_res = mprotect (bin_tr->x86_buff, bin_tr->x86_max_ip, PROT_EXEC);
+    #ifdef STRESS_TEST
+    for (long long i = 0; i < n_tests; i++)
+        if (Run (instance, std_io) == ERROR)
+            return ERROR;
+
+    return NO_ERRORS;
     #else
-    mprotect (bin_tr->x86_buff, bin_tr->x86_max_ip, PROT_EXEC);
+    return Run (instance, std_io);
     #endif
+}
 
-    MY_ASSERT (mprotect_res == 0, "mprotect ()", FUNC_ERROR, ERROR);
+//=====================================================================================//
 
-    void (* executor)(void) = (void (*)(void))(bin_tr->x86_buff);
+//=====================================================================================//
+//                                      BENCHMARK                                      //
+//=====================================================================================//
 
-    #ifdef STRESS_TEST
-    for (long long i = 0; i < n_tests; i++)
-        executor ();
-    #else
-    executor ();
-    #endif
+#define MIN_SAMPLE_NS 1000000L     // short programs are run in batches, so that clock resolution doesn't matter
+#define MAX_BATCH     (1L << 20)
 
-    return NO_ERRORS;
+static long Time_Batch (struct Bin_Tr_Instance *const instance, struct Std_IO *const std_io, const long n_batch)
+{
+    const long start = Clock_Ns ();
+
+    for (long run_i = 0; run_i < n_batch; run_i++)
+        Run (instance, std_io);
+
+    return Clock_Ns () - start;
 }
 
-int Binary_Translator (const char *const input_name)
+// the first translation is already done by the caller and is counted as a warmup run, unless there are none
+static int Benchmark (struct Bin_Tr_Instance *const instance, struct Std_IO *const std_io,
+                      const char *const bytecode, const long size, const char *const input_name,
+                      const struct Tr_Options *const options)
 {
-    MY_ASSERT (input_name, "const char *const input_name", NULL_PTR, ERROR);
+    MY_ASSERT (instance, "struct Bin_Tr_Instance *const instance", NULL_PTR, ERROR);
+    MY_ASSERT (options,  "const struct Tr_Options *const options", NULL_PTR, ERROR);
 
-    struct Bin_Tr bin_tr = {};
-    
-    bin_tr.input_buff = Make_File_Buffer (input_name, &bin_tr.max_ip);
-    MY_ASSERT (bin_tr.input_buff, "Make_File_Buffer ()", FUNC_ERROR, ERROR);
+    const int n_runs = options->bench_runs;
 
-    #ifdef DEBUG
-    int Tr_status = Translate (&bin_tr);
-    #else
-    Translate (&bin_tr);
-    #endif
+    struct Samples translation = {(long *)calloc (n_runs, sizeof (long)), n_runs};
+    MY_ASSERT (translation.ns, "translation.ns", NE_MEM, ERROR);
 
-    free (bin_tr.input_buff);
-    MY_ASSERT (Tr_status != ERROR, "Translate ()", FUNC_ERROR, ERROR);
+    struct Samples execution = {(long *)calloc (n_runs, sizeof (long)), n_runs};
+    MY_ASSERT (execution.ns, "execution.ns", NE_MEM, ERROR);
 
-    #if 0
-    FILE *output = Open_File ("debug.bin", "wb");
-    fwrite (bin_tr.x86_buff, sizeof (char), bin_tr.x86_max_ip, output);
-    Close_File (output, "debug.bin");
-    #endif
+    // only the code that runs is described to perf and counts executions
+    struct Bin_Tr_Options scratch_options = options->compile;
+    scratch_options.perf_map = scratch_options.jitdump = scratch_options.instrument = false;
+
+    const int first_run = (options->bench_warmup > 0) ? 1 - options->bench_warmup : 0;
 
-    JIT (&bin_tr);
+    for (int run_i = first_run; run_i < n_runs; run_i++)
+    {
+        struct Bin_Tr bin_tr = {.input_buff = bytecode, .max_ip = size, .huge_pages = options->compile.huge_pages,
+                                .x86_ext    = Code_Extensions (&options->compile)};
 
-    free (bin_tr.x86_buff);
+        const long start = Clock_Ns ();
+        Translate (&bin_tr, &scratch_options);
+        const long duration = Clock_Ns () - start;
 
-    printf ("Thanks for choosing Ketchupp_JIT!\n");
+        if (run_i >= 0)
+            translation.ns[run_i] = duration;
 
-    return NO_ERRORS;
+        Free_x86_Buffer (&bin_tr);
+        free (bin_tr.relocs.table);
+    }
+
+    for (int run_i = 0; run_i < options->bench_warmup; run_i++)
+        Run (instance, std_io);
+
+    long n_batch = 1;
+    while (Time_Batch (instance, std_io, n_batch) < MIN_SAMPLE_NS && n_batch < MAX_BATCH)
+        n_batch *= 2;
+
+    for (int run_i = 0; run_i < n_runs; run_i++)
+        execution.ns[run_i] = Time_Batch (instance, std_io, n_batch);
+
+    const int report_status = Write_Bench_Report (input_name, options, &translation, &execution, n_batch,
+                                                  instance->code->x86_max_ip);
+
+    free (execution.ns);
+    free (translation.ns);
+
+    return report_status;
+}
+
+#undef MIN_SAMPLE_NS
+#undef MAX_BATCH
+
+//=====================================================================================//
+
+// runs the code once or benchmarks it with numbers from stdin or --input and output to stdout
+static int Execute (const struct Bin_Tr *const code, const char *const bytecode, const long size,
+                    const char *const input_name, const struct Tr_Options *const options)
+{
+    struct Std_IO std_io = {};
+
+    if (Output_Init (&std_io.output, fileno (stdout), options->out_flush, options->out_shortest) == ERROR)
+        return ERROR;
+
+    fflush (stdout);    // the code writes past stdio: messages above go first
+
+    const struct Bin_Tr_IO io = {Std_In, Std_Out, &std_io};
+    struct Bin_Tr_Instance *instance = NULL;
+
+    int ret_val = NO_ERRORS;
+
+    if (Input_Open (&std_io.input, options->input_file, options->input_binary) == ERROR)
+    {
+        ret_val = ERROR;
+        printf ("Can't read input file \"%s\"\n", options->input_file);
+    }
+    else if ((instance = Bin_Tr_New_Instance (code, &io)) == NULL)
+    {
+        ret_val = ERROR;
+        printf ("Can't map RAM and stacks of the program\n");
+    }
+    else if (options->bench_output)
+    {
+        ret_val = Benchmark (instance, &std_io, bytecode, size, input_name, options);
+
+        if (ret_val == ERROR)
+            printf ("Can't write benchmark report \"%s\"\n", options->bench_output);
+    }
+    else if ((ret_val = JIT (instance, &std_io)) == ERROR)
+        printf ("Can't translate a procedure of \"%s\"\n", input_name);
+    else
+        printf ("Thanks for choosing Ketchupp_JIT!\n");
+
+    Bin_Tr_Delete_Instance (instance);
+    Output_Free (&std_io.output);
+    Input_Close (&std_io.input);
+
+    return ret_val;
+}
+
+int Binary_Translator (const char *const input_name, const char *const bytecode, const long size,
+                       const struct Tr_Options *const options)
+{
+    MY_ASSERT (input_name, "const char *const input_name",           NULL_PTR, ERROR);
+    MY_ASSERT (bytecode,   "const char *const bytecode",             NULL_PTR, ERROR);
+    MY_ASSERT (options,    "const struct Tr_Options *const options", NULL_PTR, ERROR);
+
+    // benchmarks measure translation itself, executables and benchmarks need all the code
+    struct Bin_Tr_Options compile_options = options->compile;
+    if (options->bench_output)
+        compile_options.cache_dir = NULL;
+    if (options->bench_output || options->aot_output)
+        compile_options.lazy = compile_options.tiered = false;
+
+    // an executable may run on another machine
+    if (options->aot_output && options->compile.target == TARGET_AUTO)
+        compile_options.target = TARGET_SSE2;
+
+    compile_options.perf_name = input_name;
+
+    FILE *layout_profile = (compile_options.layout_profile) ? fopen (compile_options.layout_profile, "r") : NULL;
+
+    if (compile_options.layout_profile && layout_profile == NULL)
+    {
+        printf ("Can't read profile \"%s\"\n", compile_options.layout_profile);
+        return ERROR;
+    }
+
+    if (layout_profile)
+        fclose (layout_profile);
+
+    struct Bin_Tr *code = Bin_Tr_Compile (bytecode, size, &compile_options);
+
+    if (code == NULL)
+    {
+        printf ("Can't translate \"%s\"\n", input_name);
+        return ERROR;
+    }
+
+    if (compile_options.peephole && !code->cached && !code->lazy)
+        printf ("Peephole optimizer removed %ld of %ld bytes of x86-64 code\n",
+                code->n_peephole_bytes, code->x86_max_ip + code->n_relaxed_bytes + code->n_peephole_bytes);
+
+    if (compile_options.short_branches && !code->cached && !code->lazy)
+        printf ("Branch relaxation removed %ld of %ld bytes of x86-64 code\n",
+                code->n_relaxed_bytes, code->x86_max_ip + code->n_relaxed_bytes);
+
+    int ret_val = NO_ERRORS;
+
+    // the code addresses RAM through r15, so the same cache entry serves JIT and static executables
+    if (options->aot_output)
+    {
+        ret_val = Write_ELF (options->aot_output, code->x86_buff, code->x86_max_ip, &code->relocs);
+
+        if (ret_val == ERROR)
+            printf ("Can't write executable \"%s\"\n", options->aot_output);
+    }
+    else
+        ret_val = Execute (code, bytecode, size, input_name, options);
+
+    if (options->profile_output && ret_val != ERROR && !Bin_Tr_Write_Profile (code, options->profile_output))
+    {
+        ret_val = ERROR;
+        printf ("Can't write profile \"%s\"\n", options->profile_output);
+    }
+
+    if (code->lazy && code->lazy->tiered && ret_val != ERROR)
+        printf ("Tiered execution translated %d of %d basic blocks\n", Count_Compiled_Blocks (code->lazy),
+                code->lazy->ir.n_blocks);
+    else if (code->lazy && ret_val != ERROR)
+    {
+        int n_compiled = 0, n_procs = 0;
+        Count_Procedures (code->lazy, &n_compiled, &n_procs);
+
+        printf ("Lazy compilation translated %d of %d procedures\n", n_compiled, n_procs);
+    }
+
+    Bin_Tr_Free (code);
+
+    return ret_val;
 }
@@ -0,0 +1,193 @@
+#include "../include/Profile.h"
+
+//=====================================================================================//
+//                                    BLOCK LAYOUT                                     //
+//=====================================================================================//
+
+// Blocks are chained from the start of the program along their hottest edges: a block is followed by its most
+// frequent successor that isn't placed yet. A chain that can't go on is continued by the first hot block in
+// bytecode order, blocks that never ran go to the end in bytecode order. Lowering puts a jmp after a block
+// whose fall-through block isn't the next one.
+
+struct Edges
+{
+    uint64_t fall_through;      // executions that go on to the fall-through block
+    uint64_t branch;            // executions that go to the destination of the last jmp or jcc
+};
+
+static inline int Negate_Jcc (const int type)
+{
+    switch (type)
+    {
+        case jae:  return jnae;
+        case ja:   return jna;
+        case jbe:  return jnbe;
+        case jb:   return jnb;
+        case je:   return jne;
+        case jne:  return je;
+        case jnae: return jae;
+        case jna:  return ja;
+        case jnbe: return jbe;
+        case jnb:  return jb;
+
+        default:
+            MY_ASSERT (false, "const int type", UNEXP_VAL, type);
+            break;
+    }
+
+    return type;
+}
+
+static inline const struct IR_Instr *Last_Instr (const struct IR *const ir, const int block_i)
+{
+    const struct IR_Block *const block = ir->blocks + block_i;
+
+    return (block->n_instrs > 0) ? ir->instrs + block->first + block->n_instrs - 1 : NULL;
+}
+
+// a call comes back to the fall-through block, the procedure is laid out from its own entry
+static struct Edges Block_Edges (const struct IR *const ir, const struct Profile *const profile,
+                                 const uint64_t *const weights, const int block_i)
+{
+    const struct IR_Instr *const last = Last_Instr (ir, block_i);
+    const uint64_t executions = weights[block_i];
+
+    if (last && Is_Jcc (last->type))
+    {
+        const uint64_t not_taken = profile->counts[profile->n_blocks + block_i];
+        const uint64_t taken     = (executions > not_taken) ? executions - not_taken : 0;
+
+        return (struct Edges){not_taken, taken};
+    }
+
+    if (last && last->type == jmp)
+        return (struct Edges){0, executions};
+
+    return (struct Edges){executions, 0};
+}
+
+// Executions of every block. Blocks emptied by constant folding have no counter, they get the executions of
+// the edges to them (from blocks before them, which is where they are usually reached from).
+static uint64_t *Block_Weights (const struct IR *const ir, const struct Profile *const profile)
+{
+    uint64_t *weights = (uint64_t *)calloc (ir->n_blocks + 1, sizeof (uint64_t));
+    if (weights == NULL)
+        return NULL;
+
+    memcpy (weights, profile->counts, ir->n_blocks * sizeof (uint64_t));
+
+    for (int block_i = 0; block_i < ir->n_blocks; block_i++)
+    {
+        const struct IR_Block *const block = ir->blocks + block_i;
+        const struct Edges edges = Block_Edges (ir, profile, weights, block_i);
+
+        if (block->fall_through >= 0 && ir->blocks[block->fall_through].n_instrs == 0)
+            weights[block->fall_through] += edges.fall_through;
+
+        if (block->branch >= 0 && ir->blocks[block->branch].n_instrs == 0)
+            weights[block->branch] += edges.branch;
+    }
+
+    return weights;
+}
+
+// the more frequent of the unplaced successors that ran, the fall-through block on a tie (-1 - none)
+static int Hot_Successor (const struct IR *const ir, const struct Profile *const profile,
+                          const uint64_t *const weights, const bool *const placed, const int block_i)
+{
+    const struct IR_Block *const block = ir->blocks + block_i;
+    const struct IR_Instr *const last  = Last_Instr (ir, block_i);
+    const struct Edges edges = Block_Edges (ir, profile, weights, block_i);
+
+    const bool fall_through = block->fall_through >= 0 && !placed[block->fall_through] && edges.fall_through > 0;
+    const bool branch       = last && (last->type == jmp || Is_Jcc (last->type)) &&
+                              !placed[block->branch] && edges.branch > 0;
+
+    if (branch && (!fall_through || edges.branch > edges.fall_through))
+        return block->branch;
+
+    return (fall_through) ? block->fall_through : -1;
+}
+
+// the jcc goes to the block after it, so it's negated and falls through there
+static void Negate_Branch (struct IR *const ir, const int block_i)
+{
+    struct IR_Block *const block = ir->blocks + block_i;
+    struct IR_Instr *const last  = ir->instrs + block->first + block->n_instrs - 1;
+
+    const int destination = block->fall_through;
+
+    block->fall_through = block->branch;
+    block->branch       = destination;
+
+    last->type       = Negate_Jcc (last->type);
+    last->jump.block = destination;
+
+    if (ir->blocks[destination].n_instrs > 0)
+        last->jump.to = ir->instrs[ir->blocks[destination].first].ip;
+}
+
+int Order_Blocks (struct IR *const ir, const struct Profile *const profile, int *const order)
+{
+    MY_ASSERT (ir,      "struct IR *const ir",                 NULL_PTR, ERROR);
+    MY_ASSERT (profile, "const struct Profile *const profile", NULL_PTR, ERROR);
+    MY_ASSERT (order,   "int *const order",                    NULL_PTR, ERROR);
+    MY_ASSERT (profile->n_blocks == ir->n_blocks, "profile->n_blocks", UNEXP_VAL, ERROR);
+
+    uint64_t *weights = Block_Weights (ir, profile);
+    bool *placed = (bool *)calloc (ir->n_blocks + 1, sizeof (bool));
+
+    if (weights == NULL || placed == NULL)
+    {
+        free (weights);
+        free (placed);
+        return ERROR;
+    }
+
+    int n_placed = 0;
+
+    // the entry stub enters the code at block 0
+    for (int seed = 0; seed >= 0 && seed < ir->n_blocks; )
+    {
+        for (int block_i = seed; block_i >= 0; block_i = Hot_Successor (ir, profile, weights, placed, block_i))
+        {
+            placed[block_i]     = true;
+            order[n_placed++] = block_i;
+        }
+
+        while (seed < ir->n_blocks && (placed[seed] || weights[seed] == 0))
+            seed++;
+    }
+
+    for (int block_i = 0; block_i < ir->n_blocks; block_i++)
+        if (!placed[block_i])
+            order[n_placed++] = block_i;
+
+    for (int order_i = 0; order_i + 1 < ir->n_blocks; order_i++)
+    {
+        const int block_i = order[order_i];
+        struct IR_Block *const block = ir->blocks + block_i;
+        struct IR_Instr *const last  = (struct IR_Instr *)Last_Instr (ir, block_i);
+
+        if (last == NULL || block->branch != order[order_i + 1])
+            continue;
+
+        // a jmp to the next block is dropped, the block falls through there instead
+        if (last->type == jmp)
+        {
+            last->type = nop;
+
+            block->fall_through = block->branch;
+            block->branch       = -1;
+        }
+        else if (Is_Jcc (last->type) && block->fall_through >= 0 && block->branch != block->fall_through)
+            Negate_Branch (ir, block_i);
+    }
+
+    free (placed);
+    free (weights);
+
+    return NO_ERRORS;
+}
+
+//=====================================================================================//
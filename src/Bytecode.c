@@ -0,0 +1,111 @@
+#include "../include/Bytecode.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define READ_CHUNK   (64L << 10)
+
+// A file is mapped if it's regular; the decoder reads nothing past the end of the bytecode
+static bool Map_Bytecode (struct Bytecode *const bytecode, const int fd)
+{
+    struct stat file_stat = {};
+
+    if (fstat (fd, &file_stat) != 0 || !S_ISREG (file_stat.st_mode) || file_stat.st_size == 0)
+        return false;
+
+    char *map = (char *)mmap (NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return false;
+
+    madvise (map, file_stat.st_size, MADV_SEQUENTIAL);     // decoded once from the beginning to the end
+
+    bytecode->data   = map;
+    bytecode->size   = file_stat.st_size;
+    bytecode->mapped = true;
+
+    return true;
+}
+
+static int Read_Bytecode (struct Bytecode *const bytecode, const int fd)
+{
+    long capacity = READ_CHUNK;
+    long size     = 0;
+
+    char *buffer = (char *)malloc (capacity);
+    MY_ASSERT (buffer, "char *buffer", NE_MEM, ERROR);
+
+    for (;;)
+    {
+        if (size == capacity)
+        {
+            capacity *= 2;
+
+            char *new_buffer = (char *)realloc (buffer, capacity);
+            if (new_buffer == NULL)
+            {
+                free (buffer);
+                return ERROR;
+            }
+
+            buffer = new_buffer;
+        }
+
+        const ssize_t n_bytes = read (fd, buffer + size, capacity - size);
+
+        if (n_bytes < 0 && errno == EINTR)
+            continue;
+
+        if (n_bytes < 0)
+        {
+            free (buffer);
+            return ERROR;
+        }
+
+        if (n_bytes == 0)
+            break;
+
+        size += n_bytes;
+    }
+
+    bytecode->data   = buffer;
+    bytecode->size   = size;
+    bytecode->mapped = false;
+
+    return NO_ERRORS;
+}
+
+// file_name "-": stdin
+int Bytecode_Load (struct Bytecode *const bytecode, const char *const file_name)
+{
+    MY_ASSERT (bytecode,  "struct Bytecode *const bytecode", NULL_PTR, ERROR);
+    MY_ASSERT (file_name, "const char *const file_name",     NULL_PTR, ERROR);
+
+    *bytecode = (struct Bytecode){};
+
+    const bool is_stdin = (strcmp (file_name, "-") == 0);
+
+    const int fd = (is_stdin) ? STDIN_FILENO : open (file_name, O_RDONLY);
+    if (fd < 0)
+        return ERROR;
+
+    // the mapping stays valid after close ()
+    const int ret_val = (Map_Bytecode (bytecode, fd)) ? NO_ERRORS : Read_Bytecode (bytecode, fd);
+
+    if (!is_stdin)
+        close (fd);
+
+    return ret_val;
+}
+
+void Bytecode_Free (struct Bytecode *const bytecode)
+{
+    if (bytecode->mapped)
+        munmap (bytecode->data, bytecode->size);
+    else
+        free (bytecode->data);
+
+    *bytecode = (struct Bytecode){};
+}
+
+#undef READ_CHUNK
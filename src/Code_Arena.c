@@ -0,0 +1,234 @@
+#include "../include/Code_Arena.h"
+#include <pthread.h>
+
+#define ARENA_SIZE  (1L << 30)
+#define REACH       ((1L << 31) - (64L << 20))     // from host to any host function: they are in one binary
+#define HINT_STEP   (64L << 20)
+
+// Offsets [begin, end) that are free below the top
+struct Hole
+{
+    long begin;
+    long end;
+};
+
+static struct
+{
+    pthread_mutex_t lock;
+
+    char *base;             // ARENA_HUGE_PAGE aligned, NULL until the first allocation
+    long  top;              // the bump pointer: offsets from here to ARENA_SIZE were never allocated
+
+    struct Hole *holes;     // sorted, never adjacent to each other or to top
+    int n_holes;
+    int holes_capacity;
+} Arena = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+//=====================================================================================//
+//                                     RESERVATION                                     //
+//=====================================================================================//
+
+static inline bool Is_Near (const char *const address, const void *const host)
+{
+    const int64_t distance = (int64_t)host - (int64_t)address;
+
+    return -REACH <= distance && distance <= REACH;
+}
+
+// right below the binary, like the code buffers before the arena; it's never unmapped, because code handles
+// may live until the process exits
+static bool Reserve (const void *const host)
+{
+    const uintptr_t host_page = (uintptr_t)host & ~(uintptr_t)(ARENA_PAGE - 1);
+    const long reserve_size   = ARENA_SIZE + ARENA_HUGE_PAGE;   // room for the alignment
+
+    for (uintptr_t hint = host_page - reserve_size; hint < host_page && Is_Near ((char *)hint, host); hint -= HINT_STEP)
+    {
+        char *reservation = (char *)mmap ((void *)hint, reserve_size, PROT_NONE,
+                                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (reservation == MAP_FAILED)
+            return false;
+
+        char *const base = reservation + (ARENA_HUGE_PAGE - (uintptr_t)reservation % ARENA_HUGE_PAGE) % ARENA_HUGE_PAGE;
+
+        if (Is_Near (base, host) && Is_Near (base + ARENA_SIZE, host))
+        {
+            Arena.base = base;
+            return true;
+        }
+
+        munmap (reservation, reserve_size);
+    }
+
+    return false;
+}
+
+//=====================================================================================//
+
+//=====================================================================================//
+//                                        HOLES                                        //
+//=====================================================================================//
+
+static int Insert_Hole (const int hole_i, const long begin, const long end)
+{
+    if (Arena.n_holes == Arena.holes_capacity)
+    {
+        const int new_capacity = (Arena.holes_capacity) ? 2 * Arena.holes_capacity : 16;
+
+        struct Hole *holes = (struct Hole *)realloc (Arena.holes, new_capacity * sizeof (struct Hole));
+        if (holes == NULL)
+            return ERROR;
+
+        Arena.holes          = holes;
+        Arena.holes_capacity = new_capacity;
+    }
+
+    memmove (Arena.holes + hole_i + 1, Arena.holes + hole_i, (Arena.n_holes - hole_i) * sizeof (struct Hole));
+
+    Arena.holes[hole_i] = (struct Hole){begin, end};
+    Arena.n_holes++;
+
+    return NO_ERRORS;
+}
+
+static void Remove_Hole (const int hole_i)
+{
+    memmove (Arena.holes + hole_i, Arena.holes + hole_i + 1, (Arena.n_holes - hole_i - 1) * sizeof (struct Hole));
+    Arena.n_holes--;
+}
+
+// first fit among the holes, then the bump pointer; -1 if there is no room
+static long Take (const long size, const long align)
+{
+    for (int hole_i = 0; hole_i < Arena.n_holes; hole_i++)
+    {
+        struct Hole *const hole = Arena.holes + hole_i;
+
+        const long begin = (hole->begin + align - 1) / align * align;
+        const long end   = begin + size;
+
+        if (end > hole->end)
+            continue;
+
+        if (begin == hole->begin && end == hole->end)
+            Remove_Hole (hole_i);
+        else if (begin == hole->begin)
+            hole->begin = end;
+        else if (end == hole->end)
+            hole->end = begin;
+        else if (Insert_Hole (hole_i + 1, end, hole->end) == ERROR)
+            continue;
+        else
+            Arena.holes[hole_i].end = begin;    // the insertion may have moved the holes
+
+        return begin;
+    }
+
+    const long begin = (Arena.top + align - 1) / align * align;
+
+    if (begin + size > ARENA_SIZE)
+        return -1;
+
+    // the gap left by the alignment; a failed insertion only loses it
+    if (begin > Arena.top)
+    {
+        if (Arena.n_holes > 0 && Arena.holes[Arena.n_holes - 1].end == Arena.top)
+            Arena.holes[Arena.n_holes - 1].end = begin;
+        else
+            Insert_Hole (Arena.n_holes, Arena.top, begin);
+    }
+
+    Arena.top = begin + size;
+
+    return begin;
+}
+
+// merges the range with the neighbouring holes; the top goes down if they touch it
+static void Give_Back (long begin, long end)
+{
+    int hole_i = 0;     // the first hole after the range
+    while (hole_i < Arena.n_holes && Arena.holes[hole_i].begin < begin)
+        hole_i++;
+
+    if (hole_i > 0 && Arena.holes[hole_i - 1].end == begin)
+    {
+        hole_i--;
+        begin = Arena.holes[hole_i].begin;
+        Remove_Hole (hole_i);
+    }
+
+    if (hole_i < Arena.n_holes && Arena.holes[hole_i].begin == end)
+    {
+        end = Arena.holes[hole_i].end;
+        Remove_Hole (hole_i);
+    }
+
+    if (end == Arena.top)
+        Arena.top = begin;
+    else
+        Insert_Hole (hole_i, begin, end);   // a failed insertion only loses the range
+}
+
+//=====================================================================================//
+
+//=====================================================================================//
+//                                       REGIONS                                       //
+//=====================================================================================//
+
+char *Arena_Alloc (const long size, const bool huge_pages, const void *const host)
+{
+    MY_ASSERT (size > 0 && size % ARENA_PAGE == 0, "const long size",        UNEXP_VAL, NULL);
+    MY_ASSERT (host,                               "const void *const host", NULL_PTR,  NULL);
+
+    // only whole aligned 2 MB pieces of a region can be huge pages
+    const bool huge = huge_pages && size >= ARENA_HUGE_PAGE;
+
+    pthread_mutex_lock (&Arena.lock);
+
+    long offset = -1;
+    if (Arena.base || Reserve (host))
+        offset = Take (size, (huge) ? ARENA_HUGE_PAGE : ARENA_PAGE);
+
+    pthread_mutex_unlock (&Arena.lock);
+
+    if (offset < 0)
+        return NULL;
+
+    char *const region = Arena.base + offset;
+
+    // a request: without transparent huge pages in the kernel the pages are just small
+    if (huge)
+        madvise (region, size, MADV_HUGEPAGE);
+
+    return region;
+}
+
+// the pages lose their contents and go back to the kernel, the addresses go back to the arena
+void Arena_Free (char *const region, const long size)
+{
+    if (region == NULL || size == 0)
+        return;
+
+    mprotect (region, size, PROT_NONE);
+    madvise  (region, size, MADV_DONTNEED);
+
+    pthread_mutex_lock (&Arena.lock);
+    Give_Back (region - Arena.base, region - Arena.base + size);
+    pthread_mutex_unlock (&Arena.lock);
+}
+
+int Arena_Write (char *const region, const long size)
+{
+    return (mprotect (region, size, PROT_READ | PROT_WRITE) == 0) ? NO_ERRORS : ERROR;
+}
+
+int Arena_Seal (char *const region, const long size)
+{
+    return (mprotect (region, size, PROT_READ | PROT_EXEC) == 0) ? NO_ERRORS : ERROR;
+}
+
+//=====================================================================================//
+
+#undef ARENA_SIZE
+#undef REACH
+#undef HINT_STEP
@@ -0,0 +1,339 @@
+#include "../include/Code_Cache.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// Cache file: header, relocation table, x86 code, bytecode. The name of the file is the key:
+// hash of bytecode and translation options; the bytecode itself tells colliding keys apart.
+
+#define CACHE_MAGIC   "KJITCODE"
+#define CACHE_VERSION 5
+#define CACHE_SUFFIX  ".kjit"
+#define TMP_SUFFIX    ".tmp"
+#define STALE_TMP_AGE 60        // seconds after which a temporary file is a leftover of a crashed run
+
+struct Cache_Header
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t options;
+
+    uint64_t key;
+    uint64_t bytecode_size;
+
+    uint64_t x86_size;
+    uint32_t n_relocs;
+    uint32_t reserved;
+
+    uint64_t checksum;      // of relocation table and x86 code
+};
+
+//=====================================================================================//
+//                                       HASHING                                       //
+//=====================================================================================//
+
+static const uint64_t FNV_OFFSET = 0xCBF29CE484222325;
+static const uint64_t FNV_PRIME  = 0x00000100000001B3;
+
+// FNV-1a, hash of the previous part of data is passed as seed
+static uint64_t Hash (const void *const data, const size_t size, uint64_t seed)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+
+    for (size_t byte_i = 0; byte_i < size; byte_i++)
+    {
+        seed ^= bytes[byte_i];
+        seed *= FNV_PRIME;
+    }
+
+    return seed;
+}
+
+static inline uint64_t Cache_Key (const struct Code_Cache *const cache, const char *const bytecode, const long max_ip)
+{
+    const uint64_t hash = Hash (bytecode, max_ip, FNV_OFFSET);
+
+    return Hash (&cache->options, sizeof cache->options, hash);
+}
+
+static inline uint64_t Entry_Checksum (const struct Reloc *const relocs, const int n_relocs,
+                                       const char *const x86_code, const long x86_size)
+{
+    const uint64_t hash = Hash (relocs, n_relocs * sizeof (struct Reloc), FNV_OFFSET);
+
+    return Hash (x86_code, x86_size, hash);
+}
+
+// returns false if the path is too long
+static inline bool Entry_Path (char *const path, const struct Code_Cache *const cache, const uint64_t key)
+{
+    return snprintf (path, PATH_MAX, "%s/%016" PRIx64 CACHE_SUFFIX, cache->dir, key) < PATH_MAX;
+}
+
+//=====================================================================================//
+
+//=====================================================================================//
+//                                       LOADING                                       //
+//=====================================================================================//
+
+static bool Is_Valid_Entry (const struct Cache_Entry *const entry, const uint64_t key, const char *const bytecode,
+                            const long max_ip, const uint32_t options)
+{
+    if (entry->map_size < sizeof (struct Cache_Header))
+        return false;
+
+    const struct Cache_Header *header = (const struct Cache_Header *)entry->map;
+
+    if (memcmp (header->magic, CACHE_MAGIC, sizeof header->magic) != 0 || header->version != CACHE_VERSION ||
+        header->key != key || header->options != options || header->bytecode_size != (uint64_t)max_ip)
+        return false;
+
+    const uint64_t relocs_size = (uint64_t)header->n_relocs * sizeof (struct Reloc);
+
+    if (header->x86_size > entry->map_size ||
+        sizeof (struct Cache_Header) + relocs_size + header->x86_size + max_ip != entry->map_size)
+        return false;
+
+    const struct Reloc *relocs   = (const struct Reloc *)(entry->map + sizeof (struct Cache_Header));
+    const char         *x86_code = entry->map + sizeof (struct Cache_Header) + relocs_size;
+
+    if (memcmp (x86_code + header->x86_size, bytecode, max_ip) != 0)
+        return false;
+
+    for (uint32_t reloc_i = 0; reloc_i < header->n_relocs; reloc_i++)
+    {
+        if (relocs[reloc_i].func >= N_HOST_FUNCS || relocs[reloc_i].x86_ip + sizeof (int) > header->x86_size)
+            return false;
+    }
+
+    return header->checksum == Entry_Checksum (relocs, header->n_relocs, x86_code, header->x86_size);
+}
+
+// entry->map stays NULL if the code for this bytecode is not cached
+int Open_Cache_Entry (const struct Code_Cache *const cache, const char *const bytecode, const long max_ip,
+                      struct Cache_Entry *const entry)
+{
+    MY_ASSERT (cache,    "const struct Code_Cache *const cache", NULL_PTR, ERROR);
+    MY_ASSERT (bytecode, "const char *const bytecode",           NULL_PTR, ERROR);
+    MY_ASSERT (entry,    "struct Cache_Entry *const entry",      NULL_PTR, ERROR);
+
+    *entry = (struct Cache_Entry){};
+
+    const uint64_t key = Cache_Key (cache, bytecode, max_ip);
+
+    char path[PATH_MAX] = "";
+    if (!Entry_Path (path, cache, key))
+        return NO_ERRORS;
+
+    const int fd = open (path, O_RDONLY);
+    if (fd < 0)
+        return NO_ERRORS;
+
+    struct stat file_stat = {};
+    if (fstat (fd, &file_stat) == 0 && file_stat.st_size > 0)
+    {
+        entry->map_size = file_stat.st_size;
+        entry->map = (char *)mmap (NULL, entry->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (entry->map == MAP_FAILED)
+            entry->map = NULL;
+    }
+
+    if (entry->map && !Is_Valid_Entry (entry, key, bytecode, max_ip, cache->options))
+    {
+        Close_Cache_Entry (entry);
+        unlink (path);              // damaged or stale, translate again
+    }
+
+    if (entry->map)
+    {
+        const struct Cache_Header *header = (const struct Cache_Header *)entry->map;
+
+        entry->n_relocs = header->n_relocs;
+        entry->relocs   = (const struct Reloc *)(entry->map + sizeof (struct Cache_Header));
+        entry->x86_size = header->x86_size;
+        entry->x86_code = (const char *)(entry->relocs + entry->n_relocs);
+
+        futimens (fd, NULL);        // modification time orders entries for eviction
+    }
+
+    close (fd);
+
+    return NO_ERRORS;
+}
+
+void Close_Cache_Entry (struct Cache_Entry *const entry)
+{
+    if (entry->map)
+        munmap (entry->map, entry->map_size);
+
+    *entry = (struct Cache_Entry){};
+}
+
+//=====================================================================================//
+
+//=====================================================================================//
+//                                       STORING                                       //
+//=====================================================================================//
+
+struct Cache_File
+{
+    char   name[NAME_MAX + 1];
+    time_t mtime;
+    long   size;
+};
+
+static int Cmp_By_Mtime (const void *first, const void *second)
+{
+    const time_t first_time  = ((const struct Cache_File *)first)->mtime;
+    const time_t second_time = ((const struct Cache_File *)second)->mtime;
+
+    return (first_time > second_time) - (first_time < second_time);
+}
+
+static inline bool Has_Suffix (const char *const name, const char *const suffix)
+{
+    const size_t name_len   = strlen (name);
+    const size_t suffix_len = strlen (suffix);
+
+    return name_len > suffix_len && strcmp (name + name_len - suffix_len, suffix) == 0;
+}
+
+// removes the least recently used entries until the cache fits in cache->max_size;
+// temporary files count toward the size, and the ones left by crashed runs are removed
+static int Evict (const struct Code_Cache *const cache)
+{
+    DIR *dir = opendir (cache->dir);
+    if (dir == NULL)
+        return ERROR;
+
+    struct Cache_File *files = NULL;
+    int n_files  = 0;
+    int capacity = 0;
+
+    long total_size = 0;
+    const time_t now = time (NULL);
+
+    for (struct dirent *dir_entry = readdir (dir); dir_entry; dir_entry = readdir (dir))
+    {
+        const bool is_tmp = Has_Suffix (dir_entry->d_name, TMP_SUFFIX);
+
+        if (!is_tmp && !Has_Suffix (dir_entry->d_name, CACHE_SUFFIX))
+            continue;
+
+        struct stat file_stat = {};
+        if (fstatat (dirfd (dir), dir_entry->d_name, &file_stat, 0) != 0 || !S_ISREG (file_stat.st_mode))
+            continue;
+
+        // a fresh temporary file is being written by another run
+        if (is_tmp)
+        {
+            if (now - file_stat.st_mtime < STALE_TMP_AGE || unlinkat (dirfd (dir), dir_entry->d_name, 0) != 0)
+                total_size += file_stat.st_size;
+
+            continue;
+        }
+
+        if (n_files == capacity)
+        {
+            capacity = (capacity) ? 2 * capacity : 64;
+
+            struct Cache_File *new_files = (struct Cache_File *)realloc (files, capacity * sizeof (struct Cache_File));
+            if (new_files == NULL)
+                break;              // evict among the files listed so far
+
+            files = new_files;
+        }
+
+        strcpy (files[n_files].name, dir_entry->d_name);
+        files[n_files].mtime = file_stat.st_mtime;
+        files[n_files].size  = file_stat.st_size;
+        n_files++;
+
+        total_size += file_stat.st_size;
+    }
+
+    if (total_size > cache->max_size)
+    {
+        qsort (files, n_files, sizeof (struct Cache_File), Cmp_By_Mtime);
+
+        for (int file_i = 0; file_i < n_files && total_size > cache->max_size; file_i++)
+        {
+            if (unlinkat (dirfd (dir), files[file_i].name, 0) == 0)
+                total_size -= files[file_i].size;
+        }
+    }
+
+    free (files);
+    closedir (dir);
+
+    return NO_ERRORS;
+}
+
+// Failures are reported but not fatal: the code just stays uncached.
+// The entry is written to a temporary file and renamed, so concurrent runs never see a partial entry;
+// the name of the temporary file has the thread id, because threads of a batch store entries concurrently
+int Store_Cache_Entry (const struct Code_Cache *const cache, const char *const bytecode, const long max_ip,
+                       const char *const x86_code, const long x86_size, const struct Relocs *const relocs)
+{
+    MY_ASSERT (cache,    "const struct Code_Cache *const cache", NULL_PTR, ERROR);
+    MY_ASSERT (bytecode, "const char *const bytecode",           NULL_PTR, ERROR);
+    MY_ASSERT (x86_code, "const char *const x86_code",           NULL_PTR, ERROR);
+    MY_ASSERT (relocs,   "const struct Relocs *const relocs",    NULL_PTR, ERROR);
+
+    if (mkdir (cache->dir, 0755) != 0 && errno != EEXIST)
+        return ERROR;
+
+    struct Cache_Header header =
+    {
+        .magic         = CACHE_MAGIC,
+        .version       = CACHE_VERSION,
+        .options       = cache->options,
+        .key           = Cache_Key (cache, bytecode, max_ip),
+        .bytecode_size = max_ip,
+        .x86_size      = x86_size,
+        .n_relocs      = relocs->n_relocs,
+        .checksum      = Entry_Checksum (relocs->table, relocs->n_relocs, x86_code, x86_size)
+    };
+
+    char path[PATH_MAX]     = "";
+    char tmp_path[PATH_MAX] = "";
+
+    if (!Entry_Path (path, cache, header.key) ||
+        snprintf (tmp_path, PATH_MAX, "%s.%ld" TMP_SUFFIX, path, (long)syscall (SYS_gettid)) >= PATH_MAX)
+        return ERROR;
+
+    FILE *file = fopen (tmp_path, "wb");
+    if (file == NULL)
+        return ERROR;
+
+    bool written = fwrite (&header, sizeof header, 1, file) == 1;
+
+    if (relocs->n_relocs > 0)
+        written = written && fwrite (relocs->table, sizeof (struct Reloc), relocs->n_relocs, file) == (size_t)relocs->n_relocs;
+
+    written = written && fwrite (x86_code, sizeof (char), x86_size, file) == (size_t)x86_size;
+    written = written && fwrite (bytecode, sizeof (char), max_ip, file) == (size_t)max_ip;
+    written = (fclose (file) == 0) && written;
+
+    if (!written || rename (tmp_path, path) != 0)
+    {
+        unlink (tmp_path);
+        return ERROR;
+    }
+
+    return Evict (cache);
+}
+
+//=====================================================================================//
+
+#undef CACHE_MAGIC
+#undef CACHE_VERSION
+#undef CACHE_SUFFIX
+#undef TMP_SUFFIX
+#undef STALE_TMP_AGE
@@ -0,0 +1,434 @@
+#include "../include/IR.h"
+#include <math.h>
+
+//=====================================================================================//
+//                                 CONSTANT PROPAGATION                                //
+//=====================================================================================//
+
+// Registers are tracked across blocks, the operand stack only inside a block:
+// values pushed by a predecessor are never known.
+
+#define N_REGS (dx + 1)
+
+enum Lattice
+{
+    UNDEF,      // no path reaches this point yet
+    CONST,
+    VARYING
+};
+
+struct Reg_Value
+{
+    enum Lattice state;
+    double num;
+};
+
+struct Regs
+{
+    struct Reg_Value reg[N_REGS];
+};
+
+struct Stack_Value
+{
+    bool   known;
+    double num;
+
+    // instructions [start, end) compute this value and nothing else (start == -1 if they don't)
+    int start;
+    int end;
+};
+
+static inline bool Same_Bits (const double first, const double second)
+{
+    return memcmp (&first, &second, sizeof (double)) == 0;
+}
+
+static bool Meet_Regs (struct Regs *const dest, const struct Regs *const src)
+{
+    bool changed = false;
+
+    for (int reg_i = ax; reg_i < N_REGS; reg_i++)
+    {
+        struct Reg_Value       *to   = dest->reg + reg_i;
+        const struct Reg_Value *from = src->reg  + reg_i;
+
+        if (from->state == UNDEF || to->state == VARYING)
+            continue;
+
+        if (to->state == UNDEF)
+            *to = *from;
+        else if (from->state == VARYING || !Same_Bits (to->num, from->num))
+            to->state = VARYING;
+        else
+            continue;
+
+        changed = true;
+    }
+
+    return changed;
+}
+
+static void Set_Varying (struct Regs *const regs)
+{
+    for (int reg_i = ax; reg_i < N_REGS; reg_i++)
+        regs->reg[reg_i].state = VARYING;
+}
+
+// The result must be the one mulsd & co. give at run time. Operations on NaN are not folded,
+// because the payload of the result depends on the order of operands in the x86 instruction.
+static bool Evaluate (const enum ISA type, const double first, const double second, double *const result)
+{
+    if (isnan (first) || isnan (second))
+        return false;
+
+    switch (type)
+    {
+        case add:
+            *result = first + second;
+            break;
+        case sub:
+            *result = first - second;
+            break;
+        case mul:
+            *result = first * second;
+            break;
+        case dvd:
+            *result = first / second;
+            break;
+        case Sqrt:
+            *result = sqrt (second);
+            break;
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+// Mirrors Jcc_Opcode (): ucomisd compares doubles, NaN takes only jne
+static bool Jcc_Taken (const enum ISA type, const double first, const double second)
+{
+    switch (type)
+    {
+        case jae:
+            return first >= second;
+        case ja:
+            return first > second;
+        case jbe:
+            return first <= second;
+        case jb:
+            return first < second;
+        case je:
+            return !isunordered (first, second) && !islessgreater (first, second);
+        case jne:
+            return isunordered (first, second) || islessgreater (first, second);
+        default:
+            return false;
+    }
+}
+
+static inline void Remove_Instrs (struct IR *const ir, const int start, const int end)
+{
+    for (int instr_i = start; instr_i < end; instr_i++)
+        ir->instrs[instr_i].type = nop;
+}
+
+static inline bool Is_Removable (const struct Stack_Value *const value, const int end)
+{
+    return value->start >= 0 && value->end == end;
+}
+
+// Simulates one block starting from register state in. With rewrite set, replaces constant
+// expressions by push_num and conditional jumps with known outcome by jmp or nothing.
+static int Simulate_Block (struct IR *const ir, const int block_i, struct Regs *const regs,
+                           struct Stack_Value *const stack, const bool rewrite, bool *const changed)
+{
+    MY_ASSERT (ir,    "struct IR *const ir",                  NULL_PTR, ERROR);
+    MY_ASSERT (regs,  "struct Regs *const regs",              NULL_PTR, ERROR);
+    MY_ASSERT (stack, "struct Stack_Value *const stack",      NULL_PTR, ERROR);
+
+    struct IR_Block *block = ir->blocks + block_i;
+    const struct Stack_Value unknown = {false, 0, -1, -1};
+
+    int depth = 0;
+
+    #define POP_() ((depth > 0) ? stack[--depth] : unknown)
+
+    for (int instr_i = block->first; instr_i < block->first + block->n_instrs; instr_i++)
+    {
+        struct IR_Instr *instr = ir->instrs + instr_i;
+
+        switch (instr->type)
+        {
+            case push_num:
+                stack[depth++] = (struct Stack_Value){true, instr->num, instr_i, instr_i + 1};
+                break;
+
+            case push_reg:
+            {
+                const struct Reg_Value *reg = regs->reg + instr->reg;
+                stack[depth++] = (struct Stack_Value){reg->state == CONST, reg->num, instr_i, instr_i + 1};
+                break;
+            }
+
+            case in:
+            case push_ram_num:
+            case push_ram_reg:
+            case push_ram_reg_num:
+                stack[depth++] = unknown;
+                break;
+
+            case pop:
+            {
+                const struct Stack_Value value = POP_();
+
+                // the value is computed just to be thrown away
+                if (rewrite && Is_Removable (&value, instr_i))
+                {
+                    Remove_Instrs (ir, value.start, instr_i + 1);
+                    *changed = true;
+                }
+                break;
+            }
+
+            case out:
+            case pop_ram_num:
+            case pop_ram_reg:
+            case pop_ram_reg_num:
+                POP_();
+                break;
+
+            case pop_reg:
+            {
+                const struct Stack_Value value = POP_();
+                regs->reg[instr->reg] = (struct Reg_Value){(value.known) ? CONST : VARYING, value.num};
+                break;
+            }
+
+            case add:
+            case sub:
+            case mul:
+            case dvd:
+            case Sqrt:
+            {
+                const struct Stack_Value second = POP_();
+                const struct Stack_Value first  = (instr->type == Sqrt) ? second : POP_();
+
+                struct Stack_Value result = unknown;
+
+                if (first.known && second.known && Evaluate (instr->type, first.num, second.num, &result.num))
+                {
+                    result.known = true;
+
+                    const bool removable = (instr->type == Sqrt) ? Is_Removable (&second, instr_i) :
+                                           Is_Removable (&second, instr_i) && Is_Removable (&first, second.start);
+                    if (removable)
+                    {
+                        result.start = first.start;
+                        result.end   = instr_i + 1;
+
+                        if (rewrite)
+                        {
+                            Remove_Instrs (ir, result.start + 1, result.end);
+                            ir->instrs[result.start].type = push_num;
+                            ir->instrs[result.start].num  = result.num;
+                            *changed = true;
+                        }
+                    }
+                }
+
+                stack[depth++] = result;
+                break;
+            }
+
+            case jae:
+            case ja:
+            case jbe:
+            case jb:
+            case je:
+            case jne:
+            {
+                const struct Stack_Value second = POP_();
+                const struct Stack_Value first  = POP_();
+
+                if (!rewrite || !first.known || !second.known ||
+                    !Is_Removable (&second, instr_i) || !Is_Removable (&first, second.start))
+                    break;
+
+                if (Jcc_Taken (instr->type, first.num, second.num))
+                {
+                    ir->instrs[first.start].jump = instr->jump;
+                    Remove_Instrs (ir, first.start, instr_i + 1);
+                    ir->instrs[first.start].type = jmp;
+                    block->fall_through = -1;
+                }
+                else
+                {
+                    Remove_Instrs (ir, first.start, instr_i + 1);
+                    block->branch = -1;
+                }
+
+                *changed = true;
+                break;
+            }
+
+            case hlt:
+            case call:
+            case jmp:
+            case ret:
+            case nop:
+                break;
+
+            default:
+                MY_ASSERT (false, "instr->type", UNEXP_VAL, ERROR);
+                break;
+        }
+    }
+
+    #undef POP_
+
+    return NO_ERRORS;
+}
+
+static int Propagate (struct IR *const ir, struct Regs *const block_regs, bool *const reached,
+                      struct Stack_Value *const stack)
+{
+    MY_ASSERT (ir,         "struct IR *const ir",           NULL_PTR, ERROR);
+    MY_ASSERT (block_regs, "struct Regs *const block_regs", NULL_PTR, ERROR);
+    MY_ASSERT (reached,    "bool *const reached",           NULL_PTR, ERROR);
+
+    Set_Varying (block_regs);   // registers are garbage at the entry point
+    reached[0] = true;
+
+    for (bool changed = true; changed; )
+    {
+        changed = false;
+
+        for (int block_i = 0; block_i < ir->n_blocks; block_i++)
+        {
+            if (!reached[block_i])
+                continue;
+
+            const struct IR_Block *block = ir->blocks + block_i;
+            struct Regs regs = block_regs[block_i];
+
+            Simulate_Block (ir, block_i, &regs, stack, false, NULL);
+
+            if (block->branch >= 0)
+            {
+                changed |= Meet_Regs (block_regs + block->branch, &regs) || !reached[block->branch];
+                reached[block->branch] = true;
+            }
+
+            if (block->fall_through >= 0)
+            {
+                // the callee may change any register before it returns
+                if (block->n_instrs > 0 && ir->instrs[block->first + block->n_instrs - 1].type == call)
+                    Set_Varying (&regs);
+
+                changed |= Meet_Regs (block_regs + block->fall_through, &regs) || !reached[block->fall_through];
+                reached[block->fall_through] = true;
+            }
+        }
+    }
+
+    return NO_ERRORS;
+}
+
+static void Remove_Dead_Blocks (struct IR *const ir, bool *const reached, int *const work_list)
+{
+    memset (reached, 0, ir->n_blocks * sizeof (bool));
+
+    int n_work = 0;
+    work_list[n_work++] = 0;
+    reached[0] = true;
+
+    while (n_work > 0)
+    {
+        const struct IR_Block *block = ir->blocks + work_list[--n_work];
+        const int next[] = {block->fall_through, block->branch};
+
+        for (int next_i = 0; next_i < 2; next_i++)
+        {
+            if (next[next_i] >= 0 && !reached[next[next_i]])
+            {
+                reached[next[next_i]] = true;
+                work_list[n_work++] = next[next_i];
+            }
+        }
+    }
+
+    for (int block_i = 0; block_i < ir->n_blocks; block_i++)
+    {
+        if (reached[block_i])
+            continue;
+
+        struct IR_Block *block = ir->blocks + block_i;
+        Remove_Instrs (ir, block->first, block->first + block->n_instrs);
+
+        block->fall_through = -1;
+        block->branch       = -1;
+    }
+}
+
+//=====================================================================================//
+
+int Fold_Constants (struct IR *const ir)
+{
+    MY_ASSERT (ir, "struct IR *const ir", NULL_PTR, ERROR);
+
+    if (ir->n_blocks == 0)
+        return NO_ERRORS;
+
+    struct Regs *block_regs = (struct Regs *)calloc (ir->n_blocks, sizeof (struct Regs));
+    bool        *reached    = (bool *)calloc (ir->n_blocks, sizeof (bool));
+    int         *work_list  = (int *)calloc (ir->n_blocks, sizeof (int));
+
+    // a block can't push more values than it has instructions
+    struct Stack_Value *stack = (struct Stack_Value *)calloc (ir->n_instrs + 1, sizeof (struct Stack_Value));
+
+    if (block_regs == NULL || reached == NULL || work_list == NULL || stack == NULL)
+    {
+        free (stack);
+        free (work_list);
+        free (reached);
+        free (block_regs);
+        return ERROR;
+    }
+
+    // removing a branch may make registers at its destination constant, so repeat until nothing changes
+    for (bool changed = true; changed; )
+    {
+        changed = false;
+
+        memset (block_regs, 0, ir->n_blocks * sizeof (struct Regs));
+        memset (reached,    0, ir->n_blocks * sizeof (bool));
+
+        Propagate (ir, block_regs, reached, stack);
+
+        for (int block_i = 0; block_i < ir->n_blocks; block_i++)
+        {
+            if (reached[block_i])
+                Simulate_Block (ir, block_i, block_regs + block_i, stack, true, &changed);
+        }
+
+        Remove_Dead_Blocks (ir, reached, work_list);
+
+        #ifdef DEBUG
+        int C_status = Compact_IR (ir);
+        #else
+        Compact_IR (ir);
+        #endif
+
+        MY_ASSERT (C_status != ERROR, "Compact_IR ()", FUNC_ERROR, ERROR);
+    }
+
+    free (stack);
+    free (work_list);
+    free (reached);
+    free (block_regs);
+
+    return NO_ERRORS;
+}
+
+#undef N_REGS
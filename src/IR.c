@@ -0,0 +1,431 @@
+#include "../include/IR.h"
+
+//=====================================================================================//
+//                                      DECODING                                       //
+//=====================================================================================//
+
+struct Instruction
+{
+    int name;
+    int proc_num;
+    int proc_sz;
+};
+
+static const struct Instruction ISA_Consts[N_INSTRUCTIONS] =
+{
+    {hlt,               HLT,  1},
+    {call,             CALL,  5},
+    {jmp,               JMP,  5},
+    {jae,               JAE,  5},
+    {ja,                 JA,  5},
+    {jbe,               JBE,  5},
+    {jb,                 JB,  5},
+    {je,                 JE,  5},
+    {jne,               JNE,  5},
+    {ret,               RET,  1},
+    {in,                 IN,  1},
+    {out,               OUT,  1},
+    {push_num,         PUSH, 12},
+    {push_ram_num,     PUSH,  8},
+    {push_reg,         PUSH,  4},
+    {push_ram_reg,     PUSH,  4},
+    {push_ram_reg_num, PUSH,  8},
+    {pop,               POP,  4},
+    {pop_ram_num,       POP,  8},
+    {pop_reg,           POP,  4},
+    {pop_ram_reg,       POP,  4},
+    {pop_ram_reg_num,   POP,  8},
+    {add,               ADD,  1},
+    {sub,               SUB,  1},
+    {mul,               MUL,  1},
+    {dvd,               DVD,  1},
+    {Sqrt,             SQRT,  1}
+};
+
+// ISA type of every instruction except push and pop
+static const unsigned char Opcode_To_ISA[] =
+{
+    [HLT]  = hlt,
+    [CALL] = call,
+    [JMP]  = jmp,
+    [JAE]  = jae,
+    [JA]   = ja,
+    [JBE]  = jbe,
+    [JB]   = jb,
+    [JE]   = je,
+    [JNE]  = jne,
+    [RET]  = ret,
+    [IN]   = in,
+    [OUT]  = out,
+    [ADD]  = add,
+    [SUB]  = sub,
+    [MUL]  = mul,
+    [DVD]  = dvd,
+    [SQRT] = Sqrt
+};
+
+// Bytecode comes from outside, so every check here is made in release builds too: an instruction that
+// doesn't fit in the bytecode or has an unknown form is an error, and nothing past max_ip is read.
+static int Decode_Push_Pop (const char *const proc_buff, const int ip, const int max_ip, struct IR_Instr *const instr)
+{
+    MY_ASSERT (proc_buff, "const char *const proc_buff",    NULL_PTR, ERROR);
+    MY_ASSERT (instr,     "struct IR_Instr *const instr",   NULL_PTR, ERROR);
+
+    // the opcode and the three bytes of the form, which every push and pop has
+    if (ip + ISA_Consts[pop].proc_sz > max_ip)
+        return ERROR;
+
+    const bool is_push = (proc_buff[ip] == PUSH);
+
+    const unsigned char has_ram = proc_buff[ip + 1];
+    const unsigned char reg     = proc_buff[ip + 2];
+    const unsigned char has_num = proc_buff[ip + 3];
+
+    if (has_ram > 1 || reg > dx || has_num > 1)
+        return ERROR;
+
+    const int checksum = has_ram + 10 * reg + 100 * has_num;
+
+    instr->reg = reg;
+
+    switch (checksum)
+    {
+        case EMPTY:
+            instr->type = pop;
+            break;
+
+        case NUM:
+            if (!is_push)
+                return ERROR;
+
+            instr->type = push_num;
+            break;
+
+        case RAM_NUM:
+            instr->type = (is_push) ? push_ram_num : pop_ram_num;
+            break;
+
+        case AX:
+        case BX:
+        case CX:
+        case DX:
+            instr->type = (is_push) ? push_reg : pop_reg;
+            break;
+
+        case RAM_AX:
+        case RAM_BX:
+        case RAM_CX:
+        case RAM_DX:
+            instr->type = (is_push) ? push_ram_reg : pop_ram_reg;
+            break;
+
+        case RAM_AX_NUM:
+        case RAM_BX_NUM:
+        case RAM_CX_NUM:
+        case RAM_DX_NUM:
+            instr->type = (is_push) ? push_ram_reg_num : pop_ram_reg_num;
+            break;
+
+        default:    // RAM without an address
+            return ERROR;
+    }
+
+    if (ip + ISA_Consts[instr->type].proc_sz > max_ip)
+        return ERROR;
+
+    if (instr->type == push_num)
+        instr->num = *(double *)(proc_buff + ip + 1 + 3);
+    else if (has_num)
+        instr->disp = *(int *)(proc_buff + ip + 1 + 3);
+
+    return NO_ERRORS;
+}
+
+// doubles capacity of the array if n_elems elements fill it; returns NULL on failure
+static void *Grow_Array (void *const array, const int n_elems, int *const capacity, const size_t elem_size)
+{
+    if (n_elems < *capacity)
+        return array;
+
+    const int new_capacity = (*capacity) ? 2 * (*capacity) : 64;
+
+    void *new_array = realloc (array, new_capacity * elem_size);
+    if (new_array)
+        *capacity = new_capacity;
+
+    return new_array;
+}
+
+static int Decode (const char *const proc_buff, const int max_ip, struct IR *const ir)
+{
+    MY_ASSERT (proc_buff, "const char *const proc_buff", NULL_PTR, ERROR);
+    MY_ASSERT (ir,        "struct IR *const ir",         NULL_PTR, ERROR);
+
+    int instr_i = 0;
+    int jump_i  = 0;
+
+    int instrs_capacity = 0;
+    int jumps_capacity  = 0;
+
+    for (int ip = 0; ip < max_ip; instr_i++)
+    {
+        // the arrays are freed by Free_IR () if they can't grow
+        struct IR_Instr *instrs = (struct IR_Instr *)Grow_Array (ir->instrs, instr_i, &instrs_capacity,
+                                                                 sizeof (struct IR_Instr));
+        if (instrs == NULL)
+            return ERROR;
+
+        ir->instrs = instrs;
+
+        struct Jump *jumps = (struct Jump *)Grow_Array (ir->jumps, jump_i, &jumps_capacity, sizeof (struct Jump));
+        if (jumps == NULL)
+            return ERROR;
+
+        ir->jumps = jumps;
+
+        const unsigned char code = proc_buff[ip];
+        struct IR_Instr *instr = ir->instrs + instr_i;
+
+        *instr = (struct IR_Instr){};
+        instr->ip = ip;
+
+        switch (code)
+        {
+            case PUSH:
+            case POP:
+                if (Decode_Push_Pop (proc_buff, ip, max_ip, instr) == ERROR)
+                    return ERROR;
+                break;
+
+            case CALL:
+            case JMP:
+            case JAE:
+            case JA:
+            case JBE:
+            case JB:
+            case JE:
+            case JNE:
+                instr->type = Opcode_To_ISA[code];
+
+                if (ip + ISA_Consts[instr->type].proc_sz > max_ip)
+                    return ERROR;
+
+                instr->jump.to = *(int *)(proc_buff + ip + 1);
+
+                ir->jumps[jump_i].from = instr_i;
+                ir->jumps[jump_i].to   = instr->jump.to;
+                ir->jumps[jump_i].type = code;
+                jump_i++;
+
+                break;
+
+            case HLT:
+            case RET:
+            case IN:
+            case OUT:
+            case ADD:
+            case SUB:
+            case MUL:
+            case DVD:
+            case SQRT:
+                instr->type = Opcode_To_ISA[code];
+                break;
+
+            default:
+                return ERROR;
+        }
+
+        ip += ISA_Consts[instr->type].proc_sz;
+    }
+
+    ir->n_instrs = instr_i;
+    ir->instrs   = (struct IR_Instr *)realloc (ir->instrs, instr_i * sizeof (struct IR_Instr));
+
+    ir->n_jumps = jump_i;
+    if (jump_i > 0)
+        ir->jumps = (struct Jump *)realloc (ir->jumps, jump_i * sizeof (struct Jump));
+    else
+    {
+        free (ir->jumps);
+        ir->jumps = NULL;
+    }
+
+    return NO_ERRORS;
+}
+
+//=====================================================================================//
+
+//=====================================================================================//
+//                                  CONTROL FLOW GRAPH                                 //
+//=====================================================================================//
+
+static inline bool Is_Terminator (const int type)
+{
+    return (hlt <= type && type <= ret);    // hlt, call, jmp, jcc and ret
+}
+
+// returns index of the instruction that begins at ip or -1
+static int Find_Instr (const struct IR *const ir, const int ip)
+{
+    int left  = 0;
+    int right = ir->n_instrs - 1;
+
+    while (left <= right)
+    {
+        const int middle = (left + right) / 2;
+
+        if (ir->instrs[middle].ip == ip)
+            return middle;
+        else if (ir->instrs[middle].ip < ip)
+            left = middle + 1;
+        else
+            right = middle - 1;
+    }
+
+    return -1;
+}
+
+static int Build_CFG (struct IR *const ir)
+{
+    MY_ASSERT (ir, "struct IR *const ir", NULL_PTR, ERROR);
+
+    const int n_instrs = ir->n_instrs;
+
+    // block_of[instr_i] is the index of the block beginning at instr_i or -1
+    int *block_of = (int *)calloc (n_instrs + 1, sizeof (int));
+    if (block_of == NULL)
+        return ERROR;
+
+    block_of[0] = 1;
+
+    for (int instr_i = 0; instr_i < n_instrs; instr_i++)
+    {
+        if (Is_Terminator (ir->instrs[instr_i].type))
+            block_of[instr_i + 1] = 1;
+    }
+
+    for (int jump_i = 0; jump_i < ir->n_jumps; jump_i++)
+    {
+        // a jump out of the bytecode or into the middle of an instruction
+        const int to = Find_Instr (ir, ir->jumps[jump_i].to);
+        if (to < 0)
+        {
+            free (block_of);
+            return ERROR;
+        }
+
+        block_of[to] = 1;
+        ir->instrs[ir->jumps[jump_i].from].jump.block = to;   // instruction index for now
+    }
+
+    int n_blocks = 0;
+    for (int instr_i = 0; instr_i < n_instrs; instr_i++)
+        block_of[instr_i] = (block_of[instr_i]) ? n_blocks++ : -1;
+
+    ir->blocks = (struct IR_Block *)calloc (n_blocks, sizeof (struct IR_Block));
+    if (ir->blocks == NULL)
+    {
+        free (block_of);
+        return ERROR;
+    }
+
+    ir->n_blocks = n_blocks;
+
+    for (int instr_i = 0, block_i = -1; instr_i < n_instrs; instr_i++)
+    {
+        if (block_of[instr_i] >= 0)
+        {
+            block_i = block_of[instr_i];
+            ir->blocks[block_i].first = instr_i;
+        }
+
+        ir->blocks[block_i].n_instrs++;
+    }
+
+    for (int block_i = 0; block_i < n_blocks; block_i++)
+    {
+        struct IR_Block *block = ir->blocks + block_i;
+        struct IR_Instr *last  = ir->instrs + block->first + block->n_instrs - 1;
+
+        const bool has_next = (block_i + 1 < n_blocks);
+
+        block->fall_through = -1;
+        block->branch       = -1;
+
+        if (last->type == call || last->type == jmp || Is_Jcc (last->type))
+        {
+            last->jump.block = block_of[last->jump.block];
+            block->branch    = last->jump.block;
+        }
+
+        if (has_next && last->type != jmp && last->type != ret && last->type != hlt)
+            block->fall_through = block_i + 1;
+    }
+
+    free (block_of);
+
+    return NO_ERRORS;
+}
+
+//=====================================================================================//
+
+int Build_IR (const char *const proc_buff, const long max_ip, struct IR *const ir)
+{
+    MY_ASSERT (proc_buff, "const char *const proc_buff", NULL_PTR, ERROR);
+    MY_ASSERT (ir,        "struct IR *const ir",         NULL_PTR, ERROR);
+
+    // invalid bytecode is reported in release builds too
+    if (Decode (proc_buff, max_ip, ir) == ERROR)
+        return ERROR;
+
+    return Build_CFG (ir);
+}
+
+// drops nop instructions left by optimization passes; blocks keep their indices and may become empty
+int Compact_IR (struct IR *const ir)
+{
+    MY_ASSERT (ir, "struct IR *const ir", NULL_PTR, ERROR);
+
+    int n_instrs = 0;
+    int n_jumps  = 0;
+
+    for (int block_i = 0; block_i < ir->n_blocks; block_i++)
+    {
+        struct IR_Block *block = ir->blocks + block_i;
+        const int first = n_instrs;
+
+        for (int instr_i = block->first; instr_i < block->first + block->n_instrs; instr_i++)
+        {
+            if (ir->instrs[instr_i].type == nop)
+                continue;
+
+            ir->instrs[n_instrs] = ir->instrs[instr_i];
+
+            if (ir->instrs[n_instrs].type == call || ir->instrs[n_instrs].type == jmp ||
+                Is_Jcc (ir->instrs[n_instrs].type))
+            {
+                ir->jumps[n_jumps].from = n_instrs;
+                ir->jumps[n_jumps].to   = ir->instrs[n_instrs].jump.to;
+                ir->jumps[n_jumps].type = ISA_Consts[ir->instrs[n_instrs].type].proc_num;
+                n_jumps++;
+            }
+
+            n_instrs++;
+        }
+
+        block->first    = first;
+        block->n_instrs = n_instrs - first;
+    }
+
+    ir->n_instrs = n_instrs;
+    ir->n_jumps  = n_jumps;
+
+    return NO_ERRORS;
+}
+
+void Free_IR (struct IR *const ir)
+{
+    free (ir->instrs);
+    free (ir->jumps);
+    free (ir->blocks);
+}
@@ -0,0 +1,311 @@
+#include "../include/IR.h"
+
+//=====================================================================================//
+//                                      INLINING                                       //
+//=====================================================================================//
+
+// A leaf procedure is every block reachable from a call target by jumps and fall-throughs, as long as none of
+// them calls anything or has hlt (which is a ret of the native code inside a procedure). A copy of it goes
+// right after the block of each call: the call becomes a fall-through (or a jmp) to the copy of the entry,
+// every ret becomes a jmp to the block after the call, and the last ret of the copy falls through there.
+// The IR is rebuilt in the new order, so that the blocks of every copy are emitted together.
+
+#define NOT_LEAF    (-1)
+#define NOT_CALLED  (-2)
+
+struct Inliner
+{
+    int *proc;              // blocks of a procedure in bytecode order
+    int  n_proc;
+    bool *in_proc;
+
+    int *size;              // instructions of the procedure of every block (NOT_LEAF - it isn't inlined, NOT_CALLED)
+    int *new_index;         // index of every block in the new IR
+    int *copy_index;        // index of the copy of every block of the procedure being copied
+};
+
+static inline const struct IR_Instr *Last_Instr (const struct IR *const ir, const int block_i)
+{
+    const struct IR_Block *const block = ir->blocks + block_i;
+
+    return (block->n_instrs > 0) ? ir->instrs + block->first + block->n_instrs - 1 : NULL;
+}
+
+static int Compare_Blocks (const void *const first, const void *const second)
+{
+    return *(const int *)first - *(const int *)second;
+}
+
+// collects the procedure of the entry block, returns its size in instructions or NOT_LEAF
+static int Collect_Proc (const struct IR *const ir, struct Inliner *const inliner, const int entry)
+{
+    inliner->proc[0]        = entry;
+    inliner->n_proc         = 1;
+    inliner->in_proc[entry] = true;
+
+    int size = 0;
+
+    for (int proc_i = 0; proc_i < inliner->n_proc; proc_i++)
+    {
+        const struct IR_Block *const block = ir->blocks + inliner->proc[proc_i];
+        const struct IR_Instr *const last  = Last_Instr (ir, inliner->proc[proc_i]);
+
+        for (int instr_i = block->first; instr_i < block->first + block->n_instrs; instr_i++)
+        {
+            if (ir->instrs[instr_i].type == call || ir->instrs[instr_i].type == hlt)
+                size = NOT_LEAF;
+            else if (size != NOT_LEAF && ir->instrs[instr_i].type != nop)
+                size++;
+        }
+
+        const int next[] = {block->fall_through, (last && last->type != ret) ? block->branch : -1};
+
+        for (int next_i = 0; next_i < (int)(sizeof next / sizeof next[0]); next_i++)
+        {
+            if (next[next_i] < 0 || inliner->in_proc[next[next_i]])
+                continue;
+
+            inliner->proc[inliner->n_proc++] = next[next_i];
+            inliner->in_proc[next[next_i]]   = true;
+        }
+    }
+
+    for (int proc_i = 0; proc_i < inliner->n_proc; proc_i++)
+        inliner->in_proc[inliner->proc[proc_i]] = false;
+
+    qsort (inliner->proc, inliner->n_proc, sizeof (int), Compare_Blocks);
+
+    return size;
+}
+
+// the call of the block is replaced by its procedure and the block after it gets the returns
+static inline bool Is_Inlined (const struct IR *const ir, const struct Inliner *const inliner, const int block_i)
+{
+    const struct IR_Instr *const last = Last_Instr (ir, block_i);
+
+    return last && last->type == call && ir->blocks[block_i].fall_through >= 0 &&
+           inliner->size[last->jump.block] >= 0;
+}
+
+// call X; ret: the procedure returns straight to the caller
+static void Put_Tail_Jumps (struct IR *const ir, const struct Inliner *const inliner)
+{
+    for (int block_i = 0; block_i < ir->n_blocks; block_i++)
+    {
+        struct IR_Block *const block = ir->blocks + block_i;
+        struct IR_Instr *const last  = (struct IR_Instr *)Last_Instr (ir, block_i);
+
+        if (last == NULL || last->type != call || block->fall_through < 0 || Is_Inlined (ir, inliner, block_i))
+            continue;
+
+        const struct IR_Instr *const next = Last_Instr (ir, block->fall_through);
+
+        if (next && ir->blocks[block->fall_through].n_instrs == 1 && next->type == ret)
+        {
+            last->type          = jmp;
+            block->fall_through = -1;
+        }
+    }
+}
+
+static inline int Block_Ip (const struct IR *const ir, const int block_i)
+{
+    return ir->instrs[ir->blocks[block_i].first].ip;
+}
+
+static inline void Set_Jump (struct IR_Instr *const instr, const enum ISA type, const struct IR *const ir,
+                             const int block_i, const int new_block_i)
+{
+    instr->type       = type;
+    instr->jump.to    = Block_Ip (ir, block_i);
+    instr->jump.block = new_block_i;
+}
+
+// the copy of the procedure follows the block of the call at new_block_i
+static void Copy_Proc (const struct IR *const ir, struct Inliner *const inliner, const int call_block,
+                       struct IR_Block *const new_blocks, struct IR_Instr *const new_instrs, int *const n_new_instrs)
+{
+    const int entry = Last_Instr (ir, call_block)->jump.block;
+    const int after = ir->blocks[call_block].fall_through;
+
+    Collect_Proc (ir, inliner, entry);
+
+    const int first_copy = inliner->new_index[call_block] + 1;
+
+    for (int proc_i = 0; proc_i < inliner->n_proc; proc_i++)
+        inliner->copy_index[inliner->proc[proc_i]] = first_copy + proc_i;
+
+    // the call itself goes to the copy of the entry
+    struct IR_Instr *const call_instr = new_instrs + new_blocks[first_copy - 1].first +
+                                        new_blocks[first_copy - 1].n_instrs - 1;
+
+    new_blocks[first_copy - 1].branch       = -1;
+    new_blocks[first_copy - 1].fall_through = -1;
+
+    if (inliner->proc[0] == entry)
+    {
+        call_instr->type = nop;
+        new_blocks[first_copy - 1].fall_through = first_copy;
+    }
+    else
+    {
+        Set_Jump (call_instr, jmp, ir, entry, inliner->copy_index[entry]);
+        new_blocks[first_copy - 1].branch = inliner->copy_index[entry];
+    }
+
+    for (int proc_i = 0; proc_i < inliner->n_proc; proc_i++)
+    {
+        const int block_i = inliner->proc[proc_i];
+        const struct IR_Block *const block = ir->blocks + block_i;
+        struct IR_Block *const copy = new_blocks + first_copy + proc_i;
+
+        copy->first        = *n_new_instrs;
+        copy->n_instrs     = block->n_instrs;
+        copy->fall_through = (block->fall_through >= 0) ? inliner->copy_index[block->fall_through] : -1;
+        copy->branch       = (block->branch >= 0) ? inliner->copy_index[block->branch] : -1;
+
+        memcpy (new_instrs + copy->first, ir->instrs + block->first, block->n_instrs * sizeof (struct IR_Instr));
+        *n_new_instrs += block->n_instrs;
+
+        struct IR_Instr *const last = new_instrs + copy->first + copy->n_instrs - 1;
+
+        if (last->type == jmp || Is_Jcc (last->type))
+            last->jump.block = copy->branch;
+        else if (last->type == ret && proc_i == inliner->n_proc - 1)
+        {
+            last->type         = nop;
+            copy->fall_through = inliner->new_index[after];
+        }
+        else if (last->type == ret)
+        {
+            Set_Jump (last, jmp, ir, after, inliner->new_index[after]);
+            copy->branch = inliner->new_index[after];
+        }
+    }
+}
+
+// the blocks of the IR in the new order, with copies of procedures after the calls
+static int Rebuild_IR (struct IR *const ir, struct Inliner *const inliner)
+{
+    int n_new_blocks = 0;
+    int n_new_instrs = ir->n_instrs;
+
+    for (int block_i = 0; block_i < ir->n_blocks; block_i++)
+    {
+        inliner->new_index[block_i] = n_new_blocks++;
+
+        if (Is_Inlined (ir, inliner, block_i))
+        {
+            const int entry = Last_Instr (ir, block_i)->jump.block;
+
+            Collect_Proc (ir, inliner, entry);
+
+            n_new_blocks += inliner->n_proc;
+
+            for (int proc_i = 0; proc_i < inliner->n_proc; proc_i++)
+                n_new_instrs += ir->blocks[inliner->proc[proc_i]].n_instrs;
+        }
+    }
+
+    if (n_new_blocks == ir->n_blocks)
+        return NO_ERRORS;
+
+    struct IR_Block *new_blocks = (struct IR_Block *)calloc (n_new_blocks + 1, sizeof (struct IR_Block));
+    struct IR_Instr *new_instrs = (struct IR_Instr *)calloc (n_new_instrs + 1, sizeof (struct IR_Instr));
+    struct Jump     *new_jumps  = (struct Jump *)calloc (n_new_instrs + 1, sizeof (struct Jump));
+
+    if (new_blocks == NULL || new_instrs == NULL || new_jumps == NULL)
+    {
+        free (new_blocks);
+        free (new_instrs);
+        free (new_jumps);
+        return ERROR;
+    }
+
+    n_new_instrs = 0;
+
+    for (int block_i = 0; block_i < ir->n_blocks; block_i++)
+    {
+        const struct IR_Block *const block = ir->blocks + block_i;
+        struct IR_Block *const new_block = new_blocks + inliner->new_index[block_i];
+
+        new_block->first        = n_new_instrs;
+        new_block->n_instrs     = block->n_instrs;
+        new_block->fall_through = (block->fall_through >= 0) ? inliner->new_index[block->fall_through] : -1;
+        new_block->branch       = (block->branch >= 0) ? inliner->new_index[block->branch] : -1;
+
+        memcpy (new_instrs + n_new_instrs, ir->instrs + block->first, block->n_instrs * sizeof (struct IR_Instr));
+        n_new_instrs += block->n_instrs;
+
+        const struct IR_Instr *const last = Last_Instr (ir, block_i);
+
+        if (last && (last->type == call || last->type == jmp || Is_Jcc (last->type)))
+            new_instrs[n_new_instrs - 1].jump.block = new_block->branch;
+
+        if (Is_Inlined (ir, inliner, block_i))
+            Copy_Proc (ir, inliner, block_i, new_blocks, new_instrs, &n_new_instrs);
+    }
+
+    free (ir->blocks);
+    free (ir->instrs);
+    free (ir->jumps);
+
+    ir->blocks   = new_blocks;
+    ir->n_blocks = n_new_blocks;
+    ir->instrs   = new_instrs;
+    ir->n_instrs = n_new_instrs;
+    ir->jumps    = new_jumps;
+
+    // drops the nops of calls and returns and lists the jumps again
+    return Compact_IR (ir);
+}
+
+int Inline_Procedures (struct IR *const ir, const int budget)
+{
+    MY_ASSERT (ir, "struct IR *const ir", NULL_PTR, ERROR);
+
+    struct Inliner inliner =
+    {
+        .proc       = (int *)calloc (ir->n_blocks + 1, sizeof (int)),
+        .in_proc    = (bool *)calloc (ir->n_blocks + 1, sizeof (bool)),
+        .size       = (int *)calloc (ir->n_blocks + 1, sizeof (int)),
+        .new_index  = (int *)calloc (ir->n_blocks + 1, sizeof (int)),
+        .copy_index = (int *)calloc (ir->n_blocks + 1, sizeof (int))
+    };
+
+    int ret_val = ERROR;
+
+    if (inliner.proc && inliner.in_proc && inliner.size && inliner.new_index && inliner.copy_index)
+    {
+        for (int block_i = 0; block_i < ir->n_blocks; block_i++)
+            inliner.size[block_i] = NOT_CALLED;
+
+        for (int jump_i = 0; jump_i < ir->n_jumps; jump_i++)
+        {
+            const struct IR_Instr *const instr = ir->instrs + ir->jumps[jump_i].from;
+
+            if (instr->type != call || inliner.size[instr->jump.block] != NOT_CALLED)
+                continue;
+
+            const int size = Collect_Proc (ir, &inliner, instr->jump.block);
+
+            inliner.size[instr->jump.block] = (size <= budget) ? size : NOT_LEAF;
+        }
+
+        Put_Tail_Jumps (ir, &inliner);
+        ret_val = Rebuild_IR (ir, &inliner);
+    }
+
+    free (inliner.proc);
+    free (inliner.in_proc);
+    free (inliner.size);
+    free (inliner.new_index);
+    free (inliner.copy_index);
+
+    return ret_val;
+}
+
+#undef NOT_LEAF
+#undef NOT_CALLED
+
+//=====================================================================================//
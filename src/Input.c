@@ -0,0 +1,334 @@
+#include "../include/Input.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INPUT_CAPACITY (64L << 10)
+
+//=====================================================================================//
+//                                       SOURCE                                        //
+//=====================================================================================//
+
+// A file is mapped if it's regular and, for text, if its size isn't a multiple of the page size:
+// then the rest of the last page is zero and every token is followed by '\0' or a separator.
+static bool Map_File (struct Input *const input)
+{
+    struct stat file_stat = {};
+
+    if (fstat (input->fd, &file_stat) != 0 || !S_ISREG (file_stat.st_mode) || file_stat.st_size == 0)
+        return false;
+
+    if (!input->binary && file_stat.st_size % sysconf (_SC_PAGESIZE) == 0)
+        return false;
+
+    const off_t offset = lseek (input->fd, 0, SEEK_CUR);    // stdin may be read partially
+    if (offset < 0 || offset > file_stat.st_size)
+        return false;
+
+    char *map = (char *)mmap (NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, input->fd, 0);
+    if (map == MAP_FAILED)
+        return false;
+
+    input->buffer   = map;
+    input->pos      = offset;
+    input->start    = offset;
+    input->size     = file_stat.st_size;
+    input->capacity = file_stat.st_size;
+    input->mapped   = true;
+    input->eof      = true;
+
+    return true;
+}
+
+// file_name == NULL: stdin
+int Input_Open (struct Input *const input, const char *const file_name, const bool binary)
+{
+    MY_ASSERT (input, "struct Input *const input", NULL_PTR, ERROR);
+
+    *input = (struct Input){};
+
+    input->binary  = binary;
+    input->is_file = (file_name != NULL);
+    input->fd      = (file_name) ? open (file_name, O_RDONLY) : STDIN_FILENO;
+
+    if (input->fd < 0)
+        return ERROR;
+
+    input->prompt = !binary && !input->is_file && isatty (input->fd);
+
+    if (Map_File (input))
+        return NO_ERRORS;
+
+    input->buffer = (char *)calloc (INPUT_CAPACITY + 1, sizeof (char));    // + '\0'
+    MY_ASSERT (input->buffer, "input->buffer", NE_MEM, ERROR);
+
+    input->capacity = INPUT_CAPACITY;
+
+    return NO_ERRORS;
+}
+
+void Input_Close (struct Input *const input)
+{
+    if (input->mapped)
+        munmap (input->buffer, input->capacity);
+    else
+        free (input->buffer);
+
+    if (input->is_file && input->fd >= 0)
+        close (input->fd);
+
+    *input = (struct Input){};
+}
+
+// moves the unread data to the beginning of the buffer and reads as much as fits after it
+static void Refill (struct Input *const input)
+{
+    if (input->eof)
+        return;
+
+    memmove (input->buffer, input->buffer + input->pos, input->size - input->pos);
+    input->size -= input->pos;
+    input->pos   = 0;
+
+    // one read () is enough for a terminal or a pipe: it returns what is there now
+    ssize_t n_bytes = 0;
+    do
+        n_bytes = read (input->fd, input->buffer + input->size, input->capacity - input->size);
+    while (n_bytes < 0 && errno == EINTR);
+
+    if (n_bytes <= 0)
+        input->eof = true;
+    else
+        input->size += n_bytes;
+
+    input->buffer[input->size] = '\0';
+}
+
+//=====================================================================================//
+
+//=====================================================================================//
+//                                       PARSING                                       //
+//=====================================================================================//
+
+#define MAX_EXACT_POW10 22          // 10^22 = 5^22 * 2^22, 5^22 < 2^53: the largest power of 10 that is exact
+#define MAX_MANTISSA    (1ULL << 53)
+#define MAX_DIGITS      19          // significant digits that surely fit in uint64_t
+
+static const double Pow10[MAX_EXACT_POW10 + 1] =
+{
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool Is_Digit (const char symbol)
+{
+    return '0' <= symbol && symbol <= '9';
+}
+
+static inline bool Is_Space (const char symbol)
+{
+    return symbol == ' ' || ('\t' <= symbol && symbol <= '\r');
+}
+
+static const char *Read_Digits (const char *str, uint64_t *const mantissa, int *const n_significant)
+{
+    for ( ; Is_Digit (*str); str++)
+    {
+        *mantissa = *mantissa * 10 + (*str - '0');  // wraps after MAX_DIGITS, such numbers go to strtod ()
+
+        if (*mantissa)
+            (*n_significant)++;
+    }
+
+    return str;
+}
+
+// Reads a number like scanf ("%lf") and returns the end of it (str if there is none). Decimal numbers
+// with a mantissa below 2^53 and a power of 10 that is a double exactly are m * 10^e or m / 10^e: one
+// correctly rounded operation (Clinger's fast path). Anything else (inf, nan, hex, long mantissas,
+// large exponents) is left to strtod (), which stops at the separator or '\0' after the number.
+const char *Parse_Double (const char *const str, double *const number)
+{
+    const char *cur = str;
+
+    const bool negative = (*cur == '-');
+    if (*cur == '-' || *cur == '+')
+        cur++;
+
+    const bool hex = (cur[0] == '0' && (cur[1] == 'x' || cur[1] == 'X'));
+
+    if (hex || !(Is_Digit (*cur) || (*cur == '.' && Is_Digit (cur[1]))))
+    {
+        char *end = NULL;
+        *number = strtod (str, &end);
+
+        return end;
+    }
+
+    uint64_t mantissa = 0;
+    int n_significant = 0;
+
+    cur = Read_Digits (cur, &mantissa, &n_significant);
+
+    int exp10 = 0;
+
+    if (*cur == '.')
+    {
+        const char *const frac = cur + 1;
+
+        cur = Read_Digits (frac, &mantissa, &n_significant);
+        exp10 -= cur - frac;
+    }
+
+    if (*cur == 'e' || *cur == 'E')
+    {
+        const char *exp_str = cur + 1;
+
+        const bool exp_negative = (*exp_str == '-');
+        if (*exp_str == '-' || *exp_str == '+')
+            exp_str++;
+
+        if (Is_Digit (*exp_str))        // otherwise 'e' is not a part of the number
+        {
+            int exponent = 0;
+            for ( ; Is_Digit (*exp_str); exp_str++)
+                if (exponent < 100000)
+                    exponent = exponent * 10 + (*exp_str - '0');
+
+            exp10 += (exp_negative) ? -exponent : exponent;
+            cur = exp_str;
+        }
+    }
+
+    if (n_significant > MAX_DIGITS || mantissa > MAX_MANTISSA)
+    {
+        char *end = NULL;
+        *number = strtod (str, &end);
+
+        return end;
+    }
+
+    // 12e25 = 12000e22: the mantissa grows while it stays exact
+    for ( ; exp10 > MAX_EXACT_POW10 && mantissa && mantissa * 10 <= MAX_MANTISSA; exp10--)
+        mantissa *= 10;
+
+    double value = (double)mantissa;    // exact
+
+    if (0 < exp10 && exp10 <= MAX_EXACT_POW10)
+        value *= Pow10[exp10];
+    else if (-MAX_EXACT_POW10 <= exp10 && exp10 < 0)
+        value /= Pow10[-exp10];
+    else if (exp10 != 0 && mantissa != 0)
+    {
+        char *end = NULL;
+        *number = strtod (str, &end);
+
+        return end;
+    }
+
+    *number = (negative) ? -value : value;
+
+    return cur;
+}
+
+#undef MAX_EXACT_POW10
+#undef MAX_MANTISSA
+#undef MAX_DIGITS
+
+//=====================================================================================//
+
+//=====================================================================================//
+//                                       NUMBERS                                       //
+//=====================================================================================//
+
+// at least n_bytes are in the buffer after pos unless the input is over
+static inline bool Have_Bytes (struct Input *const input, const size_t n_bytes)
+{
+    if (input->size - input->pos < n_bytes)
+        Refill (input);
+
+    return input->size - input->pos >= n_bytes;
+}
+
+static double Read_Binary (struct Input *const input)
+{
+    double number = NAN;
+
+    if (Have_Bytes (input, sizeof number))
+    {
+        memcpy (&number, input->buffer + input->pos, sizeof number);
+        input->pos += sizeof number;
+    }
+
+    return number;
+}
+
+// the token at pos is in the buffer up to a separator or the end of the input
+static void Read_Token (struct Input *const input)
+{
+    size_t token_i = input->pos;
+
+    for (;;)
+    {
+        for ( ; token_i < input->size; token_i++)
+            if (Is_Space (input->buffer[token_i]))
+                return;
+
+        if (input->eof || (input->pos == 0 && input->size == input->capacity))
+            return;     // end of input or a token longer than the buffer
+
+        token_i -= input->pos;
+        Refill (input);
+    }
+}
+
+// NaN at the end of the input; a token that isn't a number is skipped and is NaN too
+static double Read_Text (struct Input *const input)
+{
+    for (;;)
+    {
+        if (!Have_Bytes (input, 1))
+            return NAN;
+
+        if (!Is_Space (input->buffer[input->pos]))
+            break;
+
+        input->pos++;
+    }
+
+    Read_Token (input);
+
+    const char *const start = input->buffer + input->pos;
+
+    double number = NAN;
+    const char *end = Parse_Double (start, &number);
+
+    if (end == start)
+    {
+        number = NAN;
+        for (end = start; end < input->buffer + input->size && !Is_Space (*end); end++)
+            ;
+    }
+
+    input->pos = end - input->buffer;
+
+    return number;
+}
+
+double Input_Number (struct Input *const input)
+{
+    return (input->binary) ? Read_Binary (input) : Read_Text (input);
+}
+
+// every run of a benchmark reads the same numbers if the input is mapped; a stream can't go back
+void Input_Rewind (struct Input *const input)
+{
+    if (input->mapped)
+        input->pos = input->start;
+}
+
+//=====================================================================================//
+
+#undef INPUT_CAPACITY
@@ -0,0 +1,392 @@
+#include "../include/Interpreter.h"
+#include <math.h>
+#include <limits.h>
+#include <emmintrin.h>
+
+#define THR_BLOCK    nop            // the counter at the start of a block: nop is never threaded
+#define N_HANDLERS   (nop + 1)
+
+#define VALUES_SIZE  (8L << 20)     // like the stack of the main thread, which the native code uses
+#define FRAMES_SIZE  (16L << 20)
+#define GUARD_SIZE   4096L
+
+//=====================================================================================//
+//                                   THREADED CODE                                     //
+//=====================================================================================//
+
+static inline bool Falls_Elsewhere (const struct IR *const ir, const int block_i)
+{
+    const int fall_through = ir->blocks[block_i].fall_through;
+
+    return fall_through >= 0 && fall_through != block_i + 1;
+}
+
+// the counter of every block, its instructions without nops and a jmp where the next block isn't the one
+// it falls through to; hlt after everything stops a program that runs past its end
+int Thread_IR (const struct IR *const ir, const int threshold, struct Threaded_Code *const code)
+{
+    MY_ASSERT (ir,   "const struct IR *const ir",          NULL_PTR, ERROR);
+    MY_ASSERT (code, "struct Threaded_Code *const code", NULL_PTR, ERROR);
+
+    const void *const *const handlers = Interpret (NULL, NULL);
+
+    code->n_blocks    = ir->n_blocks;
+    code->threshold   = threshold;
+    code->block_start = (int *)calloc (ir->n_blocks + 1, sizeof (int));
+    code->counters    = (_Atomic int *)calloc (ir->n_blocks + 1, sizeof (_Atomic int));
+    code->native      = (_Atomic (const void *) *)calloc (ir->n_blocks + 1, sizeof (_Atomic (const void *)));
+    if (code->block_start == NULL || code->counters == NULL || code->native == NULL)
+        return ERROR;           // Free_Threaded_Code () frees the rest
+
+    int n_instrs = 0;
+
+    for (int block_i = 0; block_i < ir->n_blocks; block_i++)
+    {
+        const struct IR_Block *const block = ir->blocks + block_i;
+
+        code->block_start[block_i] = n_instrs++;
+
+        for (int instr_i = block->first; instr_i < block->first + block->n_instrs; instr_i++)
+            n_instrs += (ir->instrs[instr_i].type != nop);
+
+        n_instrs += Falls_Elsewhere (ir, block_i);
+    }
+
+    code->n_instrs = n_instrs + 1;
+    code->instrs   = (struct Thr_Instr *)calloc (code->n_instrs, sizeof (struct Thr_Instr));
+    if (code->instrs == NULL)
+        return ERROR;
+
+    struct Thr_Instr *thr_instr = code->instrs;
+
+    for (int block_i = 0; block_i < ir->n_blocks; block_i++)
+    {
+        const struct IR_Block *const block = ir->blocks + block_i;
+
+        *thr_instr++ = (struct Thr_Instr){.handler = handlers[THR_BLOCK], .block = block_i};
+
+        for (int instr_i = block->first; instr_i < block->first + block->n_instrs; instr_i++)
+        {
+            const struct IR_Instr *const instr = ir->instrs + instr_i;
+
+            if (instr->type == nop)
+                continue;
+
+            thr_instr->handler = handlers[instr->type];
+
+            switch (instr->type)
+            {
+                case call:
+                case jmp:
+                case jae:
+                case ja:
+                case jbe:
+                case jb:
+                case je:
+                case jne:
+                    thr_instr->target = code->instrs + code->block_start[instr->jump.block];
+                    break;
+
+                case push_num:
+                    thr_instr->num = instr->num;
+                    break;
+
+                case push_ram_num:
+                case pop_ram_num:
+                    thr_instr->disp = instr->disp;
+                    break;
+
+                case push_reg:
+                case push_ram_reg:
+                case push_ram_reg_num:
+                case pop_reg:
+                case pop_ram_reg:
+                case pop_ram_reg_num:
+                    thr_instr->reg  = instr->reg - ax;
+                    thr_instr->disp = instr->disp;
+                    break;
+
+                default:
+                    break;
+            }
+
+            thr_instr++;
+        }
+
+        if (Falls_Elsewhere (ir, block_i))
+            *thr_instr++ = (struct Thr_Instr){.handler = handlers[jmp],
+                                              .target  = code->instrs + code->block_start[block->fall_through]};
+    }
+
+    thr_instr->handler = handlers[hlt];
+
+    return NO_ERRORS;
+}
+
+void Free_Threaded_Code (struct Threaded_Code *const code)
+{
+    free (code->instrs);
+    free (code->block_start);
+    free ((void *)code->counters);
+    free ((void *)code->native);
+
+    *code = (struct Threaded_Code){};
+}
+
+//=====================================================================================//
+
+//=====================================================================================//
+//                                       STACKS                                        //
+//=====================================================================================//
+
+// [guard][values][guard][frames][guard]: only touched pages are committed
+int Interp_Stacks_Map (struct Interp_Stacks *const stacks)
+{
+    MY_ASSERT (stacks, "struct Interp_Stacks *const stacks", NULL_PTR, ERROR);
+
+    const long size = VALUES_SIZE + FRAMES_SIZE + 3 * GUARD_SIZE;
+
+    char *reservation = (char *)mmap (NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reservation == MAP_FAILED)
+        return ERROR;
+
+    char *const values = reservation + GUARD_SIZE;
+    char *const frames = values + VALUES_SIZE + GUARD_SIZE;
+
+    if (mprotect (values, VALUES_SIZE, PROT_READ | PROT_WRITE) != 0 ||
+        mprotect (frames, FRAMES_SIZE, PROT_READ | PROT_WRITE) != 0)
+    {
+        munmap (reservation, size);
+        return ERROR;
+    }
+
+    stacks->reservation = reservation;
+    stacks->values      = (double *)values;
+    stacks->frames      = (struct Frame *)frames;
+
+    return NO_ERRORS;
+}
+
+void Interp_Stacks_Unmap (struct Interp_Stacks *const stacks)
+{
+    if (stacks->reservation)
+        munmap (stacks->reservation, VALUES_SIZE + FRAMES_SIZE + 3 * GUARD_SIZE);
+
+    *stacks = (struct Interp_Stacks){};
+}
+
+//=====================================================================================//
+
+//=====================================================================================//
+//                                     INTERPRETER                                     //
+//=====================================================================================//
+
+// [reg] is [ram + index], where index = (int)reg as a 32-bit unsigned number, like in the native code
+static inline long RAM_Index (const double reg)
+{
+    return (uint32_t)_mm_cvttsd_si32 (_mm_set_sd (reg));
+}
+
+#define NEXT            goto *(++ip)->handler
+#define JUMP(to)        do { ip = (to); goto *ip->handler; } while (0)
+#define RAM_AT(index)   (*(double *)(run->ram + (index)))
+
+// ucomisd semantics: a NaN operand fails every condition but jne
+#define JCC(condition)                              \
+    {                                               \
+        const double b = *sp--;                     \
+        const double a = *sp--;                     \
+                                                    \
+        if (condition)                              \
+            JUMP (ip->target);                      \
+                                                    \
+        NEXT;                                       \
+    }
+
+#define ARITHMETICS(operator)                       \
+    {                                               \
+        const double b = *sp--;                     \
+                                                    \
+        *sp = *sp operator b;                       \
+        NEXT;                                       \
+    }
+
+const void *const *Interpret (const struct Threaded_Code *const code, struct Interp_Run *const run)
+{
+    static const void *const Handlers[N_HANDLERS] =
+    {
+        [THR_BLOCK]        = &&op_block,
+
+        [hlt]              = &&op_hlt,
+        [call]             = &&op_call,
+        [jmp]              = &&op_jmp,
+        [jae]              = &&op_jae,
+        [ja]               = &&op_ja,
+        [jbe]              = &&op_jbe,
+        [jb]               = &&op_jb,
+        [je]               = &&op_je,
+        [jne]              = &&op_jne,
+        [ret]              = &&op_ret,
+        [in]               = &&op_in,
+        [out]              = &&op_out,
+        [push_num]         = &&op_push_num,
+        [push_ram_num]     = &&op_push_ram_num,
+        [push_reg]         = &&op_push_reg,
+        [push_ram_reg]     = &&op_push_ram_reg,
+        [push_ram_reg_num] = &&op_push_ram_reg_num,
+        [pop]              = &&op_pop,
+        [pop_ram_num]      = &&op_pop_ram_num,
+        [pop_reg]          = &&op_pop_reg,
+        [pop_ram_reg]      = &&op_pop_ram_reg,
+        [pop_ram_reg_num]  = &&op_pop_ram_reg_num,
+        [add]              = &&op_add,
+        [sub]              = &&op_sub,
+        [mul]              = &&op_mul,
+        [dvd]              = &&op_dvd,
+        [Sqrt]             = &&op_sqrt
+    };
+
+    if (code == NULL)
+        return Handlers;
+
+    double *const regs = run->regs;
+
+    struct Frame *frame = run->stacks->frames;  // frames[0] is the program itself
+    double *sp = run->stacks->values - 1;       // the top value
+
+    frame->ret  = NULL;
+    frame->base = sp;
+
+    const struct Thr_Instr *ip = code->instrs;
+    goto *ip->handler;
+
+    op_block:
+    {
+        _Atomic int *const counter = code->counters + ip->block;
+        const int count = atomic_load_explicit (counter, memory_order_relaxed);
+
+        // threads running the same code may lose some increments, it only delays compilation
+        if (count < code->threshold)
+        {
+            atomic_store_explicit (counter, count + 1, memory_order_relaxed);
+            NEXT;
+        }
+
+        // native code starts with an empty operand stack
+        if (sp != frame->base)
+            NEXT;
+
+        const void *native = atomic_load_explicit (code->native + ip->block, memory_order_acquire);
+
+        if (native == NULL && (native = run->tier.compile (run->tier.context, ip->block)) == NULL)
+        {
+            atomic_store_explicit (counter, INT_MIN, memory_order_relaxed);
+            NEXT;
+        }
+
+        // the native code returns where the procedure returns or at hlt
+        const enum Native_Exit native_exit = run->tier.run (run->tier.context, native, regs);
+
+        if (native_exit == NATIVE_RET)
+            goto op_ret;
+
+        run->failed = (native_exit == NATIVE_ERROR);
+        return NULL;
+    }
+
+    op_hlt:
+        return NULL;
+
+    op_call:
+        (++frame)->ret = ip + 1;
+        frame->base    = sp;
+        JUMP (ip->target);
+
+    op_ret:
+        if (frame == run->stacks->frames)
+            return NULL;
+
+        ip = (frame--)->ret;
+        goto *ip->handler;
+
+    op_jmp:
+        JUMP (ip->target);
+
+    op_jae: JCC (a >= b)
+    op_ja:  JCC (a >  b)
+    op_jbe: JCC (a <= b)
+    op_jb:  JCC (a <  b)
+    op_je:  JCC (a >= b && a <= b)
+    op_jne: JCC (!(a >= b && a <= b))
+
+    op_in:
+        *++sp = run->io->in (run->io->context);
+        NEXT;
+
+    op_out:
+        run->io->out (run->io->context, *sp--);
+        NEXT;
+
+    op_push_num:
+        *++sp = ip->num;
+        NEXT;
+
+    op_push_ram_num:
+        *++sp = RAM_AT (ip->disp);
+        NEXT;
+
+    op_push_reg:
+        *++sp = regs[ip->reg];
+        NEXT;
+
+    op_push_ram_reg:
+        *++sp = RAM_AT (RAM_Index (regs[ip->reg]));
+        NEXT;
+
+    op_push_ram_reg_num:
+        *++sp = RAM_AT (RAM_Index (regs[ip->reg]) + ip->disp);
+        NEXT;
+
+    op_pop:
+        sp--;
+        NEXT;
+
+    op_pop_ram_num:
+        RAM_AT (ip->disp) = *sp--;
+        NEXT;
+
+    op_pop_reg:
+        regs[ip->reg] = *sp--;
+        NEXT;
+
+    op_pop_ram_reg:
+        RAM_AT (RAM_Index (regs[ip->reg])) = *sp--;
+        NEXT;
+
+    op_pop_ram_reg_num:
+        RAM_AT (RAM_Index (regs[ip->reg]) + ip->disp) = *sp--;
+        NEXT;
+
+    op_add: ARITHMETICS (+)
+    op_sub: ARITHMETICS (-)
+    op_mul: ARITHMETICS (*)
+    op_dvd: ARITHMETICS (/)
+
+    op_sqrt:
+        *sp = sqrt (*sp);
+        NEXT;
+}
+
+#undef NEXT
+#undef JUMP
+#undef RAM_AT
+#undef JCC
+#undef ARITHMETICS
+
+//=====================================================================================//
+
+#undef THR_BLOCK
+#undef N_HANDLERS
+#undef VALUES_SIZE
+#undef FRAMES_SIZE
+#undef GUARD_SIZE
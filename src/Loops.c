@@ -0,0 +1,493 @@
+#include "../include/IR.h"
+
+//=====================================================================================//
+//                                 LOOP-INVARIANT CODE                                 //
+//=====================================================================================//
+
+// A loop is the range of blocks header ... last in bytecode order, where last jumps or falls back to header.
+// Only innermost loops that are entered at header alone and have no call, in or out (they don't keep xmm
+// registers) are changed. Every entry from outside goes through a preheader put right before header, which
+//   - copies registers that the loop pushes at least as often as it pops (counters and accumulators) into
+//     xmm registers: pushes read the copy and pops write it, so the dependency from one iteration to the next
+//     stays in xmm registers. The last pop of a block and a pop before a RAM access indexed by the register
+//     write the register too, so it's up to date wherever the loop exits;
+//   - evaluates expressions of numbers and registers that aren't popped in the loop into xmm registers,
+//     which the loop pushes instead.
+// xmm8 - xmm14 are free in the register stack mode (xmm15 is the scratch of RAM indices).
+
+#define FIRST_LOOP_XMM 8
+#define N_LOOP_XMMS    7
+
+#define NOT_HOISTED    0
+#define HOISTED_TAIL (-1)   // an instruction of a hoisted expression after the first one
+
+struct Loop
+{
+    int header;
+    int last;
+
+    int n_pushes[dx + 1];
+    int n_pops[dx + 1];
+    unsigned char shadow_xmm[dx + 1];   // copy of the register (0 - none)
+
+    int n_xmms;
+    int expr_first[N_LOOP_XMMS];        // hoisted expression of every xmm (-1 - a copy of a register)
+    int expr_len[N_LOOP_XMMS];
+};
+
+struct Hoister
+{
+    struct Loop *loops;
+    int n_loops;
+
+    int *last;              // the farthest block that goes back to every block (-1 - none)
+    int *loop_of;           // loop of every block (-1 - none)
+    int *mark;              // NOT_HOISTED, HOISTED_TAIL or xmm of the expression every instruction starts
+    int *new_index;
+};
+
+static inline const struct IR_Instr *Last_Instr (const struct IR *const ir, const int block_i)
+{
+    const struct IR_Block *const block = ir->blocks + block_i;
+
+    return (block->n_instrs > 0) ? ir->instrs + block->first + block->n_instrs - 1 : NULL;
+}
+
+static void Find_Back_Edges (const struct IR *const ir, int *const last)
+{
+    for (int block_i = 0; block_i < ir->n_blocks; block_i++)
+        last[block_i] = -1;
+
+    for (int block_i = 0; block_i < ir->n_blocks; block_i++)
+    {
+        const struct IR_Block *const block = ir->blocks + block_i;
+        const struct IR_Instr *const instr = Last_Instr (ir, block_i);
+
+        // a call comes back by itself
+        const int next[] = {block->fall_through, (instr && instr->type != call) ? block->branch : -1};
+
+        for (int next_i = 0; next_i < (int)(sizeof next / sizeof next[0]); next_i++)
+            if (0 <= next[next_i] && next[next_i] <= block_i)
+                last[next[next_i]] = block_i;
+    }
+}
+
+static bool Is_Simple_Loop (const struct IR *const ir, const int *const last, const int header)
+{
+    if (ir->blocks[header].n_instrs == 0)
+        return false;
+
+    for (int block_i = header; block_i <= last[header]; block_i++)
+    {
+        // an inner loop
+        if (block_i > header && last[block_i] >= 0)
+            return false;
+
+        const struct IR_Block *const block = ir->blocks + block_i;
+
+        for (int instr_i = block->first; instr_i < block->first + block->n_instrs; instr_i++)
+        {
+            const int type = ir->instrs[instr_i].type;
+
+            if (type == call || type == in || type == out)
+                return false;
+        }
+    }
+
+    // the only entry is header
+    for (int block_i = 0; block_i < ir->n_blocks; block_i++)
+    {
+        if (header <= block_i && block_i <= last[header])
+            continue;
+
+        const int next[] = {ir->blocks[block_i].fall_through, ir->blocks[block_i].branch};
+
+        for (int next_i = 0; next_i < (int)(sizeof next / sizeof next[0]); next_i++)
+            if (header < next[next_i] && next[next_i] <= last[header])
+                return false;
+    }
+
+    return true;
+}
+
+static inline bool Is_Invariant (const struct Loop *const loop, const struct IR_Instr *const instr)
+{
+    switch (instr->type)
+    {
+        case push_num:
+        case add:
+        case sub:
+        case mul:
+        case dvd:
+        case Sqrt:
+            return true;
+
+        case push_reg:
+            return loop->n_pops[instr->reg] == 0;
+
+        default:
+            return false;
+    }
+}
+
+// length of the longest invariant expression at instr_i that pushes one value and takes none (0 - none)
+static int Invariant_Len (const struct IR *const ir, const struct Loop *const loop, const int instr_i, const int end)
+{
+    int depth = 0;
+    int len   = 0;
+
+    for (int expr_i = instr_i; expr_i < end && Is_Invariant (loop, ir->instrs + expr_i); expr_i++)
+    {
+        const int type = ir->instrs[expr_i].type;
+
+        depth += (type == push_num || type == push_reg) ? 1 : (type == Sqrt) ? 0 : -1;
+
+        if (depth < 1)
+            break;
+
+        if (depth == 1)
+            len = expr_i - instr_i + 1;
+    }
+
+    return len;
+}
+
+static bool Same_Expr (const struct IR *const ir, const int first, const int second, const int len)
+{
+    for (int expr_i = 0; expr_i < len; expr_i++)
+    {
+        const struct IR_Instr *const a = ir->instrs + first  + expr_i;
+        const struct IR_Instr *const b = ir->instrs + second + expr_i;
+
+        if (a->type != b->type || (a->type == push_reg && a->reg != b->reg) ||
+            (a->type == push_num && memcmp (&a->num, &b->num, sizeof a->num) != 0))
+            return false;
+    }
+
+    return true;
+}
+
+// xmm of the expression, a new one if there is no such expression yet (0 - all of them are taken)
+static int Expr_Xmm (const struct IR *const ir, struct Loop *const loop, const int first, const int len)
+{
+    for (int xmm_i = 0; xmm_i < loop->n_xmms; xmm_i++)
+        if (loop->expr_len[xmm_i] == len && Same_Expr (ir, loop->expr_first[xmm_i], first, len))
+            return FIRST_LOOP_XMM + xmm_i;
+
+    if (loop->n_xmms == N_LOOP_XMMS)
+        return 0;
+
+    loop->expr_first[loop->n_xmms] = first;
+    loop->expr_len[loop->n_xmms]   = len;
+
+    return FIRST_LOOP_XMM + loop->n_xmms++;
+}
+
+// false if there is nothing to keep in xmm registers
+static bool Analyze_Loop (const struct IR *const ir, struct Loop *const loop, int *const mark)
+{
+    const int first = ir->blocks[loop->header].first;
+    const int end   = ir->blocks[loop->last].first + ir->blocks[loop->last].n_instrs;
+
+    for (int instr_i = first; instr_i < end; instr_i++)
+    {
+        const struct IR_Instr *const instr = ir->instrs + instr_i;
+
+        if (instr->type == push_reg)
+            loop->n_pushes[instr->reg]++;
+        else if (instr->type == pop_reg)
+            loop->n_pops[instr->reg]++;
+    }
+
+    // a register that is mostly assigned gains nothing from a copy that every pop writes
+    for (int reg = ax; reg <= dx; reg++)
+    {
+        if (loop->n_pops[reg] == 0 || loop->n_pushes[reg] < loop->n_pops[reg])
+            continue;
+
+        loop->shadow_xmm[reg] = FIRST_LOOP_XMM + loop->n_xmms;
+        loop->expr_first[loop->n_xmms++] = -1;
+    }
+
+    // an expression doesn't go past its block
+    for (int block_i = loop->header; block_i <= loop->last; block_i++)
+    {
+        const struct IR_Block *const block = ir->blocks + block_i;
+        const int block_end = block->first + block->n_instrs;
+
+        for (int instr_i = block->first; instr_i < block_end; )
+        {
+            const int len = Invariant_Len (ir, loop, instr_i, block_end);
+            const int xmm = (len > 0) ? Expr_Xmm (ir, loop, instr_i, len) : 0;
+
+            if (xmm == 0)
+            {
+                instr_i++;
+                continue;
+            }
+
+            mark[instr_i] = xmm;
+
+            for (int expr_i = 1; expr_i < len; expr_i++)
+                mark[instr_i + expr_i] = HOISTED_TAIL;
+
+            instr_i += len;
+        }
+    }
+
+    return loop->n_xmms > 0;
+}
+
+static int Preheader_Size (const struct Loop *const loop)
+{
+    int size = 0;
+
+    for (int xmm_i = 0; xmm_i < loop->n_xmms; xmm_i++)
+        size += (loop->expr_first[xmm_i] < 0) ? 1 : loop->expr_len[xmm_i] + 1;
+
+    return size;
+}
+
+static int Find_Loops (const struct IR *const ir, struct Hoister *const hoister)
+{
+    Find_Back_Edges (ir, hoister->last);
+
+    for (int block_i = 0; block_i < ir->n_blocks; block_i++)
+        hoister->loop_of[block_i] = -1;
+
+    for (int header = 0; header < ir->n_blocks; header++)
+    {
+        if (hoister->last[header] < 0 || !Is_Simple_Loop (ir, hoister->last, header))
+            continue;
+
+        struct Loop *const loop = hoister->loops + hoister->n_loops;
+
+        *loop = (struct Loop){.header = header, .last = hoister->last[header]};
+
+        if (!Analyze_Loop (ir, loop, hoister->mark))
+            continue;
+
+        for (int block_i = loop->header; block_i <= loop->last; block_i++)
+            hoister->loop_of[block_i] = hoister->n_loops;
+
+        hoister->n_loops++;
+    }
+
+    return hoister->n_loops;
+}
+
+//=====================================================================================//
+
+//=====================================================================================//
+//                                   NEW INSTRUCTIONS                                  //
+//=====================================================================================//
+
+// copies of registers, then every hoisted expression followed by load_const of its xmm
+static void Put_Preheader (const struct IR *const ir, const struct Loop *const loop, struct IR_Instr *const new_instrs,
+                           int *const n_new_instrs)
+{
+    const int ip = ir->instrs[ir->blocks[loop->header].first].ip;
+
+    for (int reg = ax; reg <= dx; reg++)
+        if (loop->shadow_xmm[reg])
+            new_instrs[(*n_new_instrs)++] = (struct IR_Instr){.type = load_shadow, .reg = (unsigned char)reg,
+                                                              .xmm = loop->shadow_xmm[reg], .ip = ip};
+
+    for (int xmm_i = 0; xmm_i < loop->n_xmms; xmm_i++)
+    {
+        const int first = loop->expr_first[xmm_i];
+
+        if (first < 0)
+            continue;
+
+        memcpy (new_instrs + *n_new_instrs, ir->instrs + first, loop->expr_len[xmm_i] * sizeof (struct IR_Instr));
+        *n_new_instrs += loop->expr_len[xmm_i];
+
+        new_instrs[(*n_new_instrs)++] = (struct IR_Instr){.type = load_const, .xmm = FIRST_LOOP_XMM + xmm_i,
+                                                          .ip = new_instrs[*n_new_instrs - 1].ip};
+    }
+}
+
+// Instructions of a block of the loop copied to new_block. The block is walked backwards, so that a pop knows
+// whether the register is read as a RAM index or at the end of the block before it's popped again.
+static void Rewrite_Loop_Block (const struct Loop *const loop, const int *const mark, const struct IR_Block *const block,
+                                struct IR_Instr *const new_block)
+{
+    bool reg_is_read[dx + 1] = {};
+
+    for (int reg = ax; reg <= dx; reg++)
+        reg_is_read[reg] = true;
+
+    for (int instr_i = block->n_instrs - 1; instr_i >= 0; instr_i--)
+    {
+        struct IR_Instr *const instr = new_block + instr_i;
+        const int instr_mark = mark[block->first + instr_i];
+
+        switch (instr->type)
+        {
+            case push_ram_reg:
+            case push_ram_reg_num:
+            case pop_ram_reg:
+            case pop_ram_reg_num:
+                reg_is_read[instr->reg] = true;
+                break;
+
+            case push_reg:
+            case pop_reg:
+                if (instr_mark != NOT_HOISTED || loop->shadow_xmm[instr->reg] == 0)
+                    break;
+
+                instr->xmm  = loop->shadow_xmm[instr->reg];
+                instr->type = (instr->type == push_reg) ? push_shadow :
+                              (reg_is_read[instr->reg])  ? pop_shadow_reg : pop_shadow;
+
+                if (instr->type != push_shadow)
+                    reg_is_read[instr->reg] = false;
+                break;
+
+            default:
+                break;
+        }
+
+        if (instr_mark == HOISTED_TAIL)
+            instr->type = nop;
+        else if (instr_mark != NOT_HOISTED)
+        {
+            instr->type = push_const;
+            instr->xmm  = (unsigned char)instr_mark;
+        }
+    }
+}
+
+// entries from outside of the loop go to the preheader, which is right before the header
+static inline int New_Successor (const struct Hoister *const hoister, const int block_i, const int next)
+{
+    if (next < 0)
+        return -1;
+
+    const int loop_i = hoister->loop_of[next];
+
+    if (loop_i >= 0 && hoister->loops[loop_i].header == next && hoister->loop_of[block_i] != loop_i)
+        return hoister->new_index[next] - 1;
+
+    return hoister->new_index[next];
+}
+
+static int Rebuild_IR (struct IR *const ir, struct Hoister *const hoister)
+{
+    int n_new_blocks = 0;
+    int n_new_instrs = ir->n_instrs;
+
+    for (int block_i = 0; block_i < ir->n_blocks; block_i++)
+    {
+        const int loop_i = hoister->loop_of[block_i];
+
+        if (loop_i >= 0 && hoister->loops[loop_i].header == block_i)
+        {
+            n_new_blocks++;
+            n_new_instrs += Preheader_Size (hoister->loops + loop_i);
+        }
+
+        hoister->new_index[block_i] = n_new_blocks++;
+    }
+
+    struct IR_Block *new_blocks = (struct IR_Block *)calloc (n_new_blocks + 1, sizeof (struct IR_Block));
+    struct IR_Instr *new_instrs = (struct IR_Instr *)calloc (n_new_instrs + 1, sizeof (struct IR_Instr));
+    struct Jump     *new_jumps  = (struct Jump *)calloc (n_new_instrs + 1, sizeof (struct Jump));
+
+    if (new_blocks == NULL || new_instrs == NULL || new_jumps == NULL)
+    {
+        free (new_blocks);
+        free (new_instrs);
+        free (new_jumps);
+        return ERROR;
+    }
+
+    n_new_instrs = 0;
+
+    for (int block_i = 0; block_i < ir->n_blocks; block_i++)
+    {
+        const struct IR_Block *const block = ir->blocks + block_i;
+        const int loop_i = hoister->loop_of[block_i];
+
+        if (loop_i >= 0 && hoister->loops[loop_i].header == block_i)
+        {
+            struct IR_Block *const preheader = new_blocks + hoister->new_index[block_i] - 1;
+
+            preheader->first = n_new_instrs;
+            Put_Preheader (ir, hoister->loops + loop_i, new_instrs, &n_new_instrs);
+
+            preheader->n_instrs     = n_new_instrs - preheader->first;
+            preheader->fall_through = hoister->new_index[block_i];
+            preheader->branch       = -1;
+        }
+
+        struct IR_Block *const new_block = new_blocks + hoister->new_index[block_i];
+
+        new_block->first        = n_new_instrs;
+        new_block->n_instrs     = block->n_instrs;
+        new_block->fall_through = New_Successor (hoister, block_i, block->fall_through);
+        new_block->branch       = New_Successor (hoister, block_i, block->branch);
+
+        memcpy (new_instrs + n_new_instrs, ir->instrs + block->first, block->n_instrs * sizeof (struct IR_Instr));
+
+        if (loop_i >= 0)
+            Rewrite_Loop_Block (hoister->loops + loop_i, hoister->mark, block, new_instrs + n_new_instrs);
+
+        n_new_instrs += block->n_instrs;
+
+        const struct IR_Instr *const last = Last_Instr (ir, block_i);
+
+        if (last && (last->type == call || last->type == jmp || Is_Jcc (last->type)))
+            new_instrs[n_new_instrs - 1].jump.block = new_block->branch;
+    }
+
+    free (ir->blocks);
+    free (ir->instrs);
+    free (ir->jumps);
+
+    ir->blocks   = new_blocks;
+    ir->n_blocks = n_new_blocks;
+    ir->instrs   = new_instrs;
+    ir->n_instrs = n_new_instrs;
+    ir->jumps    = new_jumps;
+
+    // drops the tails of hoisted expressions and lists the jumps again
+    return Compact_IR (ir);
+}
+
+//=====================================================================================//
+
+int Hoist_Loop_Invariants (struct IR *const ir)
+{
+    MY_ASSERT (ir, "struct IR *const ir", NULL_PTR, ERROR);
+
+    struct Hoister hoister =
+    {
+        .loops     = (struct Loop *)calloc (ir->n_blocks + 1, sizeof (struct Loop)),
+        .last      = (int *)calloc (ir->n_blocks + 1, sizeof (int)),
+        .loop_of   = (int *)calloc (ir->n_blocks + 1, sizeof (int)),
+        .mark      = (int *)calloc (ir->n_instrs + 1, sizeof (int)),
+        .new_index = (int *)calloc (ir->n_blocks + 1, sizeof (int))
+    };
+
+    int ret_val = ERROR;
+
+    if (hoister.loops && hoister.last && hoister.loop_of && hoister.mark && hoister.new_index)
+        ret_val = (Find_Loops (ir, &hoister) > 0) ? Rebuild_IR (ir, &hoister) : NO_ERRORS;
+
+    free (hoister.loops);
+    free (hoister.last);
+    free (hoister.loop_of);
+    free (hoister.mark);
+    free (hoister.new_index);
+
+    return ret_val;
+}
+
+#undef FIRST_LOOP_XMM
+#undef N_LOOP_XMMS
+#undef NOT_HOISTED
+#undef HOISTED_TAIL
+
+//=====================================================================================//
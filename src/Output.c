@@ -0,0 +1,558 @@
+#include "../include/Output.h"
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+
+#define OUTPUT_CAPACITY (64L << 10)
+
+//=====================================================================================//
+//                                       BUFFER                                        //
+//=====================================================================================//
+
+int Output_Init (struct Output *const output, const int fd, const enum Flush_Policy policy, const bool shortest)
+{
+    MY_ASSERT (output, "struct Output *const output", NULL_PTR, ERROR);
+
+    output->buffer = (char *)malloc (OUTPUT_CAPACITY);
+    MY_ASSERT (output->buffer, "output->buffer", NE_MEM, ERROR);
+
+    output->size       = 0;
+    output->capacity   = OUTPUT_CAPACITY;
+    output->fd         = fd;
+    output->line_flush = (policy == FLUSH_LINE) || (policy == FLUSH_AUTO && isatty (fd));
+    output->shortest   = shortest;
+
+    return NO_ERRORS;
+}
+
+void Output_Free (struct Output *const output)
+{
+    free (output->buffer);
+    *output = (struct Output){};
+}
+
+// the translated code can't handle errors, so the buffer is dropped if it can't be written
+int Output_Flush (struct Output *const output)
+{
+    MY_ASSERT (output, "struct Output *const output", NULL_PTR, ERROR);
+
+    size_t written = 0;
+
+    while (written < output->size)
+    {
+        const ssize_t n_bytes = write (output->fd, output->buffer + written, output->size - written);
+
+        if (n_bytes < 0 && errno == EINTR)
+            continue;
+
+        if (n_bytes <= 0)
+        {
+            output->size = 0;
+            return ERROR;
+        }
+
+        written += n_bytes;
+    }
+
+    output->size = 0;
+
+    return NO_ERRORS;
+}
+
+void Output_String (struct Output *const output, const char *const str)
+{
+    const size_t len = strlen (str);
+
+    if (output->size + len > output->capacity)
+        Output_Flush (output);
+
+    if (len > output->capacity)
+        write (output->fd, str, len);
+    else
+    {
+        memcpy (output->buffer + output->size, str, len);
+        output->size += len;
+    }
+
+    if (output->line_flush)
+        Output_Flush (output);
+}
+
+void Output_Number (struct Output *const output, const double number)
+{
+    if (output->capacity - output->size < MAX_NUMBER_LEN)
+        Output_Flush (output);
+
+    char *const str = output->buffer + output->size;
+
+    int len = (output->shortest) ? Format_Shortest (str, number) : Format_G (str, number);
+    str[len++] = '\n';
+
+    output->size += len;
+
+    if (output->line_flush)
+        Output_Flush (output);
+}
+
+//=====================================================================================//
+
+//=====================================================================================//
+//                                     FORMATTING                                      //
+//=====================================================================================//
+
+// Both formats print like printf (): sign, nan, inf and 0 as it does; other numbers in %g
+// notation with trailing zeros removed: fixed if -4 <= exponent < precision, d.ddde+XX otherwise.
+
+// writes sign; returns its length or the length of the whole number if it is nan, inf or 0
+static int Put_Special (char *const str, const double number, bool *const is_special)
+{
+    int len = 0;
+
+    if (signbit (number))
+        str[len++] = '-';
+
+    *is_special = true;
+
+    switch (fpclassify (number))
+    {
+        case FP_NAN:
+            memcpy (str + len, "nan", 3);
+            return len + 3;
+        case FP_INFINITE:
+            memcpy (str + len, "inf", 3);
+            return len + 3;
+        case FP_ZERO:
+            str[len] = '0';
+            return len + 1;
+        default:
+            break;
+    }
+
+    *is_special = false;
+
+    return len;
+}
+
+// digits d.ddd x 10^exp10 (without trailing zeros) in %g notation
+static int Put_Decimal (char *const str, const char *const digits, const int n_digits, const int exp10,
+                        const int precision)
+{
+    int len = 0;
+
+    if (exp10 < -4 || exp10 >= precision)
+    {
+        str[len++] = digits[0];
+
+        if (n_digits > 1)
+        {
+            str[len++] = '.';
+            memcpy (str + len, digits + 1, n_digits - 1);
+            len += n_digits - 1;
+        }
+
+        const int abs_exp10 = abs (exp10);
+
+        str[len++] = 'e';
+        str[len++] = (exp10 < 0) ? '-' : '+';
+        if (abs_exp10 >= 100)
+            str[len++] = '0' + abs_exp10 / 100;
+        str[len++] = '0' + abs_exp10 / 10 % 10;
+        str[len++] = '0' + abs_exp10 % 10;
+    }
+    else if (exp10 < 0)
+    {
+        str[len++] = '0';
+        str[len++] = '.';
+
+        memset (str + len, '0', -exp10 - 1);
+        len += -exp10 - 1;
+
+        memcpy (str + len, digits, n_digits);
+        len += n_digits;
+    }
+    else if (n_digits <= exp10 + 1)
+    {
+        memcpy (str + len, digits, n_digits);
+        len += n_digits;
+
+        memset (str + len, '0', exp10 + 1 - n_digits);
+        len += exp10 + 1 - n_digits;
+    }
+    else
+    {
+        memcpy (str + len, digits, exp10 + 1);
+        len += exp10 + 1;
+
+        str[len++] = '.';
+
+        memcpy (str + len, digits + exp10 + 1, n_digits - exp10 - 1);
+        len += n_digits - exp10 - 1;
+    }
+
+    return len;
+}
+
+//-------------------------------------------------------------------------------------//
+//                        %g: 6 significant digits, correctly rounded                  //
+//-------------------------------------------------------------------------------------//
+
+#define G_PRECISION     6
+#define MAX_EXACT_POW10 27          // 5^27 < 2^64: 10^27 is exact in long double
+#define HALFWAY_MARGIN  1e-9L       // error of the scaled number is below 1e6 * 2^-64
+
+static const long double Pow10_Long[MAX_EXACT_POW10 + 1] =
+{
+    1e0L,  1e1L,  1e2L,  1e3L,  1e4L,  1e5L,  1e6L,  1e7L,  1e8L,  1e9L,
+    1e10L, 1e11L, 1e12L, 1e13L, 1e14L, 1e15L, 1e16L, 1e17L, 1e18L, 1e19L,
+    1e20L, 1e21L, 1e22L, 1e23L, 1e24L, 1e25L, 1e26L, 1e27L
+};
+
+// number * 10^(5 - exp10) in [10^5, 10^6) is computed with one rounding in long double (64-bit significand)
+// and rounded to an integer. Returns false if it isn't certain which way to round or 10^(5 - exp10) isn't exact.
+static bool Round_G_Digits (const double number, uint32_t *const digits, int *const exp10)
+{
+    int exp2 = 0;
+    frexp (number, &exp2);
+
+    int guess = (int)floor ((exp2 - 1) * 0.30102999566398120);     // exp10 or exp10 - 1
+
+    for (int try_i = 0; try_i < 2; try_i++, guess++)
+    {
+        const int power = G_PRECISION - 1 - guess;
+
+        if (power > MAX_EXACT_POW10 || power < -MAX_EXACT_POW10)
+            return false;
+
+        const long double scaled = (power >= 0) ? number * Pow10_Long[power] : number / Pow10_Long[-power];
+
+        if (scaled >= 1e6L)
+            continue;
+
+        uint32_t integer = (uint32_t)scaled;
+        const long double fraction = scaled - integer;
+
+        if (fabsl (fraction - 0.5L) < HALFWAY_MARGIN)
+            return false;
+
+        integer += (fraction > 0.5L);
+
+        *exp10 = guess;
+        if (integer == 1000000)
+        {
+            integer = 100000;
+            (*exp10)++;
+        }
+
+        *digits = integer;
+
+        return true;
+    }
+
+    return false;
+}
+
+int Format_G (char *const str, const double number)
+{
+    bool is_special = false;
+    const int len = Put_Special (str, number, &is_special);
+
+    if (is_special)
+        return len;
+
+    uint32_t integer = 0;
+    int exp10 = 0;
+
+    if (!Round_G_Digits (fabs (number), &integer, &exp10))
+        return snprintf (str, MAX_NUMBER_LEN, "%g", number);
+
+    char digits[G_PRECISION] = {};
+    for (int digit_i = G_PRECISION - 1; digit_i >= 0; digit_i--, integer /= 10)
+        digits[digit_i] = '0' + integer % 10;
+
+    int n_digits = G_PRECISION;
+    while (digits[n_digits - 1] == '0')
+        n_digits--;
+
+    return len + Put_Decimal (str + len, digits, n_digits, exp10, G_PRECISION);
+}
+
+#undef G_PRECISION
+#undef MAX_EXACT_POW10
+#undef HALFWAY_MARGIN
+
+//-------------------------------------------------------------------------------------//
+//                          Shortest round-trip digits: Grisu2                         //
+//-------------------------------------------------------------------------------------//
+
+// Florian Loitsch, "Printing floating-point numbers quickly and accurately with integers", 2010.
+// Products with cached powers of 10 are inexact, so the digits are generated for the interval
+// that surely reads back to the number. They are shortest, unless the interval that possibly
+// does gives fewer digits; then the shortest ones are searched with snprintf () and strtod ().
+
+#define SHORTEST_PRECISION 17
+#define SIGNIFICAND_BITS   52
+#define HIDDEN_BIT         (1ULL << SIGNIFICAND_BITS)
+#define EXPONENT_BIAS      (0x3FF + SIGNIFICAND_BITS)
+
+// f * 2^e
+struct Diy_Fp
+{
+    uint64_t f;
+    int e;
+};
+
+// 10^-348, 10^-340, ..., 10^340 rounded to 64 bits
+static const struct Diy_Fp Cached_Powers[] =
+{
+    {0xFA8FD5A0081C0288ULL, -1220}, {0xBAAEE17FA23EBF76ULL, -1193}, {0x8B16FB203055AC76ULL, -1166},
+    {0xCF42894A5DCE35EAULL, -1140}, {0x9A6BB0AA55653B2DULL, -1113}, {0xE61ACF033D1A45DFULL, -1087},
+    {0xAB70FE17C79AC6CAULL, -1060}, {0xFF77B1FCBEBCDC4FULL, -1034}, {0xBE5691EF416BD60CULL, -1007},
+    {0x8DD01FAD907FFC3CULL,  -980}, {0xD3515C2831559A83ULL,  -954}, {0x9D71AC8FADA6C9B5ULL,  -927},
+    {0xEA9C227723EE8BCBULL,  -901}, {0xAECC49914078536DULL,  -874}, {0x823C12795DB6CE57ULL,  -847},
+    {0xC21094364DFB5637ULL,  -821}, {0x9096EA6F3848984FULL,  -794}, {0xD77485CB25823AC7ULL,  -768},
+    {0xA086CFCD97BF97F4ULL,  -741}, {0xEF340A98172AACE5ULL,  -715}, {0xB23867FB2A35B28EULL,  -688},
+    {0x84C8D4DFD2C63F3BULL,  -661}, {0xC5DD44271AD3CDBAULL,  -635}, {0x936B9FCEBB25C996ULL,  -608},
+    {0xDBAC6C247D62A584ULL,  -582}, {0xA3AB66580D5FDAF6ULL,  -555}, {0xF3E2F893DEC3F126ULL,  -529},
+    {0xB5B5ADA8AAFF80B8ULL,  -502}, {0x87625F056C7C4A8BULL,  -475}, {0xC9BCFF6034C13053ULL,  -449},
+    {0x964E858C91BA2655ULL,  -422}, {0xDFF9772470297EBDULL,  -396}, {0xA6DFBD9FB8E5B88FULL,  -369},
+    {0xF8A95FCF88747D94ULL,  -343}, {0xB94470938FA89BCFULL,  -316}, {0x8A08F0F8BF0F156BULL,  -289},
+    {0xCDB02555653131B6ULL,  -263}, {0x993FE2C6D07B7FACULL,  -236}, {0xE45C10C42A2B3B06ULL,  -210},
+    {0xAA242499697392D3ULL,  -183}, {0xFD87B5F28300CA0EULL,  -157}, {0xBCE5086492111AEBULL,  -130},
+    {0x8CBCCC096F5088CCULL,  -103}, {0xD1B71758E219652CULL,   -77}, {0x9C40000000000000ULL,   -50},
+    {0xE8D4A51000000000ULL,   -24}, {0xAD78EBC5AC620000ULL,     3}, {0x813F3978F8940984ULL,    30},
+    {0xC097CE7BC90715B3ULL,    56}, {0x8F7E32CE7BEA5C70ULL,    83}, {0xD5D238A4ABE98068ULL,   109},
+    {0x9F4F2726179A2245ULL,   136}, {0xED63A231D4C4FB27ULL,   162}, {0xB0DE65388CC8ADA8ULL,   189},
+    {0x83C7088E1AAB65DBULL,   216}, {0xC45D1DF942711D9AULL,   242}, {0x924D692CA61BE758ULL,   269},
+    {0xDA01EE641A708DEAULL,   295}, {0xA26DA3999AEF774AULL,   322}, {0xF209787BB47D6B85ULL,   348},
+    {0xB454E4A179DD1877ULL,   375}, {0x865B86925B9BC5C2ULL,   402}, {0xC83553C5C8965D3DULL,   428},
+    {0x952AB45CFA97A0B3ULL,   455}, {0xDE469FBD99A05FE3ULL,   481}, {0xA59BC234DB398C25ULL,   508},
+    {0xF6C69A72A3989F5CULL,   534}, {0xB7DCBF5354E9BECEULL,   561}, {0x88FCF317F22241E2ULL,   588},
+    {0xCC20CE9BD35C78A5ULL,   614}, {0x98165AF37B2153DFULL,   641}, {0xE2A0B5DC971F303AULL,   667},
+    {0xA8D9D1535CE3B396ULL,   694}, {0xFB9B7CD9A4A7443CULL,   720}, {0xBB764C4CA7A44410ULL,   747},
+    {0x8BAB8EEFB6409C1AULL,   774}, {0xD01FEF10A657842CULL,   800}, {0x9B10A4E5E9913129ULL,   827},
+    {0xE7109BFBA19C0C9DULL,   853}, {0xAC2820D9623BF429ULL,   880}, {0x80444B5E7AA7CF85ULL,   907},
+    {0xBF21E44003ACDD2DULL,   933}, {0x8E679C2F5E44FF8FULL,   960}, {0xD433179D9C8CB841ULL,   986},
+    {0x9E19DB92B4E31BA9ULL,  1013}, {0xEB96BF6EBADF77D9ULL,  1039}, {0xAF87023B9BF0EE6BULL,  1066}
+};
+
+static const uint64_t Pow10_64[] =
+{
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL,
+    10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+    1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL,
+    10000000000000000000ULL
+};
+
+static inline struct Diy_Fp Multiply (const struct Diy_Fp first, const struct Diy_Fp second)
+{
+    const unsigned __int128 product = (unsigned __int128)first.f * second.f;
+
+    const uint64_t high = (uint64_t)(product >> 64) + (((uint64_t)product >> 63) & 1);     // rounded
+
+    return (struct Diy_Fp){high, first.e + second.e + 64};
+}
+
+static inline struct Diy_Fp Normalize (const struct Diy_Fp number)
+{
+    const int shift = __builtin_clzll (number.f);
+
+    return (struct Diy_Fp){number.f << shift, number.e - shift};
+}
+
+static inline struct Diy_Fp Double_To_Diy_Fp (const double number)
+{
+    uint64_t bits = 0;
+    memcpy (&bits, &number, sizeof bits);
+
+    const int      biased_exp  = (bits >> SIGNIFICAND_BITS) & 0x7FF;
+    const uint64_t significand = bits & (HIDDEN_BIT - 1);
+
+    if (biased_exp == 0)    // subnormal
+        return (struct Diy_Fp){significand, 1 - EXPONENT_BIAS};
+
+    return (struct Diy_Fp){significand + HIDDEN_BIT, biased_exp - EXPONENT_BIAS};
+}
+
+// halfway points to the neighbouring doubles with the exponent of the normalized upper one
+static void Boundaries (const struct Diy_Fp number, struct Diy_Fp *const minus, struct Diy_Fp *const plus)
+{
+    *plus = Normalize ((struct Diy_Fp){(number.f << 1) + 1, number.e - 1});
+
+    // the lower neighbour of a power of 2 is twice as close
+    *minus = (number.f == HIDDEN_BIT) ? (struct Diy_Fp){(number.f << 2) - 1, number.e - 2} :
+                                        (struct Diy_Fp){(number.f << 1) - 1, number.e - 1};
+
+    minus->f <<= minus->e - plus->e;
+    minus->e   = plus->e;
+}
+
+// c = 10^-k such that the exponent of number * c is in [-60, -32]
+static inline struct Diy_Fp Cached_Power (const int exp2, int *const k)
+{
+    const double dk = (-61 - exp2) * 0.30102999566398114 + 347;    // dk > 0: (int) rounds down
+
+    int power = (int)dk;
+    if (dk - power > 0.0)
+        power++;
+
+    const int index = (power >> 3) + 1;
+
+    *k = -(-348 + index * 8);
+
+    return Cached_Powers[index];
+}
+
+// moves the last digit towards the number while it stays in the interval
+static void Grisu_Round (char *const digits, const int n_digits, const uint64_t delta, uint64_t rest,
+                         const uint64_t ten_kappa, const uint64_t wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+    {
+        digits[n_digits - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+// digits of mp until they are within delta of it
+static void Generate_Digits (const struct Diy_Fp w, const struct Diy_Fp mp, uint64_t delta,
+                             char *const digits, int *const n_digits, int *const k)
+{
+    const struct Diy_Fp one = {1ULL << -mp.e, mp.e};
+    const uint64_t wp_w = mp.f - w.f;
+
+    uint32_t integral   = (uint32_t)(mp.f >> -one.e);
+    uint64_t fractional = mp.f & (one.f - 1);
+
+    int kappa = 1;
+    while (kappa < 10 && integral >= Pow10_64[kappa])
+        kappa++;
+
+    *n_digits = 0;
+
+    while (kappa > 0)
+    {
+        const uint32_t digit = integral / Pow10_64[kappa - 1];
+        integral %= Pow10_64[kappa - 1];
+
+        if (digit || *n_digits)
+            digits[(*n_digits)++] = '0' + digit;
+
+        kappa--;
+
+        const uint64_t rest = ((uint64_t)integral << -one.e) + fractional;
+        if (rest <= delta)
+        {
+            *k += kappa;
+            Grisu_Round (digits, *n_digits, delta, rest, Pow10_64[kappa] << -one.e, wp_w);
+            return;
+        }
+    }
+
+    for (;;)
+    {
+        fractional *= 10;
+        delta      *= 10;
+
+        const char digit = (char)(fractional >> -one.e);
+
+        if (digit || *n_digits)
+            digits[(*n_digits)++] = '0' + digit;
+
+        fractional &= one.f - 1;
+        kappa--;
+
+        if (fractional < delta)
+        {
+            *k += kappa;
+            Grisu_Round (digits, *n_digits, delta, fractional, one.f, wp_w * ((-kappa < 20) ? Pow10_64[-kappa] : 0));
+            return;
+        }
+    }
+}
+
+// number = digits * 10^k; the interval of digits is shrunk (1) or widened (-1) by the error of products
+static void Grisu2 (const double number, const int shrink, char *const digits, int *const n_digits, int *const k)
+{
+    const struct Diy_Fp value = Double_To_Diy_Fp (number);
+
+    struct Diy_Fp w_minus = {};
+    struct Diy_Fp w_plus  = {};
+    Boundaries (value, &w_minus, &w_plus);
+
+    const struct Diy_Fp c_mk = Cached_Power (w_plus.e, k);
+
+    const struct Diy_Fp w  = Multiply (Normalize (value), c_mk);
+    struct Diy_Fp       wp = Multiply (w_plus,  c_mk);
+    struct Diy_Fp       wm = Multiply (w_minus, c_mk);
+
+    wm.f += shrink;
+    wp.f -= shrink;
+
+    Generate_Digits (w, wp, wp.f - wm.f, digits, n_digits, k);
+}
+
+static inline bool Same_Double (const double first, const double second)
+{
+    return memcmp (&first, &second, sizeof (double)) == 0;
+}
+
+// the first precision in [min_digits, max_digits) whose correctly rounded digits read back to the number
+static void Search_Shortest (const double number, const int min_digits, const int max_digits,
+                             char *const digits, int *const n_digits, int *const k)
+{
+    for (int precision = min_digits; precision < max_digits; precision++)
+    {
+        char str[MAX_NUMBER_LEN] = {};
+        snprintf (str, sizeof str, "%.*e", precision - 1, number);      // d.ddde+XX
+
+        if (!Same_Double (strtod (str, NULL), number))
+            continue;
+
+        digits[0] = str[0];
+        memcpy (digits + 1, str + 2, precision - 1);
+
+        *n_digits = precision;
+        *k        = atoi (strchr (str, 'e') + 1) - (precision - 1);
+
+        return;
+    }
+}
+
+int Format_Shortest (char *const str, const double number)
+{
+    bool is_special = false;
+    const int len = Put_Special (str, number, &is_special);
+
+    if (is_special)
+        return len;
+
+    char digits[SHORTEST_PRECISION + 3] = {};
+    int n_digits = 0;
+    int k = 0;
+
+    Grisu2 (fabs (number), 1, digits, &n_digits, &k);
+
+    char wide_digits[SHORTEST_PRECISION + 3] = {};
+    int n_wide_digits = 0;
+    int wide_k = 0;
+
+    Grisu2 (fabs (number), -1, wide_digits, &n_wide_digits, &wide_k);
+
+    if (n_wide_digits < n_digits)
+        Search_Shortest (fabs (number), n_wide_digits, n_digits, digits, &n_digits, &k);
+
+    for ( ; n_digits > 1 && digits[n_digits - 1] == '0'; n_digits--)
+        k++;
+
+    return len + Put_Decimal (str + len, digits, n_digits, n_digits + k - 1, SHORTEST_PRECISION);
+}
+
+#undef SHORTEST_PRECISION
+#undef SIGNIFICAND_BITS
+#undef HIDDEN_BIT
+#undef EXPONENT_BIAS
+
+//=====================================================================================//
+
+#undef OUTPUT_CAPACITY
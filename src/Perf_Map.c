@@ -0,0 +1,261 @@
+#include "../include/Perf_Map.h"
+#include <elf.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JITDUMP_MAGIC   0x4A695444      // "JiTD"
+#define JITDUMP_VERSION 1
+
+#define PATH_SIZE 64
+
+// tools/perf/util/jitdump.h of the kernel
+struct Jitdump_Header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+enum Jitdump_Record
+{
+    JIT_CODE_LOAD       = 0,
+    JIT_CODE_DEBUG_INFO = 2
+};
+
+struct Record_Prefix
+{
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+};
+
+// followed by the name and the code
+struct Code_Load
+{
+    struct Record_Prefix prefix;
+
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+};
+
+// followed by the entries
+struct Debug_Info
+{
+    struct Record_Prefix prefix;
+
+    uint64_t code_addr;
+    uint64_t nr_entry;
+};
+
+// followed by the file name
+struct Debug_Entry
+{
+    uint64_t addr;
+    int32_t  lineno;
+    int32_t  discrim;
+};
+
+static struct
+{
+    pthread_mutex_t lock;
+
+    FILE *map;              // NULL until the first symbol
+    int   dump_fd;          // -1 until the first symbol
+    uint64_t code_index;
+
+    bool failed;            // files that can't be created aren't tried again
+} Perf = {.lock = PTHREAD_MUTEX_INITIALIZER, .dump_fd = -1};
+
+//=====================================================================================//
+//                                      PERF MAP                                       //
+//=====================================================================================//
+
+static int Write_Map_Line (const struct Perf_Symbol *const symbol)
+{
+    if (Perf.map == NULL)
+    {
+        char path[PATH_SIZE] = "";
+        snprintf (path, sizeof path, "/tmp/perf-%d.map", (int)getpid ());
+
+        if ((Perf.map = fopen (path, "a")) == NULL)
+            return ERROR;
+    }
+
+    fprintf (Perf.map, "%" PRIxPTR " %lx %s\n", (uintptr_t)(symbol->buffer + symbol->x86_ip), symbol->size, symbol->name);
+
+    // perf reads the file after the process exits, which may be a crash
+    return (fflush (Perf.map) == 0) ? NO_ERRORS : ERROR;
+}
+
+//=====================================================================================//
+
+//=====================================================================================//
+//                                       JITDUMP                                       //
+//=====================================================================================//
+
+static inline uint64_t Timestamp (void)
+{
+    struct timespec time = {};
+    clock_gettime (CLOCK_MONOTONIC, &time);     // perf record -k 1
+
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+// perf finds the file by its executable mapping, which is kept until the process exits
+static int Open_Dump (void)
+{
+    char path[PATH_SIZE] = "";
+    snprintf (path, sizeof path, "/tmp/jit-%d.dump", (int)getpid ());
+
+    const int fd = open (path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd < 0)
+        return ERROR;
+
+    const struct Jitdump_Header header =
+    {
+        .magic      = JITDUMP_MAGIC,
+        .version    = JITDUMP_VERSION,
+        .total_size = sizeof (struct Jitdump_Header),
+        .elf_mach   = EM_X86_64,
+        .pid        = (uint32_t)getpid (),
+        .timestamp  = Timestamp ()
+    };
+
+    const long page_size = sysconf (_SC_PAGESIZE);
+
+    if (write (fd, &header, sizeof header) != sizeof header ||
+        mmap (NULL, page_size, PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0) == MAP_FAILED)
+    {
+        close (fd);
+        return ERROR;
+    }
+
+    Perf.dump_fd = fd;
+
+    return NO_ERRORS;
+}
+
+// the whole record goes with one write, so that a failure doesn't leave half of it
+static int Write_Record (const char *const record, const size_t size)
+{
+    return (write (Perf.dump_fd, record, size) == (ssize_t)size) ? NO_ERRORS : ERROR;
+}
+
+// debug info goes before the code it describes
+static int Write_Debug_Info (const struct Perf_Symbol *const symbol, const uint64_t timestamp)
+{
+    if (symbol->n_lines == 0)
+        return NO_ERRORS;
+
+    const size_t file_size  = strlen (symbol->file) + 1;
+    const size_t entry_size = sizeof (struct Debug_Entry) + file_size;
+    const size_t size       = sizeof (struct Debug_Info) + symbol->n_lines * entry_size;
+
+    char *record = (char *)calloc (1, size);
+    MY_ASSERT (record, "char *record", NE_MEM, ERROR);
+
+    *(struct Debug_Info *)record = (struct Debug_Info)
+    {
+        .prefix    = {JIT_CODE_DEBUG_INFO, (uint32_t)size, timestamp},
+        .code_addr = (uintptr_t)(symbol->buffer + symbol->x86_ip),
+        .nr_entry  = (uint64_t)symbol->n_lines
+    };
+
+    char *entry = record + sizeof (struct Debug_Info);
+
+    for (int line_i = 0; line_i < symbol->n_lines; line_i++, entry += entry_size)
+    {
+        const struct Debug_Entry debug_entry =
+        {
+            .addr   = (uintptr_t)(symbol->buffer + symbol->lines[line_i].x86_ip),
+            .lineno = symbol->lines[line_i].ip
+        };
+
+        memcpy (entry, &debug_entry, sizeof debug_entry);
+        memcpy (entry + sizeof debug_entry, symbol->file, file_size);
+    }
+
+    const int W_status = Write_Record (record, size);
+    free (record);
+
+    return W_status;
+}
+
+static int Write_Code_Load (const struct Perf_Symbol *const symbol, const uint64_t timestamp)
+{
+    const size_t name_size = strlen (symbol->name) + 1;
+    const size_t size      = sizeof (struct Code_Load) + name_size + symbol->size;
+
+    char *record = (char *)calloc (1, size);
+    MY_ASSERT (record, "char *record", NE_MEM, ERROR);
+
+    const uintptr_t code_addr = (uintptr_t)(symbol->buffer + symbol->x86_ip);
+
+    *(struct Code_Load *)record = (struct Code_Load)
+    {
+        .prefix     = {JIT_CODE_LOAD, (uint32_t)size, timestamp},
+        .pid        = (uint32_t)getpid (),
+        .tid        = (uint32_t)syscall (SYS_gettid),
+        .vma        = code_addr,
+        .code_addr  = code_addr,
+        .code_size  = (uint64_t)symbol->size,
+        .code_index = Perf.code_index++
+    };
+
+    memcpy (record + sizeof (struct Code_Load), symbol->name, name_size);
+    memcpy (record + sizeof (struct Code_Load) + name_size, symbol->buffer + symbol->x86_ip, symbol->size);
+
+    const int W_status = Write_Record (record, size);
+    free (record);
+
+    return W_status;
+}
+
+//=====================================================================================//
+
+int Perf_Describe (const struct Perf_Symbol *const symbol, const bool perf_map, const bool jitdump)
+{
+    MY_ASSERT (symbol, "const struct Perf_Symbol *const symbol", NULL_PTR, ERROR);
+
+    if (symbol->size == 0)
+        return NO_ERRORS;
+
+    pthread_mutex_lock (&Perf.lock);
+
+    int ret_val = NO_ERRORS;
+
+    if (perf_map && Write_Map_Line (symbol) == ERROR)
+        ret_val = ERROR;
+
+    if (jitdump && !Perf.failed)
+    {
+        const uint64_t timestamp = Timestamp ();
+
+        if ((Perf.dump_fd < 0 && Open_Dump () == ERROR) || Write_Debug_Info (symbol, timestamp) == ERROR ||
+            Write_Code_Load (symbol, timestamp) == ERROR)
+        {
+            Perf.failed = true;
+            ret_val = ERROR;
+        }
+    }
+
+    pthread_mutex_unlock (&Perf.lock);
+
+    return ret_val;
+}
+
+#undef JITDUMP_MAGIC
+#undef JITDUMP_VERSION
+#undef PATH_SIZE
@@ -0,0 +1,140 @@
+#include "../include/Profile.h"
+
+#define PROFILE_HEADER "# Ketchupp_JIT profile: block ip executions, branch ip taken not_taken\n"
+#define LINE_SIZE 128
+
+struct Profile *Profile_New (const struct IR *const ir)
+{
+    MY_ASSERT (ir, "const struct IR *const ir", NULL_PTR, NULL);
+
+    struct Profile *profile = (struct Profile *)calloc (1, sizeof (struct Profile));
+    if (profile == NULL)
+        return NULL;
+
+    profile->n_blocks = ir->n_blocks;
+    profile->counts   = (uint64_t *)calloc (2 * ir->n_blocks + 1, sizeof (uint64_t));
+    profile->block_ip = (int *)calloc (ir->n_blocks + 1, sizeof (int));
+    profile->jcc_ip   = (int *)calloc (ir->n_blocks + 1, sizeof (int));
+
+    if (!profile->counts || !profile->block_ip || !profile->jcc_ip)
+    {
+        Profile_Free (profile);
+        return NULL;
+    }
+
+    for (int block_i = 0; block_i < ir->n_blocks; block_i++)
+    {
+        const struct IR_Block *const block = ir->blocks + block_i;
+        const struct IR_Instr *const last  = ir->instrs + block->first + block->n_instrs - 1;
+
+        profile->block_ip[block_i] = (block->n_instrs > 0) ? ir->instrs[block->first].ip : -1;
+        profile->jcc_ip[block_i]   = (block->n_instrs > 0 && Is_Jcc (last->type)) ? last->ip : -1;
+    }
+
+    return profile;
+}
+
+void Profile_Free (struct Profile *const profile)
+{
+    if (profile == NULL)
+        return;
+
+    free (profile->counts);
+    free (profile->block_ip);
+    free (profile->jcc_ip);
+    free (profile);
+}
+
+int Profile_Write (const struct Profile *const profile, const char *const file_name)
+{
+    MY_ASSERT (profile,   "const struct Profile *const profile", NULL_PTR, ERROR);
+    MY_ASSERT (file_name, "const char *const file_name",         NULL_PTR, ERROR);
+
+    FILE *file = fopen (file_name, "w");
+    if (file == NULL)
+        return ERROR;
+
+    fputs (PROFILE_HEADER, file);
+
+    for (int block_i = 0; block_i < profile->n_blocks; block_i++)
+    {
+        if (profile->block_ip[block_i] < 0)
+            continue;
+
+        const uint64_t executions = profile->counts[block_i];
+        const uint64_t not_taken  = profile->counts[profile->n_blocks + block_i];
+
+        fprintf (file, "block %d %" PRIu64 "\n", profile->block_ip[block_i], executions);
+
+        // lost increments of threads mustn't make it negative
+        if (profile->jcc_ip[block_i] >= 0)
+            fprintf (file, "branch %d %" PRIu64 " %" PRIu64 "\n", profile->jcc_ip[block_i],
+                     (executions > not_taken) ? executions - not_taken : 0, not_taken);
+    }
+
+    return (fclose (file) == 0) ? NO_ERRORS : ERROR;
+}
+
+// Index of ip in ips or -1. Lines of a profile go in bytecode order, so the search goes on from the last
+// match and wraps around only for lines out of order.
+static int Find_Ip (const int *const ips, const int n_ips, const int ip, int *const cursor)
+{
+    if (ip < 0)
+        return -1;     // empty blocks and blocks without a conditional jump
+
+    for (int step = 0, index = *cursor; step < n_ips; step++, index = (index + 1 < n_ips) ? index + 1 : 0)
+    {
+        if (ips[index] == ip)
+        {
+            *cursor = index;
+            return index;
+        }
+    }
+
+    return -1;
+}
+
+int Profile_Read (struct Profile *const profile, const char *const file_name)
+{
+    MY_ASSERT (profile,   "struct Profile *const profile", NULL_PTR, ERROR);
+    MY_ASSERT (file_name, "const char *const file_name",   NULL_PTR, ERROR);
+
+    FILE *file = fopen (file_name, "r");
+    if (file == NULL)
+        return ERROR;
+
+    char line[LINE_SIZE] = "";
+
+    int block_cursor = 0;
+    int jcc_cursor   = 0;
+
+    while (fgets (line, sizeof line, file))
+    {
+        int ip = 0;
+        uint64_t first  = 0;
+        uint64_t second = 0;
+
+        if (sscanf (line, "block %d %" SCNu64, &ip, &first) == 2)
+        {
+            const int block_i = Find_Ip (profile->block_ip, profile->n_blocks, ip, &block_cursor);
+
+            if (block_i >= 0)
+                profile->counts[block_i] += first;
+        }
+        else if (sscanf (line, "branch %d %" SCNu64 " %" SCNu64, &ip, &first, &second) == 3)
+        {
+            const int block_i = Find_Ip (profile->jcc_ip, profile->n_blocks, ip, &jcc_cursor);
+
+            if (block_i >= 0)
+                profile->counts[profile->n_blocks + block_i] += second;
+        }
+    }
+
+    const bool failed = ferror (file);
+    fclose (file);
+
+    return (failed) ? ERROR : NO_ERRORS;
+}
+
+#undef PROFILE_HEADER
+#undef LINE_SIZE
@@ -0,0 +1,43 @@
+#include "../include/RAM.h"
+
+#define GUARD_BELOW  (2L << 30)                         // disp32 >= -2^31
+#define RESERVE_SIZE (GUARD_BELOW + (6L << 30) + 4096)  // index < 2^32, disp32 < 2^31, the last qword
+
+int RAM_Map (struct RAM *const ram)
+{
+    MY_ASSERT (ram, "struct RAM *const ram", NULL_PTR, ERROR);
+
+    // PROT_NONE pages are neither committed nor counted by the kernel, many instances fit in one process
+    char *reservation = (char *)mmap (NULL, RESERVE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reservation == MAP_FAILED)
+        return ERROR;
+
+    if (mprotect (reservation + GUARD_BELOW, RAM_SIZE, PROT_READ | PROT_WRITE) != 0)
+    {
+        munmap (reservation, RESERVE_SIZE);
+        return ERROR;
+    }
+
+    ram->reservation = reservation;
+    ram->base        = reservation + GUARD_BELOW;
+
+    return NO_ERRORS;
+}
+
+void RAM_Unmap (struct RAM *const ram)
+{
+    if (ram->reservation)
+        munmap (ram->reservation, RESERVE_SIZE);
+
+    ram->reservation = NULL;
+    ram->base        = NULL;
+}
+
+// private anonymous pages that are given back read as zero the next time they are touched
+void RAM_Clear (struct RAM *const ram)
+{
+    madvise (ram->base, RAM_SIZE, MADV_DONTNEED);
+}
+
+#undef GUARD_BELOW
+#undef RESERVE_SIZE
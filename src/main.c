@@ -1,25 +1,219 @@
 #include "../include/Binary_Translator.h"
+#include "../include/Batch.h"
+#include "../include/Bytecode.h"
+#include <limits.h>
 
-int Check_Argc (const int argc, const int expected)
+#define DEFAULT_CACHE_SIZE     (64L << 20)
+#define DEFAULT_BENCH_RUNS     21
+#define DEFAULT_BENCH_WARMUP   3
+#define DEFAULT_TIER_THRESHOLD 1000
+
+// returns false if str isn't a non-negative decimal number
+static bool Parse_Number (const char *const str, long *const number)
 {
-    return (argc == expected) ? 0 : 1;
+    char *end = NULL;
+    *number = strtol (str, &end, 10);
+
+    return end != str && *end == '\0' && *number >= 0;
 }
 
+// returns index of input file name in argv or 0 if arguments are wrong
+static int Parse_Args (const int argc, char *argv[], struct Tr_Options *const options)
+{
+    struct Bin_Tr_Options *const compile = &options->compile;     // what Bin_Tr_Compile () gets
+
+    int arg_i = 1;
+
+    compile->cache_size     = DEFAULT_CACHE_SIZE;
+    options->bench_runs     = DEFAULT_BENCH_RUNS;
+    options->bench_warmup   = DEFAULT_BENCH_WARMUP;
+    compile->tier_threshold = DEFAULT_TIER_THRESHOLD;
+
+    // "-" alone is the input file: bytecode from stdin
+    for ( ; arg_i < argc && argv[arg_i][0] == '-' && argv[arg_i][1] != '\0'; arg_i++)
+    {
+        const bool has_value = (arg_i + 1 < argc);
+
+        if (strcmp (argv[arg_i], "--reg-stack") == 0)
+            compile->reg_stack = true;
+        else if (strcmp (argv[arg_i], "--peephole") == 0)
+            compile->peephole = true;
+        else if (strcmp (argv[arg_i], "--const-fold") == 0)
+            compile->const_fold = true;
+        else if (strcmp (argv[arg_i], "--short-branches") == 0)
+            compile->short_branches = true;
+        else if (strcmp (argv[arg_i], "--licm") == 0)
+            compile->licm = true;
+        else if (strcmp (argv[arg_i], "--fp-contract") == 0)
+            compile->fp_contract = true;
+        else if (strcmp (argv[arg_i], "--target") == 0 && has_value)
+        {
+            const char *const target = argv[++arg_i];
+
+            if (strcmp (target, "native") == 0)
+                compile->target = TARGET_NATIVE;
+            else if (strcmp (target, "sse2") == 0)
+                compile->target = TARGET_SSE2;
+            else if (strcmp (target, "avx") == 0)
+                compile->target = TARGET_AVX;
+            else if (strcmp (target, "fma") == 0)
+                compile->target = TARGET_FMA;
+            else
+                return 0;
+        }
+        else if (strcmp (argv[arg_i], "--huge-pages") == 0)
+            compile->huge_pages = true;
+        else if (strcmp (argv[arg_i], "--lazy") == 0)
+            compile->lazy = true;
+        else if (strcmp (argv[arg_i], "--tiered") == 0)
+            compile->tiered = true;
+        else if (strcmp (argv[arg_i], "--perf-map") == 0)
+            compile->perf_map = true;
+        else if (strcmp (argv[arg_i], "--jitdump") == 0)
+            compile->jitdump = true;
+        else if (strcmp (argv[arg_i], "--inline") == 0 && has_value)
+        {
+            long budget = 0;
+            if (!Parse_Number (argv[++arg_i], &budget) || budget > BIN_TR_MAX_INLINE_BUDGET)
+                return 0;
+
+            compile->inline_budget = budget;
+        }
+        else if (strcmp (argv[arg_i], "--tier-threshold") == 0 && has_value)
+        {
+            long threshold = 0;
+            if (!Parse_Number (argv[++arg_i], &threshold) || threshold > INT_MAX)
+                return 0;
+
+            compile->tier_threshold = threshold;
+        }
+        else if (strcmp (argv[arg_i], "--cache") == 0 && has_value)
+            compile->cache_dir = argv[++arg_i];
+        else if (strcmp (argv[arg_i], "--aot") == 0 && has_value)
+            options->aot_output = argv[++arg_i];
+        else if (strcmp (argv[arg_i], "--layout") == 0 && has_value)
+            compile->layout_profile = argv[++arg_i];
+        else if (strcmp (argv[arg_i], "--profile") == 0 && has_value)
+        {
+            options->profile_output = argv[++arg_i];
+            compile->instrument     = true;
+        }
+        else if (strcmp (argv[arg_i], "--out-flush") == 0 && has_value)
+        {
+            const char *const policy = argv[++arg_i];
+
+            if (strcmp (policy, "auto") == 0)
+                options->out_flush = FLUSH_AUTO;
+            else if (strcmp (policy, "line") == 0)
+                options->out_flush = FLUSH_LINE;
+            else if (strcmp (policy, "full") == 0)
+                options->out_flush = FLUSH_FULL;
+            else
+                return 0;
+        }
+        else if (strcmp (argv[arg_i], "--out-shortest") == 0)
+            options->out_shortest = true;
+        else if (strcmp (argv[arg_i], "--input") == 0 && has_value)
+            options->input_file = argv[++arg_i];
+        else if (strcmp (argv[arg_i], "--input-binary") == 0)
+            options->input_binary = true;
+        else if (strcmp (argv[arg_i], "--cache-size") == 0 && has_value)
+        {
+            if (!Parse_Number (argv[++arg_i], &compile->cache_size))
+                return 0;
+        }
+        else if (strcmp (argv[arg_i], "--bench") == 0 && has_value)
+            options->bench_output = argv[++arg_i];
+        else if (strcmp (argv[arg_i], "--bench-runs") == 0 && has_value)
+        {
+            long n_runs = 0;
+            if (!Parse_Number (argv[++arg_i], &n_runs) || n_runs == 0 || n_runs > INT_MAX)
+                return 0;
+
+            options->bench_runs = n_runs;
+        }
+        else if (strcmp (argv[arg_i], "--bench-warmup") == 0 && has_value)
+        {
+            long n_runs = 0;
+            if (!Parse_Number (argv[++arg_i], &n_runs) || n_runs > INT_MAX)
+                return 0;
+
+            options->bench_warmup = n_runs;
+        }
+        else if (strcmp (argv[arg_i], "--batch") == 0)
+            options->batch = true;
+        else if (strcmp (argv[arg_i], "--threads") == 0 && has_value)
+        {
+            long n_threads = 0;
+            if (!Parse_Number (argv[++arg_i], &n_threads) || n_threads > INT_MAX)
+                return 0;
+
+            options->n_threads = n_threads;
+        }
+        else
+            return 0;
+    }
+
+    // jobs of a batch have their own inputs and outputs and are run only once
+    if (options->batch && (options->aot_output || options->input_file || options->bench_output ||
+                           options->profile_output || compile->layout_profile))
+        return 0;
+
+    // counters are addressed in the memory of the translator
+    if (options->aot_output && options->profile_output)
+        return 0;
+
+    // the profile would count blocks that aren't in bytecode order
+    if (options->profile_output && compile->layout_profile)
+        return 0;
+
+    return (arg_i == argc - 1) ? arg_i : 0;     // input file name is the last argument
+}
+
+#undef DEFAULT_CACHE_SIZE
+#undef DEFAULT_BENCH_RUNS
+#undef DEFAULT_BENCH_WARMUP
+#undef DEFAULT_TIER_THRESHOLD
+
 int main (int argc, char *argv[])
 {
     #ifdef DEBUG
     Open_Log_File ("Binary_Translator");
     #endif
-    
-    MY_ASSERT (Check_Argc (argc, 2) == 0, "int argc", NE_MAIN_ARGS, ERROR);
 
-    #ifdef DEBUG
-    int ret_val = Binary_Translator (argv[1]);
-    #else
-    Binary_Translator (argv[1]);
-    #endif
+    struct Tr_Options options = {};
+
+    const int input_i = Parse_Args (argc, argv, &options);
+
+    // in a release build MY_ASSERT is empty, and argv[0] would be read as bytecode
+    if (input_i == 0)
+    {
+        printf ("Usage: %s [options] input_file_name (see README.md for the options)\n", argv[0]);
+        return ERROR;
+    }
+
+    if (options.batch)
+    {
+        const int batch_status = Batch (argv[input_i], &options);
+
+        MY_ASSERT (batch_status != ERROR, "Batch ()", FUNC_ERROR, ERROR);
+
+        return (batch_status == ERROR) ? ERROR : 0;
+    }
+
+    struct Bytecode bytecode = {};
+
+    if (Bytecode_Load (&bytecode, argv[input_i]) == ERROR)
+    {
+        printf ("Can't read bytecode \"%s\"\n", argv[input_i]);
+        return ERROR;
+    }
+
+    const int ret_val = Binary_Translator (argv[input_i], bytecode.data, bytecode.size, &options);
+
+    Bytecode_Free (&bytecode);
 
     MY_ASSERT (ret_val != ERROR, "Translate ()", FUNC_ERROR, ERROR);
     
-    return 0;
+    return (ret_val == ERROR) ? ERROR : 0;
 }
@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""Tests of the binary translator.
+
+Every program of tests/ is run by the translator once per configuration, with numbers for in from
+NAME.in if there is one. What the program prints has to be the same as NAME.expected in every
+configuration; messages of the translator itself are skipped. The program is also written by --aot and
+the executable is run with NAME.in on stdin, so In and Out of its runtime are checked against the host ones.
+"""
+
+import argparse
+import itertools
+import os
+import subprocess
+import sys
+import tempfile
+
+CONFIGS = {
+    "jit":         [],
+    "jit-opt":     ["--reg-stack", "--peephole", "--const-fold", "--short-branches", "--licm", "--inline", "16"],
+    "lazy":        ["--lazy"],
+    "tiered-0":    ["--tiered", "--tier-threshold", "0"],
+    "tiered-1000": ["--tiered", "--tier-threshold", "1000"],
+}
+
+MESSAGES = ("Thanks for choosing Ketchupp_JIT!", "Peephole optimizer removed", "Branch relaxation removed",
+            "Lazy compilation translated", "Tiered execution translated")
+
+
+def program_output(stdout):
+    return [line for line in stdout.splitlines() if not line.startswith(MESSAGES)]
+
+
+def first_difference(output, expected):
+    for line_i, (line, expected_line) in enumerate(itertools.zip_longest(output, expected)):
+        if line != expected_line:
+            return "line %d is %r instead of %r" % (line_i + 1, line, expected_line)
+
+
+def input_file(program):
+    input_name = program[:-len(".bin")] + ".in"
+    return input_name if os.path.exists(input_name) else None
+
+
+def run(command, stdin, args):
+    try:
+        result = subprocess.run(command, stdin=stdin, capture_output=True, text=True, timeout=args.timeout)
+    except subprocess.TimeoutExpired:
+        return None, "timeout"
+
+    if result.returncode != 0:
+        return None, "exit status %d" % result.returncode
+
+    return program_output(result.stdout), None
+
+
+def run_translator(translator, program, flags, args):
+    input_name = input_file(program)
+    command = [translator] + flags + (["--input", input_name] if input_name else []) + [program]
+
+    return run(command, subprocess.DEVNULL, args)
+
+
+def run_aot(translator, program, args):
+    with tempfile.TemporaryDirectory() as directory:
+        executable = os.path.join(directory, "program")
+
+        _, error = run([translator, "--aot", executable, program], subprocess.DEVNULL, args)
+        if error:
+            return None, "translation: " + error
+
+        input_name = input_file(program)
+        with open(input_name if input_name else os.devnull) as stdin:
+            return run([executable], stdin, args)
+
+
+def main():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--translator", default=os.path.join(root, "bin", "Binary_Translator.out"))
+    parser.add_argument("--timeout",    type=int, default=60)
+    args = parser.parse_args()
+
+    tests = os.path.join(root, "tests")
+    programs = sorted(os.path.join(tests, name) for name in os.listdir(tests) if name.endswith(".bin"))
+
+    n_failed = 0
+    for program in programs:
+        with open(program[:-len(".bin")] + ".expected") as file:
+            expected = file.read().splitlines()
+
+        for config in list(CONFIGS) + ["aot"]:
+            if config == "aot":
+                output, error = run_aot(args.translator, program, args)
+            else:
+                output, error = run_translator(args.translator, program, CONFIGS[config], args)
+
+            if error is None and output != expected:
+                error = first_difference(output, expected)
+
+            if error:
+                n_failed += 1
+                print("FAIL %-28s %-12s %s" % (os.path.basename(program), config, error))
+
+    n_runs = len(programs) * (len(CONFIGS) + 1)
+    print("%d of %d runs passed" % (n_runs - n_failed, n_runs))
+
+    return 1 if n_failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())